@@ -10,8 +10,12 @@ layout(set = 0, binding = 6, scalar) readonly buffer materialBuffer { StandardMa
 layout (set = 0, binding = 2) uniform ShadowMappingSettingsBlock {
   ShadowFragmentSettings shadowSettings;
 };
-layout(set = 0, binding = 1) uniform sampler2D shadowDepth;
+layout(set = 0, binding = 1) uniform sampler2DArrayShadow shadowDepth; // a layer per cascade
 layout(set = 0, binding = 3) uniform sampler2D ssaoAmbient;
+layout(set = 0, binding = 9) uniform sampler2D shadowMask; // half resolution lit fraction of the depth prepass
+layout(set = 0, binding = 10) uniform ClusterGridBlock { ClusterGrid clusterGrid; };
+layout(set = 0, binding = 11, scalar) readonly buffer lightBuffer { GPULight lights[]; };
+layout(set = 0, binding = 12) readonly buffer clusterBuffer { uint clusterLights[]; };
 
 layout(set = 1, binding = 0) uniform texture2D global_textures[];
 layout(set = 1, binding = 1) uniform sampler global_samplers[];
@@ -21,82 +25,17 @@ layout (location = 0) in vec3 inNormal;
 layout (location = 1) in vec3 inColor;
 layout (location = 2) in vec2 inUV;
 layout (location = 3) in flat uint material_idx;
-layout (location = 4) in vec4 inPosLightSpace;
-
-
-layout (location = 0) out vec4 outColour;
-
-const vec2 pDisk[16] = vec2[](
-vec2(0.91222, 0.38802), /* start early bailing samples*/
-vec2(0.27429, 0.72063),
-vec2(-0.59791, 0.55189),
-vec2(-0.67385, -0.52580),
-vec2(0.09907, -0.72597),
-vec2(0.66040, -0.25044), /* end early bailing samples*/
-vec2(0.06297, 0.05615),
-vec2(0.42948, 0.25584),
-vec2(0.39460, 0.53219),
-vec2(0.38904, 0.60419),
-vec2(0.79025, 0.30594),
-vec2(0.15336, 0.27664),
-vec2(0.11991, 0.51297),
-vec2(-0.03102, 0.62509),
-vec2(-0.21704, 0.81630),
-vec2(-0.38587, 0.89740));
-
-
-float IGN(vec2 fragCoord) {
-    return mod(52.9829189 * mod(0.06711056 * fragCoord.x + 0.00583715 * fragCoord.y + 0.00314159, 1.0), 1.0);
-}
-
-vec2 rotate(vec2 v, float angle) {
-    float cosAngle = cos(angle);
-    float sinAngle = sin(angle);
-    return vec2(
-        cosAngle * v.x - sinAngle * v.y,
-        sinAngle * v.x + cosAngle * v.y
-    );
-}
-
-float shadow_pcf(vec3 projCoords, float radius)
-{
-  float shadow = 0.0f;
-  float currentDepth = projCoords.z;
-   
-  if (currentDepth < 0.0)
-    return 0.0;
-
-  for (int i = 0; i < 6; i++)
-  {
-    vec2 dir = pDisk[i];
-    float randAngle = IGN(gl_FragCoord.xy) * 2 * PI;
-    dir = rotate(dir, randAngle);
-
-    float pcfDepth = texture(shadowDepth, projCoords.xy + (dir*radius)).r;
-    shadow += pcfDepth > currentDepth /*+ bias*/ ? 1.0 : 0.0;
-  }
-  
-  // NOTE: early bailing
-  if (shadow < 0.01  || shadow > 5.99)
-  {
-    return shadow < 0.01 ? 0.0 : 1.0;
-  }
-
+layout (location = 4) in vec3 inPosWorld;
 
-  for (int i = 6; i < 16; i++)
-  {
-    vec2 dir = pDisk[i];
-    float randAngle = IGN(gl_FragCoord.xy) * 2 * PI;
-    dir = rotate(dir, randAngle);
-
-    float pcfDepth = texture(shadowDepth, projCoords.xy + (dir*radius)).r;
-    shadow += pcfDepth > currentDepth /*+ bias*/ ? 1.0 : 0.0;
-  }
 
-  return shadow /= 16;
-}
+layout (location = 0) out vec4 outColour;     // weighted premultiplied colour and weight with WEIGHTED_OIT
+layout (location = 1) out float outRevealage; // coverage, only with WEIGHTED_OIT
 
+// transparent_set drawn into the accumulation and revealage targets instead of the draw image
+layout(constant_id = 2) const bool WEIGHTED_OIT = false;
 
+#include "shadows.glsl"
+#include "lights.glsl"
 
 void main() 
 {
@@ -108,21 +47,47 @@ void main()
   
   vec4 albedo = texture(sampler2D(global_textures[sampled], global_samplers[samp]), inUV) * vec4(inColor, 1.0) * vec4(mat.modulate, 1.0);
   float lightValue = max(dot(inNormal, sceneData.sunlightDirection.xyz), 0.1f);
+  float viewDepth = -(sceneData.view * vec4(inPosWorld, 1.0)).z;
   
   if (shadowSettings.enabled == 1 && mat.strength < 1.01)
   {
-    vec3 projCoords = inPosLightSpace.xyz / inPosLightSpace.w;
-    projCoords = projCoords * vec3(0.5, 0.5, 1.0) + vec3(0.5, 0.5, 0.0);
-    float shadow_value = 1.0 - shadow_pcf(projCoords, shadowSettings.softness); // shadow softness parameter!
+    // opaque geometry is in the depth prepass, the mask already resolved it
+    float shadow_value = shadowSettings.screenMask == 1
+      ? texture(shadowMask, min(gl_FragCoord.xy * 0.5, shadowSettings.maskExtent - 0.5) / vec2(textureSize(shadowMask, 0))).r
+      : 1.0 - shadow_cascaded(inPosWorld, viewDepth, gl_FragCoord.xy);
     lightValue *= shadow_value;
     lightValue = max(lightValue, 0.1f);
   }
 
 
-  float ssao = texture(ssaoAmbient, gl_FragCoord.xy / vec2(1280, 800)).r;
+  // the ssao image covers the whole draw image, the drawn part starts at its origin
+  float ssao = texture(ssaoAmbient, gl_FragCoord.xy / vec2(textureSize(ssaoAmbient, 0))).r;
+
+  // only the lights binned into this fragments cluster are looked at
+  vec3 localLight = vec3(0.0);
+  uint clusterCount = 0;
+  if (clusterGrid.lightCount > 0)
+  {
+    localLight = clustered_lighting(inPosWorld, normalize(inNormal), viewDepth, gl_FragCoord.xy, clusterCount);
+  }
 
-  vec4 color = albedo * lightValue * (ssao);
+  vec4 color = albedo * (vec4(localLight, 0.0) + lightValue) * (ssao);
   color += vec4(mat.emissions * mat.strength, 1.0f);
+
+  if (clusterGrid.heatmap == 1)
+  {
+    color.rgb = clusterCount == 0 ? color.rgb * 0.25 : mix(color.rgb, cluster_heat(clusterCount), 0.75);
+  }
+
+  if (WEIGHTED_OIT)
+  {
+    // order independent, the weight falls off with view depth so the nearer surfaces dominate (mcguire & bavoil 2013)
+    float alpha = clamp(albedo.a, 0.0, 1.0);
+    float weight = alpha * clamp(10.0 / (1e-5 + pow(viewDepth / 5.0, 2.0) + pow(viewDepth / 200.0, 6.0)), 1e-2, 3e3);
+    outColour = vec4(color.rgb * alpha, alpha) * weight;
+    outRevealage = alpha;
+    return;
+  }
     
   outColour = color;   
 }
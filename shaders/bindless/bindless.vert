@@ -24,7 +24,7 @@ layout (location = 0) out vec3 outNormal;
 layout (location = 1) out vec3 outColor;
 layout (location = 2) out vec2 outUV;
 layout (location = 3) out flat uint material_idx;
-layout (location = 4) out vec4 outPosLightSpace;
+layout (location = 4) out vec3 outPosWorld; // the fragment picks the shadow cascade
 
 vec3 decode_normal(vec2 f)
 {
@@ -57,7 +57,7 @@ void main()
 
   material_idx = dd.material_idx;
 
-  outPosLightSpace = shadowSettings.lightViewProj * vec4(positionWorld, 1.0f);
+  outPosWorld = positionWorld;
 }
 
 #endif
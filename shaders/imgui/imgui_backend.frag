@@ -3,8 +3,9 @@
 
 #ifndef __cplusplus
 
-layout (set = 1, binding = 0) uniform texture2D global_textures[];
-layout (set = 1, binding = 1) uniform sampler global_samplers[];
+// the bindless set is the only one in the imgui layout
+layout (set = 0, binding = 0) uniform texture2D global_textures[];
+layout (set = 0, binding = 1) uniform sampler global_samplers[];
 
 layout (location = 0) in vec4 inColour;
 layout (location = 1) in vec2 inUV;
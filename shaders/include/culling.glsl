@@ -0,0 +1,198 @@
+#ifndef CULLING_GLSL
+#define CULLING_GLSL
+
+#include "common.h"
+#include "input_structures.glsl"
+
+// two phase occlusion culling: the early phase draws what was visible last frame, the depth pyramid
+// is built from that and the late phase tests everything against it, drawing only what became visible
+#define CULL_PHASE_EARLY 0
+#define CULL_PHASE_LATE 1
+
+// the cull shader compacts visible draws in the same dispatch, culling.compaction picks how
+#define CULL_GROUP_SIZE 1024
+#define COMPACTION_LOOKBACK 0 // decoupled look-back prefix sum, keeps draw order
+#define COMPACTION_APPEND 1   // one atomic per subgroup on the indirect count, unordered
+
+// views tested in one dispatch, view 0 is the camera and the only one with occlusion culling
+#define MAX_CULL_VIEWS 8
+
+// look-back state of a group: flag in the top 2 bits, count in the rest
+#define LOOKBACK_AGGREGATE (1u << 30) // count of the group itself
+#define LOOKBACK_PREFIX (2u << 30)    // count of the group and every group before it
+#define LOOKBACK_FLAGS (3u << 30)
+
+// written by the late phase, read back on the cpu once the frame has finished
+struct CullCounters
+{
+  uint32_ar frustum_culled;
+  uint32_ar occlusion_culled;
+  uint32_ar early_draws;
+  uint32_ar late_draws;
+};
+
+#ifndef __cplusplus
+layout(scalar, buffer_reference) buffer VisibilityBuffer{
+  uint32_ar data[];
+};
+
+layout(scalar, buffer_reference) buffer CullCounterBuffer{
+  CullCounters counters;
+};
+
+// zeroed before every dispatch. groups take their id from next_group so a group only ever waits on running ones.
+// state is view major, view * groups + group
+layout(scalar, buffer_reference) buffer LookbackBuffer{
+  uint32_ar next_group;
+  uint32_ar state[];
+};
+#endif
+
+// one frustum the draws are tested against and the indirect list its visible draws are compacted into
+struct CullView
+{
+  vec4_ar planes[6]; // world space, xyz points inside
+  buffer_ar(IndirectDrawBuffer) ids;
+  buffer_ar(IndirectCountBuffer) indirect_count;
+};
+
+#ifndef __cplusplus
+layout(scalar, buffer_reference) readonly buffer CullViewBuffer{
+  CullView views[];
+};
+#endif
+
+struct OcclusionCullData
+{
+  mat4_ar view;          // camera view, spheres are tested in view space
+  vec4_ar proj;          // P00, abs(P11), P22, P32, enough to project a view space sphere
+  vec2_ar extent;        // draw extent the depth pyramid was built from
+  vec2_ar pyramid_size;  // level 0 of the pyramid for that extent
+  float_ar znear;
+  uint32_ar pyramid_levels;
+  uint32_ar phase;
+  uint32_ar enabled;     // 0 = frustum only, everything goes into the early phase
+  buffer_ar(VisibilityBuffer) history_read;  // visibility of last frame
+  buffer_ar(VisibilityBuffer) history_write; // visibility of this frame, written by the late phase
+  buffer_ar(CullCounterBuffer) counters;
+};
+
+#ifndef __cplusplus
+layout(scalar, buffer_reference) readonly buffer OcclusionCullBuffer{
+  OcclusionCullData data;
+};
+#endif
+
+struct indirect_cull_pcs
+{
+#ifdef __cplusplus
+    indirect_cull_pcs()
+        : views{0}, lookback{0}, occlusion{0}, draw_count{0}, view_count{1} {}
+#endif
+    buffer_ar(CullViewBuffer) views;
+    buffer_ar(LookbackBuffer) lookback; // only used by COMPACTION_LOOKBACK
+    buffer_ar(OcclusionCullBuffer) occlusion;
+    uint32_ar draw_count;
+    uint32_ar view_count;
+};
+
+
+#ifndef __cplusplus
+
+// bounding sphere of a draw in world space, radius scaled by the largest axis of the transform
+vec4 world_sphere(vec4 bounds, mat4x3 transform)
+{
+  vec3 centre = transform * vec4(bounds.xyz, 1.0);
+  float scale = max(max(length(transform[0]), length(transform[1])), length(transform[2]));
+  return vec4(centre, bounds.w * scale);
+}
+
+bool in_frustum(vec4 sphere, CullView view)
+{
+  bool visible = true;
+  for (int i = 0; i < 6; i++)
+  {
+    visible = visible && dot(view.planes[i].xyz, sphere.xyz) + view.planes[i].w > -sphere.w;
+  }
+  return visible;
+}
+
+// projects the sphere to a screen rect (2D Polyhedral Bounds of a Clipped, Perspective-Projected 3D Sphere, Mara & McGuire)
+// and compares its closest depth with the farthest depth of the pyramid texels under it
+bool occlusion_visible(vec4 sphere, OcclusionCullData occ, sampler2D pyramid)
+{
+  // view space looks down -z
+  vec3 c = vec3(sphere.x, sphere.y, -sphere.z);
+  float r = sphere.w;
+
+  // crosses the near plane, cant be projected
+  if (c.z < r + occ.znear)
+    return true;
+
+  vec2 cx = -c.xz;
+  vec2 vx = vec2(sqrt(dot(cx, cx) - r * r), r);
+  vec2 minx = mat2(vx.x, vx.y, -vx.y, vx.x) * cx;
+  vec2 maxx = mat2(vx.x, -vx.y, vx.y, vx.x) * cx;
+
+  vec2 cy = -c.yz;
+  vec2 vy = vec2(sqrt(dot(cy, cy) - r * r), r);
+  vec2 miny = mat2(vy.x, vy.y, -vy.y, vy.x) * cy;
+  vec2 maxy = mat2(vy.x, -vy.y, vy.y, vy.x) * cy;
+
+  vec4 aabb = vec4(minx.x / minx.y * occ.proj.x, miny.x / miny.y * occ.proj.y, maxx.x / maxx.y * occ.proj.x, maxy.x / maxy.y * occ.proj.y);
+  aabb = clamp(aabb.xwzy * vec4(0.5, -0.5, 0.5, -0.5) + vec4(0.5), 0.0, 1.0); // clip -> uv, y points down
+
+  // pick the level where the rect covers at most 2x2 texels, a level i texel spans 2^(i+1) pixels
+  vec2 pixels = (aabb.zw - aabb.xy) * occ.extent;
+  int level = int(min(ceil(log2(max(max(pixels.x, pixels.y), 1.0))), float(occ.pyramid_levels - 1)));
+
+  ivec2 size = max(ivec2(occ.pyramid_size) >> level, ivec2(1));
+  ivec2 lo = clamp(ivec2(aabb.xy * occ.extent) >> (level + 1), ivec2(0), size - 1);
+  ivec2 hi = clamp(ivec2(aabb.zw * occ.extent) >> (level + 1), ivec2(0), size - 1);
+
+  float farthest = min(
+    min(texelFetch(pyramid, lo, level).r, texelFetch(pyramid, ivec2(hi.x, lo.y), level).r),
+    min(texelFetch(pyramid, ivec2(lo.x, hi.y), level).r, texelFetch(pyramid, hi, level).r)
+  );
+
+  // reverse z, the closest point of the sphere has the greatest depth
+  float z = sphere.z + r;
+  float closest = (occ.proj.z * z + occ.proj.w) / -z;
+  return closest >= farthest;
+}
+
+// whether draw idx is emitted by the camera in the current phase, the late phase also records history and counters
+bool cull_draw(uint idx, vec4 sphere, CullView camera, OcclusionCullBuffer occlusion, sampler2D pyramid)
+{
+  bool frustumVisible = in_frustum(sphere, camera);
+
+  OcclusionCullData occ = occlusion.data;
+  if (occ.enabled == 0)
+    return frustumVisible;
+
+  bool wasVisible = occ.history_read.data[idx] != 0;
+  if (occ.phase == CULL_PHASE_EARLY)
+    return frustumVisible && wasVisible;
+
+  vec4 viewSphere = vec4((occ.view * vec4(sphere.xyz, 1.0)).xyz, sphere.w);
+  bool visible = frustumVisible && occlusion_visible(viewSphere, occ, pyramid);
+  bool emit = visible && !wasVisible;
+
+  occ.history_write.data[idx] = uint(visible);
+
+  // one atomic per subgroup instead of per draw
+  uvec4 counts = subgroupAdd(uvec4(!frustumVisible, frustumVisible && !visible, frustumVisible && wasVisible, emit));
+  if (subgroupElect())
+  {
+    atomicAdd(occ.counters.counters.frustum_culled, counts.x);
+    atomicAdd(occ.counters.counters.occlusion_culled, counts.y);
+    atomicAdd(occ.counters.counters.early_draws, counts.z);
+    atomicAdd(occ.counters.counters.late_draws, counts.w);
+  }
+
+  return emit;
+}
+
+#endif // is glsl
+
+#endif // CULLING_GLSL
@@ -17,11 +17,15 @@ struct GPUSceneData
   vec4_ar sunlightColor;
 };
 
+// layers of the sun shadow map, one per cascade
+#define MAX_SHADOW_CASCADES 4
+
 struct ShadowFragmentSettings
 {
 #ifdef __cplusplus
   ShadowFragmentSettings()
-    : lightViewProj{1.0f}, near{0.1f}, far{10.0f}, light_size{0.0f}, softness{0.0025}, enabled{false}, texture_idx{3} {} 
+    : lightViewProj{1.0f}, near{0.1f}, far{10.0f}, light_size{0.0f}, softness{0.0025}, enabled{false}, screenMask{false},
+      cascadeCount{0}, blendBand{0.0f}, maskExtent{0.0f}, padding{0.0f}, cascadeViewProj{}, cascadeSplits{0.0f} {}
 #endif
   mat4_ar lightViewProj;
   float_ar near;
@@ -29,18 +33,70 @@ struct ShadowFragmentSettings
   float_ar light_size;
   float_ar softness;
   uint32_ar enabled;
-  uint32_ar texture_idx;
+  uint32_ar screenMask; // read the shadow mask instead of filtering, only the depth prepass geometry is in it
+  uint32_ar cascadeCount;
+  float_ar blendBand; // fraction of a cascade that fades into the next one
+  vec2_ar maskExtent; // written part of the shadow mask, the rest holds an older frame under render scale
+  vec2_ar padding;
+  // 16 byte aligned for std140
+  mat4_ar cascadeViewProj[MAX_SHADOW_CASCADES];
+  vec4_ar cascadeSplits; // camera view depth each cascade ends at
+};
+
+// punctual lights binned into a view space froxel grid, tiles of the draw extent times exponential depth slices
+#define CLUSTER_TILE_SIZE 64
+#define CLUSTER_SLICES 24
+#define MAX_LIGHTS_PER_CLUSTER 64
+
+// a point light has spotScale 0 and spotOffset 1, a spot fades over saturate(cos * spotScale + spotOffset)
+struct GPULight
+{
+  vec3_ar position;
+  float_ar range; // the light is cut off past it
+  vec3_ar colour; // times the intensity
+  float_ar spotScale;
+  vec3_ar direction;
+  float_ar spotOffset;
+};
+
+struct ClusterGrid
+{
+#ifdef __cplusplus
+  ClusterGrid()
+    : tilesX{0}, tilesY{0}, lightCount{0}, heatmap{0}, near{0.1f}, far{100.0f}, sliceScale{0.0f}, sliceBias{0.0f} {}
+#endif
+  uint32_ar tilesX;
+  uint32_ar tilesY;
+  uint32_ar lightCount; // 0 skips the cluster lookup
+  uint32_ar heatmap;    // tints the output by the lights of its cluster
+  float_ar near;        // view depth the first slice starts at
+  float_ar far;         // the last slice goes on past it
+  float_ar sliceScale;  // slice = log(view depth) * sliceScale + sliceBias
+  float_ar sliceBias;
 };
 
 struct bloom_pcs 
 {
 #ifdef __cplusplus
   bloom_pcs()
-    : srcResolution{0.0f}, filterRadius{0.0f}, mipLevel{0} {}
+    : srcResolution{0.0f}, filterRadius{0.0f}, mipLevel{0}, srcExtent{0.0f}, dstExtent{0.0f} {}
 #endif
-  vec2_ar srcResolution;
+  vec2_ar srcResolution; // size of the source image
   float_ar filterRadius;
   uint32_ar mipLevel;
+  vec2_ar srcExtent; // drawn part of the source, render scale shrinks it
+  vec2_ar dstExtent;
+};
+
+struct upscale_pcs
+{
+#ifdef __cplusplus
+  upscale_pcs()
+    : srcExtent{0.0f}, dstExtent{0.0f}, sharpness{0.0f} {}
+#endif
+  vec2_ar srcExtent; // drawn part of the source, the output covers the same view
+  vec2_ar dstExtent;
+  float_ar sharpness; // 0 skips the sharpening
 };
 
 
@@ -98,6 +154,7 @@ struct DrawData
   uint32_ar mesh_idx;
   uint32_ar indexCount;
   uint32_ar firstIndex;
+  uint32_ar bounds_idx; // one sphere per surface, mesh_idx is per node
 };
 
 struct IndirectDraw
@@ -169,14 +226,6 @@ layout(scalar, buffer_reference) buffer BoundsBuffer{
   vec4_ar data[];
 };
 
-layout(scalar, buffer_reference) buffer PartialSums{
-  uint32_ar data[];
-};
-
-
-layout(scalar, buffer_reference) buffer OutputCulling{
-  uint32_ar data[];
-};
 
 #endif // is glsl
 
@@ -0,0 +1,69 @@
+#ifndef LIGHTS_GLSL
+#define LIGHTS_GLSL
+
+#include "common.h"
+#include "input_structures.glsl"
+
+#ifndef __cplusplus
+
+// clustered punctual lights, shared by the light culling pass and the forward shader.
+// the includer declares clusterGrid (ClusterGrid) and lights (GPULight[]), the forward shader also
+// clusterLights (uint[], per cluster a count followed by MAX_LIGHTS_PER_CLUSTER light indices)
+
+// start of the cluster in clusterLights
+uint cluster_base(uvec2 tile, uint slice)
+{
+  return ((slice * clusterGrid.tilesY + tile.y) * clusterGrid.tilesX + tile.x) * (MAX_LIGHTS_PER_CLUSTER + 1);
+}
+
+uint cluster_slice(float viewDepth)
+{
+  float slice = log(max(viewDepth, clusterGrid.near)) * clusterGrid.sliceScale + clusterGrid.sliceBias;
+  return min(uint(max(slice, 0.0)), CLUSTER_SLICES - 1);
+}
+
+// view depth the slice starts at, the one past the last is far
+float slice_depth(uint slice)
+{
+  return clusterGrid.near * pow(clusterGrid.far / clusterGrid.near, float(slice) / float(CLUSTER_SLICES));
+}
+
+// windowed inverse square, reaches 0 at the range
+vec3 punctual_light(GPULight light, vec3 posWorld, vec3 normal)
+{
+  vec3 toLight = light.position - posWorld;
+  float distSq = dot(toLight, toLight);
+  float rangeSq = light.range * light.range;
+  if (distSq >= rangeSq)
+    return vec3(0.0);
+
+  vec3 l = toLight * inversesqrt(max(distSq, 1e-8));
+  float window = clamp(1.0 - (distSq * distSq) / (rangeSq * rangeSq), 0.0, 1.0);
+  float attenuation = window * window / max(distSq, 0.01);
+
+  float spot = clamp(dot(-l, light.direction) * light.spotScale + light.spotOffset, 0.0, 1.0);
+  return light.colour * (max(dot(normal, l), 0.0) * attenuation * spot * spot);
+}
+
+vec3 clustered_lighting(vec3 posWorld, vec3 normal, float viewDepth, vec2 fragCoord, out uint count)
+{
+  uint base = cluster_base(uvec2(fragCoord) / CLUSTER_TILE_SIZE, cluster_slice(viewDepth));
+  count = clusterLights[base];
+
+  vec3 lit = vec3(0.0);
+  for (uint i = 0; i < count; i++)
+  {
+    lit += punctual_light(lights[clusterLights[base + 1 + i]], posWorld, normal);
+  }
+  return lit;
+}
+
+// blue through green to red as the cluster fills up
+vec3 cluster_heat(uint count)
+{
+  float t = clamp(float(count) / float(MAX_LIGHTS_PER_CLUSTER), 0.0, 1.0);
+  return clamp(vec3(t * 2.0 - 1.0, 1.0 - abs(t * 2.0 - 1.0), 1.0 - t * 2.0), 0.0, 1.0);
+}
+
+#endif // is glsl
+#endif // LIGHTS_GLSL
@@ -0,0 +1,112 @@
+#ifndef SHADOWS_GLSL
+#define SHADOWS_GLSL
+
+#include "common.h"
+#include "input_structures.glsl"
+
+#ifndef __cplusplus
+
+// cascaded sun shadows, shared by the forward shader and the screen space shadow mask.
+// the includer declares shadowSettings (ShadowFragmentSettings) and shadowDepth (sampler2DArrayShadow,
+// compares with GREATER so a tap is 1 where the reference is in front of the caster)
+
+// baked per pipeline variant (shadow_mapping.pcf_taps) so the tap loops unroll
+layout(constant_id = 0) const uint PCF_TAPS = 16;
+layout(constant_id = 1) const uint PCF_EARLY_TAPS = 6; // taken first, fully lit or shadowed bails out
+
+const vec2 pDisk[16] = vec2[](
+vec2(0.91222, 0.38802), /* start early bailing samples*/
+vec2(0.27429, 0.72063),
+vec2(-0.59791, 0.55189),
+vec2(-0.67385, -0.52580),
+vec2(0.09907, -0.72597),
+vec2(0.66040, -0.25044), /* end early bailing samples*/
+vec2(0.06297, 0.05615),
+vec2(0.42948, 0.25584),
+vec2(0.39460, 0.53219),
+vec2(0.38904, 0.60419),
+vec2(0.79025, 0.30594),
+vec2(0.15336, 0.27664),
+vec2(0.11991, 0.51297),
+vec2(-0.03102, 0.62509),
+vec2(-0.21704, 0.81630),
+vec2(-0.38587, 0.89740));
+
+
+float IGN(vec2 fragCoord) {
+    return mod(52.9829189 * mod(0.06711056 * fragCoord.x + 0.00583715 * fragCoord.y + 0.00314159, 1.0), 1.0);
+}
+
+// per pixel rotation of the disk scaled by the filter radius, built once and shared by every tap and cascade
+mat2 pcf_rotation(vec2 pixel, float radius)
+{
+  float angle = IGN(pixel) * 2 * PI;
+  float c = cos(angle) * radius;
+  float s = sin(angle) * radius;
+  return mat2(c, s, -s, c);
+}
+
+// every tap is a 2x2 filtered hardware compare
+float shadow_pcf(vec3 projCoords, float layer, mat2 rotation)
+{
+  float currentDepth = projCoords.z;
+
+  if (currentDepth < 0.0)
+    return 0.0;
+
+  float lit = 0.0f;
+  for (uint i = 0; i < PCF_EARLY_TAPS; i++)
+  {
+    lit += texture(shadowDepth, vec4(projCoords.xy + rotation * pDisk[i], layer, currentDepth));
+  }
+
+  // NOTE: early bailing
+  if (PCF_EARLY_TAPS < PCF_TAPS && (lit < 0.01 || lit > float(PCF_EARLY_TAPS) - 0.01))
+  {
+    return lit < 0.01 ? 1.0 : 0.0;
+  }
+
+  for (uint i = PCF_EARLY_TAPS; i < PCF_TAPS; i++)
+  {
+    lit += texture(shadowDepth, vec4(projCoords.xy + rotation * pDisk[i], layer, currentDepth));
+  }
+
+  return 1.0 - lit / float(PCF_TAPS);
+}
+
+float cascade_shadow(vec3 posWorld, uint cascade, mat2 rotation)
+{
+  vec4 posLightSpace = shadowSettings.cascadeViewProj[cascade] * vec4(posWorld, 1.0);
+  vec3 projCoords = posLightSpace.xyz / posLightSpace.w;
+  projCoords = projCoords * vec3(0.5, 0.5, 1.0) + vec3(0.5, 0.5, 0.0);
+  return shadow_pcf(projCoords, float(cascade), rotation);
+}
+
+// shadowed fraction from the first cascade that reaches the view depth, the last band of each cascade fades
+// into the next one. past the last split everything is lit
+float shadow_cascaded(vec3 posWorld, float viewDepth, vec2 pixel)
+{
+  uint count = shadowSettings.cascadeCount;
+  if (count == 0 || viewDepth >= shadowSettings.cascadeSplits[count - 1])
+    return 0.0;
+
+  uint cascade = 0;
+  while (cascade < count - 1 && viewDepth > shadowSettings.cascadeSplits[cascade])
+    cascade++;
+
+  mat2 rotation = pcf_rotation(pixel, shadowSettings.softness);
+  float shadow = cascade_shadow(posWorld, cascade, rotation);
+
+  float begin = cascade == 0 ? 0.0 : shadowSettings.cascadeSplits[cascade - 1];
+  float end = shadowSettings.cascadeSplits[cascade];
+  float band = (end - begin) * shadowSettings.blendBand;
+  if (band > 0.0 && viewDepth > end - band)
+  {
+    float next = cascade + 1 < count ? cascade_shadow(posWorld, cascade + 1, rotation) : 0.0;
+    shadow = mix(next, shadow, (end - viewDepth) / band);
+  }
+  return shadow;
+}
+
+#endif // is glsl
+#endif // SHADOWS_GLSL
@@ -1,6 +1,8 @@
 #include "application.h"
 #include "lucerna_pch.h"
 #include "la_asserts.h"
+#include "job_system.h"
+#include "vk_loader.h"
 
 #include "toml++/impl/forward_declarations.hpp"
 #include "toml++/impl/node.hpp"
@@ -8,16 +10,20 @@
 
 namespace Lucerna {
 
-  Application::Application()
+  Application::Application(int argc, char* argv[])
   {
 
     toml::parse_result result = toml::parse_file("config/configuration.toml");
-    if (!result.succeeded())
+    // NOTE: headless runs on ci boxes may not ship a config, fall back to the defaults below
+    toml::table toml{};
+    if (result.succeeded())
     {
-      // AR_CORE_ERROR("Error loading configuration file!");
-      return;
+      toml = result.table();
+    }
+    else
+    {
+      LA_LOG_WARN("Error loading configuration file, using defaults!");
     }
-        auto toml = result.table();
     // AR_CORE_TRACE("Loaded configuration.toml");
 
     config.scene_path = toml["startup"]["scene_path"].value_or("assets/structure.glb");
@@ -33,17 +39,86 @@ namespace Lucerna {
       toml["general"]["internal_resolution"][1].value_or(config.resolution.y)
     };
     
+    parse_arguments(argc, argv);
+
+    JobSystem::init();
+
+    if (!config.bench_load_dir.empty())
+    {
+      return;
+    }
+
+    if (config.headless)
+    {
+      LA_LOG_INFO("Running headless for {} frames ({})", config.frames, config.scene_path);
+      return;
+    }
+    
     Window::init("lucerna-dev", config.resolution.x, config.resolution.y);
   }
 
   Application::~Application()
   {
     // finish logging into a file
-    Window::shutdown(); 
+    if (!config.headless && config.bench_load_dir.empty())
+    {
+      Window::shutdown(); 
+    }
+
+    JobSystem::shutdown();
+  }
+
+  void Application::parse_arguments(int argc, char* argv[])
+  {
+    for (int i = 1; i < argc; i++)
+    {
+      std::string_view arg = argv[i];
+      bool has_value = i + 1 < argc;
+
+      if (arg == "--headless")
+      {
+        config.headless = true;
+      }
+      else if (arg == "--frames" && has_value)
+      {
+        config.frames = std::max(1, std::atoi(argv[++i]));
+      }
+      else if (arg == "--frames-in-flight" && has_value)
+      {
+        config.frames_in_flight = std::clamp(std::atoi(argv[++i]), 1, (int) MAX_FRAMES_IN_FLIGHT);
+      }
+      else if (arg == "--pipeline-cache" && has_value)
+      {
+        config.pipeline_cache_path = argv[++i];
+      }
+      else if (arg == "--scene" && has_value)
+      {
+        config.scene_path = argv[++i];
+      }
+      else if (arg == "--report" && has_value)
+      {
+        config.report_path = argv[++i];
+      }
+      else if (arg == "--bench-load")
+      {
+        bool has_dir = has_value && argv[i + 1][0] != '-';
+        config.bench_load_dir = has_dir ? argv[++i] : "assets";
+      }
+      else
+      {
+        LA_LOG_WARN("Ignoring unknown argument {}", arg);
+      }
+    }
   }
 
   void Application::run()
   {
+    if (!config.bench_load_dir.empty())
+    {
+      benchmark_gltf_decode(config.bench_load_dir);
+      return;
+    }
+
     // NOTE: configure engine startup from args or config.toml file 
     m_Engine.init();
     m_Engine.run();
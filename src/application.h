@@ -7,7 +7,7 @@ namespace Lucerna {
   class Application
   {
     public:
-      Application();
+      Application(int argc, char* argv[]);
       ~Application();
       void run();
     public:
@@ -19,9 +19,26 @@ namespace Lucerna {
         // general
         glm::uvec2 internal_resolution;
         
+        // frames the cpu may record ahead of the gpu (--frames-in-flight N), 1 to MAX_FRAMES_IN_FLIGHT.
+        // fewer is lower latency, more keeps the gpu busy when frame costs vary (offline renders)
+        uint32_t frames_in_flight{ 2 };
+
+        // pipeline cache kept between runs (--pipeline-cache path)
+        std::string pipeline_cache_path{ "pipeline_cache.bin" };
+
         // window
         glm::uvec2 resolution;
+
+        // headless benchmark (--headless --frames N --scene X --report Y)
+        bool headless{ false };
+        uint32_t frames{ 300 };
+        std::string report_path{ "frame_report.json" };
+
+        // load benchmark (--bench-load [dir]), no window or device is created
+        std::string bench_load_dir;
       } config;
+    private:
+      void parse_arguments(int argc, char* argv[]);
     private:
       Engine m_Engine;
       Window m_Window;
@@ -0,0 +1,72 @@
+#include "dynamic_resolution.h"
+#include "gpu_profiler.h"
+#include "cvars.h"
+#include "logger.h"
+
+namespace Lucerna {
+
+AutoCVar_Int dynResEnabled("dynamic_resolution.enabled", "scale the internal resolution to hit dynamic_resolution.target_ms, needs profiler.enabled", 0, CVarFlags::EditCheckbox);
+AutoCVar_Float dynResTarget("dynamic_resolution.target_ms", "gpu frame budget in ms", 16.6f, CVarFlags::EditFloatDrag);
+AutoCVar_Float dynResHeadroom("dynamic_resolution.headroom", "fraction of the budget the frame has to be under before the scale goes up again", 0.15f, CVarFlags::Advanced);
+AutoCVar_Float dynResMinScale("dynamic_resolution.min_scale", "", 0.5f, CVarFlags::Advanced);
+AutoCVar_Float dynResMaxScale("dynamic_resolution.max_scale", "", 1.0f, CVarFlags::Advanced);
+AutoCVar_Float dynResStepDown("dynamic_resolution.step_down", "most the scale drops in one change", 0.1f, CVarFlags::Advanced);
+AutoCVar_Float dynResStepUp("dynamic_resolution.step_up", "most the scale rises in one change, smaller than step_down so it backs off fast and recovers slowly", 0.05f, CVarFlags::Advanced);
+AutoCVar_Float dynResSmoothing("dynamic_resolution.smoothing", "weight of a new reading in the filtered frame time", 0.2f, CVarFlags::Advanced);
+AutoCVar_Int dynResSettleFrames("dynamic_resolution.settle_frames", "readings at the current scale before it can change again", 8, CVarFlags::Advanced);
+
+bool DynamicResolution::enabled()
+{
+  return dynResEnabled.get();
+}
+
+float DynamicResolution::update(float scale, uint64_t frameNumber)
+{
+  if (!enabled())
+    return scale;
+
+  const float minScale = std::clamp(dynResMinScale.get(), 0.1f, 1.0f);
+  const float maxScale = std::clamp(dynResMaxScale.get(), minScale, 1.0f);
+  const float clamped = std::clamp(scale, minScale, maxScale);
+  if (clamped != scale)
+  {
+    settledFrame = frameNumber;
+    samples = 0;
+    return clamped;
+  }
+
+  // only readings of frames drawn at the current scale count
+  const GpuProfiler::FrameTimings& last = GpuProfiler::lastFrame;
+  if (last.passes.empty() || last.frame == lastSample || last.frame < settledFrame)
+    return scale;
+
+  lastSample = last.frame;
+  float ms = GpuProfiler::last_frame_ms();
+  filteredMs = samples == 0 ? ms : glm::mix(filteredMs, ms, std::clamp(dynResSmoothing.get(), 0.01f, 1.0f));
+  samples++;
+
+  if (samples < (uint32_t) std::max(dynResSettleFrames.get(), 1))
+    return scale;
+
+  // inside the band nothing changes, so a frame time near the target doesnt bounce between two scales
+  const float target = std::max(dynResTarget.get(), 0.1f);
+  const float headroom = std::clamp(dynResHeadroom.get(), 0.0f, 0.9f);
+  if (filteredMs <= target && filteredMs >= target * (1.0f - headroom))
+    return scale;
+
+  // the gpu time mostly follows the pixel count, the scale is per axis. aims for the middle of the band
+  float aim = target * (1.0f - 0.5f * headroom);
+  float wanted = scale * std::sqrt(aim / std::max(filteredMs, 0.01f));
+  float next = std::clamp(wanted, scale - std::max(dynResStepDown.get(), 0.0f), scale + std::max(dynResStepUp.get(), 0.0f));
+  next = std::clamp(next, minScale, maxScale);
+
+  if (std::abs(next - scale) < 0.005f)
+    return scale;
+
+  LA_LOG_DEBUG("Dynamic resolution: {:.2f} ms filtered, render scale {:.3f} -> {:.3f}", filteredMs, scale, next);
+  settledFrame = frameNumber;
+  samples = 0;
+  return next;
+}
+
+} // namespace Lucerna
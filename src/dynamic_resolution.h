@@ -0,0 +1,25 @@
+#pragma once
+#include "lucerna_pch.h"
+
+namespace Lucerna {
+
+  // picks the render scale from the gpu frame time the GpuProfiler reads back, so the frame fits the budget of
+  // dynamic_resolution.target_ms. the readings are filtered and the scale only moves when the filtered time leaves
+  // the band between target * (1 - headroom) and target, at most a step per change. after a change it waits for
+  // frames drawn at the new scale before it looks again, the profiler reads back frames in flight late.
+  // needs profiler.enabled, without readings the scale stays where it is
+  class DynamicResolution
+  {
+    public:
+      // once per frame before the draw extent is worked out, scale is what the last frame was drawn at
+      static float update(float scale, uint64_t frameNumber);
+      static bool enabled();
+      static float filtered_ms() { return filteredMs; }
+    private:
+      static inline float filteredMs{ 0.0f };
+      static inline uint64_t lastSample{ UINT64_MAX }; // profiler frame that last went into the filter
+      static inline uint64_t settledFrame{ 0 }; // first frame drawn at the current scale
+      static inline uint32_t samples{ 0 }; // filtered since settledFrame
+  };
+
+} // namespace Lucerna
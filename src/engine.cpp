@@ -17,12 +17,17 @@
 #include "vk_swapchain.h"
 #include "gfx_effects.h"
 #include <GLFW/glfw3.h>
+#include <bit>
 #include <cstring>
 #include <format>
 #include <vulkan/vulkan_core.h>
 #include "vk_types.h"
 #include "imgui_backend.h"
 #include "renderer.h"
+#include "frame_report.h"
+#include "gpu_profiler.h"
+#include "job_system.h"
+#include "dynamic_resolution.h"
 
 #define VMA_IMPLEMENTATION
 #include "vk_mem_alloc.h"
@@ -39,6 +44,19 @@ AutoCVar_Int shadowEnabled("shadow_mapping.enabled", "is shadow mapping enabled"
 AutoCVar_Int shadowViewFromLight("shadow_mapping.view_from_light", "view scene from view of directional light shadow caster", 0, CVarFlags::EditCheckbox);
 AutoCVar_Int shadowRotateLight("shadow_mapping.rotate_light", "rotate light around origin showcasing real time shadows", 1, CVarFlags::EditCheckbox);
 AutoCVar_Float shadowSoftness("shadow_mapping.softness", "radius of pcf sampling", 0.0025, CVarFlags::None);
+AutoCVar_Int shadowPcfTaps("shadow_mapping.pcf_taps", "pcf taps in [1, 16], the first 6 decide if the rest are needed. baked into the mesh and shadow mask pipelines", 16, CVarFlags::None);
+AutoCVar_Int shadowCascades("shadow_mapping.cascades", "shadow cascades in [1, 4] the camera frustum is split into", 4, CVarFlags::None);
+AutoCVar_Int shadowResolution("shadow_mapping.resolution", "width and height of every cascade, the shadow map is recreated when it changes", 2048, CVarFlags::Advanced);
+AutoCVar_Float shadowDistance("shadow_mapping.distance", "view depth the last cascade ends at, capped by camera.far", 100.0, CVarFlags::None);
+AutoCVar_Float shadowSplitLambda("shadow_mapping.split_lambda", "0 splits the cascades uniformly, 1 logarithmically", 0.75, CVarFlags::EditFloatDrag);
+AutoCVar_Float shadowBlendBand("shadow_mapping.blend_band", "fraction at the end of a cascade that fades into the next one, 0 is a hard switch", 0.1, CVarFlags::EditFloatDrag);
+AutoCVar_Int shadowCacheEnabled("shadow_mapping.cache", "keep the cascades between frames and only render the ones whose fit or casters changed", 1, CVarFlags::EditCheckbox);
+AutoCVar_Float shadowCasterRange("shadow_mapping.caster_range", "how far towards the light casters outside a cascade still cast into it", 50.0, CVarFlags::Advanced);
+
+AutoCVar_Int lightsCount("lights.count", "point and spot lights scattered over the scene in [0, 4096], regenerated when it changes", 256, CVarFlags::None);
+AutoCVar_Float lightsRange("lights.range", "distance the scattered lights reach", 6.0, CVarFlags::None);
+AutoCVar_Float lightsIntensity("lights.intensity", "brightness of the scattered lights", 8.0, CVarFlags::None);
+AutoCVar_Float lightsSpotFraction("lights.spot_fraction", "part of the scattered lights that are spots pointing down", 0.25, CVarFlags::EditFloatDrag);
 
 AutoCVar_Int debugLinesEnabled("debug.show_lines", "", 0, CVarFlags::EditCheckbox);
 AutoCVar_Int debugFrustumFreeze("debug.freeze_frustum", "", 0, CVarFlags::EditCheckbox);
@@ -51,6 +69,9 @@ AutoCVar_Int ssaoDisplayTexture("ssao.display_texture", "", 0, CVarFlags::EditCh
 AutoCVar_Float ssaoKernelRadius("ssao.kernel_radius", "", 0.0, CVarFlags::None);
 AutoCVar_Int ssaoEnabled("ssao.enabled", "", 1, CVarFlags::EditCheckbox);
 
+AutoCVar_Int asyncCompute("render.async_compute", "run culling, the depth pyramid and ssao on the compute queue", 1, CVarFlags::EditCheckbox);
+AutoCVar_Int parallelRecording("render.parallel_recording", "record the passes into secondary command buffers on the job system", 1, CVarFlags::EditCheckbox);
+
 
 
 
@@ -67,6 +88,8 @@ void Engine::init()
   s_Instance = this;
   
   internalExtent = {Application::config.internal_resolution.x, Application::config.internal_resolution.y, 1};
+  framesInFlight = Application::config.frames_in_flight;
+  LA_LOG_ASSERT(framesInFlight >= 1 && framesInFlight <= MAX_FRAMES_IN_FLIGHT, "Frames in flight has to be between 1 and {}", MAX_FRAMES_IN_FLIGHT);
 
   init_vulkan();
   
@@ -84,9 +107,12 @@ void Engine::init()
   sampl.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_BORDER;
   sampl.borderColor = VK_BORDER_COLOR_FLOAT_OPAQUE_BLACK;
 
-  // NOTE: linear for now, it should be shadow billinear?? hardware!
-  sampl.magFilter = VK_FILTER_NEAREST;
-  sampl.minFilter = VK_FILTER_NEAREST;
+  // hardware pcf, every tap is a bilinear filtered compare. reverse z, the reference is lit in front of the caster.
+  // the black border is depth 0, outside the cascade is lit
+  sampl.magFilter = VK_FILTER_LINEAR;
+  sampl.minFilter = VK_FILTER_LINEAR;
+  sampl.compareEnable = VK_TRUE;
+  sampl.compareOp = VK_COMPARE_OP_GREATER;
   vkCreateSampler(device, &sampl, nullptr, &m_ShadowSampler);
   
   init_swapchain();
@@ -94,13 +120,19 @@ void Engine::init()
   init_sync_structures();
   init_descriptors();
   init_pipelines();
-  init_imgui(); 
+  if (!Application::config.headless)
+  {
+    init_imgui(); 
+  }
   init_default_data();
   
 
 
   
-  mainCamera.init();
+  if (!Application::config.headless)
+  {
+    mainCamera.init();
+  }
 
   std::string structurePath = Application::config.scene_path;
   auto structureFile = load_gltf(this, structurePath);
@@ -121,23 +153,22 @@ void Engine::init()
 
   init_draw_sets();
 
-  
-  shadowPass.buffer = create_buffer(sizeof(u_ShadowPass), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+  // textures and scene buffers go out as one batch, the first frame waits on it on the gpu instead of per resource on the cpu
+  uploader.flush();
 
-  m_DeletionQueue.push_function([=, this] {
-    destroy_buffer(shadowPass.buffer);
 
+  m_DeletionQueue.push_function([=, this] {
     destroy_buffer(mainDrawContext.sceneBuffers.indexBuffer);
     destroy_buffer(mainDrawContext.sceneBuffers.vertexBuffer);
     destroy_buffer(mainDrawContext.sceneBuffers.transformBuffer);
     destroy_buffer(mainDrawContext.sceneBuffers.materialBuffer);
     destroy_buffer(mainDrawContext.sceneBuffers.positionBuffer);
     destroy_buffer(mainDrawContext.sceneBuffers.boundsBuffer);
+    destroy_buffer(mainDrawContext.sceneBuffers.lightBuffer);
   });
 
-  // prepare gfx effects
-  bloom::prepare();
-  ssao::prepare();
+  // prepare gfx effects, bloom and ssao are built with the pipelines
+  depth_pyramid::prepare();
   
 } 
 
@@ -149,24 +180,30 @@ void Engine::shutdown()
 
   loadedScenes.clear();
   
-  vkDestroySwapchainKHR(device, m_Swapchain.handle, nullptr);
-  vkDestroySurfaceKHR(m_Instance, m_Surface, nullptr);
-  
-  for (auto view : m_Swapchain.views)
+  if (!Application::config.headless)
   {
-    vkDestroyImageView(device, view, nullptr);
+    vkDestroySwapchainKHR(device, m_Swapchain.handle, nullptr);
+    vkDestroySurfaceKHR(m_Instance, m_Surface, nullptr);
+    
+    for (auto view : m_Swapchain.views)
+    {
+      vkDestroyImageView(device, view, nullptr);
+    }
   }
   
-  for (int i = 0; i < FRAME_OVERLAP; i++)
+  for (uint32_t i = 0; i < framesInFlight; i++)
   {
     vkDestroyCommandPool(device, m_Frames[i].commandPool, nullptr);
+    for (CommandPools& pools : m_Frames[i].threadCommands)
+    {
+      pools.destroy(device);
+    }
 
-    vkDestroyFence(device, m_Frames[i].renderFence, nullptr);
     vkDestroySemaphore(device, m_Frames[i].renderSemaphore, nullptr);
     vkDestroySemaphore(device, m_Frames[i].swapchainSemaphore, nullptr);
-    
-    m_Frames[i].deletionQueue.flush();
   }
+  frameDeletionQueue.flush();
+  vkDestroySemaphore(device, frameTimeline, nullptr);
 
   m_DeletionQueue.flush();
   
@@ -183,6 +220,12 @@ bool Engine::should_quit()
 
 void Engine::run()
 {
+  if (Application::config.headless)
+  {
+    run_headless();
+    return;
+  }
+
   while (should_quit())
   {
     auto start = std::chrono::system_clock::now();
@@ -214,11 +257,67 @@ void Engine::run()
   }
 }
 
+// NOTE: each frame is waited on right after submission so the culling counts read back belong to that frame,
+// cpu_ms excludes the wait and gpu_ms comes from the frame timestamps
+void Engine::run_headless()
+{
+  FrameReport::samples.reserve(Application::config.frames);
+  GpuProfiler::historySize = Application::config.frames;
+
+  for (uint32_t i = 0; i < Application::config.frames; i++)
+  {
+    auto start = std::chrono::system_clock::now();
+
+    update_scene();
+    uint32_t slot = frame_slot();
+    uint64_t frame_idx = frameNumber;
+    draw();
+    
+    auto end = std::chrono::system_clock::now();
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+    stats.frametime = elapsed.count() / 1000.0f;
+
+    wait_frame_timeline(frame_idx + 1);
+    collect_frame_sample(slot, frame_idx, stats.frametime);
+  }
+
+  FrameReport::write_json(Application::config.report_path);
+  GpuProfiler::write_csv(std::filesystem::path(Application::config.report_path).replace_extension(".csv").string());
+}
+
+void Engine::collect_frame_sample(uint32_t frame_slot, uint64_t frame_idx, float cpu_ms)
+{
+  float gpu_ms = GpuProfiler::resolve(frame_slot) ? GpuProfiler::last_frame_ms() : 0.0f;
+
+  auto read_count = [](DrawSet& set) -> uint32_t {
+    if (set.draw_datas.size() == 0) return 0;
+    uint32_t count = *(uint32_t*) set.buffers.indirect.count.info.pMappedData;
+    if (Renderer::occlusion_active())
+      count += *(uint32_t*) set.buffers.late_indirect.count.info.pMappedData;
+    return count;
+  };
+
+  FrameReport::add_sample({
+    .frame = frame_idx,
+    .cpu_ms = cpu_ms,
+    .gpu_ms = gpu_ms,
+    .draw_count = static_cast<uint32_t>(opaque_set.draw_datas.size() + transparent_set.draw_datas.size()),
+    .opaque_visible = read_count(opaque_set),
+    .transparent_visible = read_count(transparent_set),
+    .render_scale = m_RenderScale,
+    .shadow_cascades = stats.shadow_cascades_rendered,
+  });
+}
+
 void Engine::resize_swapchain(int width, int height)
 {
   LA_LOG_ASSERT(width > 0 && height > 0, "Attempted to resize swapchain to 0x0");
 
-  vkDeviceWaitIdle(device);
+  {
+    // waiting idle counts as touching every queue, the uploader may be submitting from a loader thread
+    std::lock_guard<std::mutex> lock(graphicsQueueMutex);
+    vkDeviceWaitIdle(device);
+  }
 
   VkSwapchainKHR oldSwapchain = m_Swapchain.handle;
   for (int i = 0; i < m_Swapchain.views.size(); i++)
@@ -252,6 +351,10 @@ void Engine::update_scene()
   sceneData.proj = projection;
   sceneData.viewproj = projection * view;
 
+  // fitted to the camera frustum, before culling as the cascades are culled in the same dispatch as the camera
+  update_shadow_view();
+  update_lights();
+
   if (debugFrustumFreeze.get() == false)
   {
     lastDebugFrustum = sceneData.viewproj;
@@ -275,16 +378,39 @@ void Engine::update_scene()
   stats.scene_update_time = elapsed.count() / 1000.0f;
 }
 
+void Engine::wait_frame_timeline(uint64_t value)
+{
+  if (value == 0)
+    return;
+
+  VkSemaphoreWaitInfo waitInfo{.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO, .pNext = nullptr};
+  waitInfo.semaphoreCount = 1;
+  waitInfo.pSemaphores = &frameTimeline;
+  waitInfo.pValues = &value;
+  VK_CHECK_RESULT(vkWaitSemaphores(device, &waitInfo, UINT64_MAX));
+}
+
 void Engine::draw()
 {
   VkResult r;
-  VK_CHECK_RESULT(vkWaitForFences(device, 1, &get_current_frame().renderFence, true, 1000000000));
-  
-  get_current_frame().deletionQueue.flush();
+  // the frame framesInFlight back used this slot, with one in flight that is the last frame
+  wait_frame_timeline(get_current_frame().timelineValue);
+
+  uint64_t completed = 0;
+  VK_CHECK_RESULT(vkGetSemaphoreCounterValue(device, frameTimeline, &completed));
+  frameDeletionQueue.collect(completed);
   get_current_frame().frameDescriptors.clear_pools(device);
+  get_current_frame().frameUniforms.reset();
+  for (CommandPools& pools : get_current_frame().threadCommands)
+  {
+    pools.reset(device);
+  }
+  uploader.collect();
+
+  const bool headless = Application::config.headless;
 
   uint32_t swapchainImageIndex;
-  if (valid_swapchain)
+  if (valid_swapchain && !headless)
   {
     r = vkAcquireNextImageKHR(device, m_Swapchain.handle, 1000000000, get_current_frame().swapchainSemaphore, nullptr, &swapchainImageIndex);
     if (r == VK_ERROR_OUT_OF_DATE_KHR)
@@ -301,80 +427,350 @@ void Engine::draw()
     return;
   }
 
-  m_DrawExtent.height = glm::min(m_Swapchain.extent2d.height, m_DrawImage.imageExtent.height) * m_RenderScale;
-  m_DrawExtent.width = glm::min(m_Swapchain.extent2d.width, m_DrawImage.imageExtent.width) * m_RenderScale;
-
-  VK_CHECK_RESULT(vkResetFences(device, 1, &get_current_frame().renderFence));
+  // headless renders the whole draw image, there is no swapchain to clamp against
+  VkExtent2D targetExtent = headless ? VkExtent2D{m_DrawImage.imageExtent.width, m_DrawImage.imageExtent.height} : m_Swapchain.extent2d;
+  m_RenderScale = DynamicResolution::update(m_RenderScale, frameNumber);
+  m_DrawExtent.height = glm::max<uint32_t>(glm::min(targetExtent.height, m_DrawImage.imageExtent.height) * m_RenderScale, 1);
+  m_DrawExtent.width = glm::max<uint32_t>(glm::min(targetExtent.width, m_DrawImage.imageExtent.width) * m_RenderScale, 1);
+  depth_pyramid::set_draw_extent(m_DrawExtent);
+  // the output covers the window, the upscale stretches the drawn part of the draw image over it
+  VkExtent2D outputTarget = headless ? VkExtent2D{m_OutputImage.imageExtent.width, m_OutputImage.imageExtent.height} : m_Swapchain.extent2d;
+  m_OutputExtent.width = glm::max(glm::min(outputTarget.width, m_OutputImage.imageExtent.width), m_DrawExtent.width);
+  m_OutputExtent.height = glm::max(glm::min(outputTarget.height, m_OutputImage.imageExtent.height), m_DrawExtent.height);
 
   VkCommandBuffer cmd = get_current_frame().mainCommandBuffer;
   VK_CHECK_RESULT(vkResetCommandBuffer(cmd, 0));
   VkCommandBufferBeginInfo cmdBeginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
   VK_CHECK_RESULT(vkBeginCommandBuffer(cmd, &cmdBeginInfo))
 
+  GpuProfiler::begin_frame(cmd, frame_slot(), frameNumber);
 
   // NOTE: do i need to bind every frame? sceneData or every pipeline??
   // vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, bindless_pipeline_layout, 1, 1, &bindless_descriptor_set, 0, nullptr);
   // vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, bindless_pipeline_layout, 0, 1, &global_descriptor_set, 0, nullptr);
 
-  vklog::start_debug_label(cmd, "Compute Culling", MARKER_RED);
-  Renderer::cull_draw_set(cmd, opaque_set);
-  Renderer::cull_draw_set(cmd, transparent_set);
-  vklog::end_debug_label(cmd);
-  
+  // before recording, the passes bind what it picks
+  update_pipeline_variants();
+
+  // passes declare what they touch, the graph orders the barriers and drops what nothing reads
+  RenderGraph& graph = renderGraph;
+  std::span<CommandPools> threadPools = parallelRecording.get() ? std::span(get_current_frame().threadCommands) : std::span<CommandPools>();
+  graph.begin(frame_slot(), asyncCompute.get(), threadPools);
+
+  RGHandle drawImage = graph.import_image("Draw Image", m_DrawImage.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED);
+  RGHandle outputImage = graph.import_image("Output Image", m_OutputImage.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED);
+  // the geometry pass leaves it sampled, the cached layers have to survive the import
+  VkImageLayout shadowLayout = shadowCache.written ? VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
+  RGHandle shadowMap = graph.import_image("Shadow Map", m_ShadowDepthImage.image, VK_IMAGE_ASPECT_DEPTH_BIT, shadowLayout);
+  shadowCache.written = true;
+
+  // only alive for part of the frame, the graph aliases the ones whose passes dont overlap
+  const VkImageUsageFlags effectUsage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+  RGHandle depthImage = graph.create_image("Depth Image", {internalExtent, m_DepthImage.imageFormat, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT});
+  RGHandle ssaoAmbient = graph.create_image("SSAO Ambient", {internalExtent, ssao::outputFormat, effectUsage});
+  RGHandle ssaoBlurred = graph.create_image("SSAO Blurred", {internalExtent, ssao::outputFormat, effectUsage});
+  RGHandle shadowMask = graph.create_image("Shadow Mask", {shadow_mask::extent(), shadow_mask::outputFormat, effectUsage});
+  const VkImageUsageFlags oitUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+  RGHandle oitAccumulation = graph.create_image("OIT Accumulation", {internalExtent, weighted_oit::accumulationFormat, oitUsage});
+  RGHandle oitRevealage = graph.create_image("OIT Revealage", {internalExtent, weighted_oit::revealageFormat, oitUsage});
+  std::vector<RGHandle> bloomMips(bloom::mip_count());
+  for (uint32_t i = 0; i < bloomMips.size(); i++)
+  {
+    bloomMips[i] = graph.create_image("Bloom Mip " + std::to_string(i), {bloom::mip_extent(i), bloom::mipFormat, effectUsage});
+  }
+  RGHandle pyramid = graph.import_image("Depth Pyramid", depth_pyramid::pyramid.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_GENERAL);
+  RGHandle pyramidDebug = graph.import_image("Depth Pyramid Debug", depth_pyramid::debugImage.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_GENERAL);
+  RGHandle lightBuffer = graph.import_buffer("Lights", mainDrawContext.sceneBuffers.lightBuffer.buffer);
+  RGHandle lightClusters = graph.import_buffer("Light Clusters", light_clusters::clusterBuffer.buffer);
+
+  // indirect lists, written by the cull passes and read by the draws
+  struct ListHandles { RGHandle draws; RGHandle count; };
+  auto import_list = [&](const IndirectList& list, const std::string& name) {
+    return ListHandles{graph.import_buffer(name + " Draws", list.draws.buffer), graph.import_buffer(name + " Count", list.count.buffer)};
+  };
+  const IndirectList noList{};
+  ListHandles opaqueEarly = import_list(opaque_set.buffers.indirect, opaque_set.name);
+  ListHandles opaqueLate = import_list(opaque_set.buffers.late_indirect, opaque_set.name + " Late");
+  ListHandles transparentEarly = import_list(transparent_set.buffers.indirect, transparent_set.name);
+  ListHandles transparentLate = import_list(transparent_set.buffers.late_indirect, transparent_set.name + " Late");
+  std::vector<ListHandles> cascadeLists(cascades.count);
+  for (uint32_t c = 0; c < cascadeLists.size(); c++)
+  {
+    const IndirectList& list = c < opaque_set.buffers.view_indirect.size() ? opaque_set.buffers.view_indirect[c] : noList;
+    cascadeLists[c] = import_list(list, opaque_set.name + " Cascade " + std::to_string(c));
+  }
 
+  auto writes = [](RenderGraph::Pass& pass, ListHandles list) { pass.write(list.draws, ResourceUsage::StorageWrite).write(list.count, ResourceUsage::StorageWrite); };
+  auto draws = [](RenderGraph::Pass& pass, ListHandles list) { pass.read(list.draws, ResourceUsage::IndirectBuffer).read(list.count, ResourceUsage::IndirectBuffer); };
+
+  const bool occlusion = Renderer::occlusion_active();
+  const bool shadows = shadowEnabled.get();
+  // cached cascades are neither culled nor drawn, the cull views are contiguous so it culls up to the last dirty one
+  const uint32_t shadowDirty = shadows ? shadowCache.dirty : 0;
+  const uint32_t shadowCullViews = std::bit_width(shadowDirty);
+  const bool showPyramid = *CVarSystem::get()->get_int_cvar("culling.show_pyramid");
+  const bool bloomOn = *CVarSystem::get()->get_int_cvar("bloom.enabled");
+  const bool upscaleOn = upscale::enabled();
+  const bool shadowMaskOn = shadows && shadow_mask::enabled();
+  const uint32_t lightCount = mainDrawContext.lights.size();
+  // with nothing transparent the oit passes would only clear and composite nothing
+  const bool oitOn = weighted_oit::enabled() && transparent_set.draw_datas.size() != 0;
 
-  
-  // draw compute bg
-  vkutil::transition_image(cmd, m_DrawImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
-  draw_background(cmd);
+  {
+    RenderGraph::Pass& pass = graph.add_pass("Early Cull", RenderGraph::PassType::Compute, MARKER_RED).async_compute();
+    writes(pass, opaqueEarly);
+    writes(pass, transparentEarly);
+    for (uint32_t c = 0; c < shadowCullViews; c++)
+      writes(pass, cascadeLists[c]);
+
+    pass.record([this, shadowCullViews](VkCommandBuffer cmd) {
+      if (shadowCullViews > 0)
+      {
+        std::span<const glm::mat4> shadowViews(cascades.viewProj.data(), shadowCullViews);
+        Renderer::cull_draw_set(cmd, opaque_set, CULL_PHASE_EARLY, shadowViews);
+      }
+      else
+      {
+        Renderer::cull_draw_set(cmd, opaque_set, CULL_PHASE_EARLY);
+      }
+      Renderer::cull_draw_set(cmd, transparent_set, CULL_PHASE_EARLY);
+    });
+  }
+
+  graph.add_pass("Background", RenderGraph::PassType::Transfer, MARKER_BLUE)
+    .write(drawImage, ResourceUsage::TransferDst)
+    .record([this](VkCommandBuffer cmd) { draw_background(cmd); });
 
   // draw depth prepass first to be able to overlap shadow mapping & screen space (depth based) compute effects
-  vkutil::transition_image(cmd, m_DepthImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
-  draw_depth_prepass(cmd);
+  {
+    RenderGraph::Pass& pass = graph.add_pass("Depth Prepass", RenderGraph::PassType::Graphics, MARKER_BLUE);
+    pass.write(depthImage, ResourceUsage::DepthAttachment);
+    draws(pass, opaqueEarly);
+    pass.record([this](VkCommandBuffer cmd) { draw_depth_prepass(cmd, CULL_PHASE_EARLY); });
+  }
+
+  // hi-z from what was visible last frame, everything else is tested against it and drawn into the same depth
+  if (occlusion)
+  {
+    RenderGraph::Pass& reduce = graph.add_pass("Depth Pyramid", RenderGraph::PassType::Compute, MARKER_RED).async_compute();
+    reduce.read(depthImage, ResourceUsage::DepthSampled).write(pyramid, ResourceUsage::StorageWrite);
+    if (showPyramid)
+      reduce.write(pyramidDebug, ResourceUsage::StorageWrite);
+    reduce.record([this](VkCommandBuffer cmd) { depth_pyramid::run(cmd, m_DrawExtent, m_DepthImage.imageView); });
+
+    RenderGraph::Pass& cull = graph.add_pass("Late Cull", RenderGraph::PassType::Compute, MARKER_RED).async_compute();
+    cull.read(pyramid, ResourceUsage::Sampled);
+    writes(cull, opaqueLate);
+    writes(cull, transparentLate);
+    cull.record([this](VkCommandBuffer cmd) {
+      Renderer::cull_draw_set(cmd, opaque_set, CULL_PHASE_LATE);
+      Renderer::cull_draw_set(cmd, transparent_set, CULL_PHASE_LATE);
+    });
+
+    RenderGraph::Pass& prepass = graph.add_pass("Late Depth Prepass", RenderGraph::PassType::Graphics, MARKER_BLUE);
+    prepass.write(depthImage, ResourceUsage::DepthAttachment);
+    draws(prepass, opaqueLate);
+    prepass.record([this](VkCommandBuffer cmd) { draw_depth_prepass(cmd, CULL_PHASE_LATE); });
+  }
+
+  if (shadowDirty != 0)
+  {
+    RenderGraph::Pass& pass = graph.add_pass("Shadow Pass", RenderGraph::PassType::Graphics, MARKER_BLUE);
+    pass.write(shadowMap, ResourceUsage::DepthAttachment);
+    for (uint32_t c = 0; c < cascadeLists.size(); c++)
+    {
+      if (shadowDirty & (1u << c))
+        draws(pass, cascadeLists[c]);
+    }
+    pass.record([this, shadowDirty](VkCommandBuffer cmd) { draw_shadow_pass(cmd, shadowDirty); });
+
+    for (uint32_t c = 0; c < cascades.count; c++)
+    {
+      if (shadowDirty & (1u << c))
+        shadowCache.viewProj[c] = cascades.viewProj[c];
+    }
+    shadowCache.valid |= shadowDirty;
+  }
+  stats.shadow_cascades_rendered = std::popcount(shadowDirty);
+  if (shadows && shadowDirty == 0)
+  {
+    stats.shadow_cache_hits++;
+  }
 
-  vkutil::transition_image(cmd, m_ShadowDepthImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
-  draw_shadow_pass(cmd);
-  vkutil::transition_image(cmd, m_ShadowDepthImage.image, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL);
+  // depth based compute ss effects, culled when the geometry pass doesnt read the result.
+  // on the compute queue it runs next to the shadow pass
+  graph.add_pass("SSAO", RenderGraph::PassType::Compute, MARKER_GREEN)
+    .async_compute()
+    .read(depthImage, ResourceUsage::DepthSampled)
+    .write(ssaoAmbient, ResourceUsage::StorageWrite)
+    .write(ssaoBlurred, ResourceUsage::StorageWrite)
+    .record([this](VkCommandBuffer cmd) { ssao::run(cmd, m_DepthImage.imageView); });
+
+  // bins the lights into the clusters the depth prepass touches, declared next to ssao so
+  // both land in one compute segment beside the shadow pass
+  graph.add_pass("Light Culling", RenderGraph::PassType::Compute, MARKER_GREEN)
+    .async_compute()
+    .read(depthImage, ResourceUsage::DepthSampled)
+    .read(lightBuffer, ResourceUsage::StorageRead)
+    .write(lightClusters, ResourceUsage::StorageWrite)
+    .record([this, lightCount](VkCommandBuffer cmd) {
+      light_clusters::run(cmd, m_DepthImage.imageView, mainDrawContext.sceneBuffers.lightBuffer.buffer, lightCount);
+    });
 
+  // after the shadow pass on the graphics queue, async it would cut the frame for the cascades
+  graph.add_pass("Shadow Mask", RenderGraph::PassType::Compute, MARKER_GREEN)
+    .read(depthImage, ResourceUsage::DepthSampled)
+    .read(shadowMap, ResourceUsage::DepthSampled)
+    .write(shadowMask, ResourceUsage::StorageWrite)
+    .record([this](VkCommandBuffer cmd) { shadow_mask::run(cmd, m_DepthImage.imageView); });
 
-  if (ssaoEnabled.get())
   {
-    vkutil::transition_image(cmd, m_DepthImage.image, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL);
-    // depth based compute ss effects
-    ssao::run(cmd, m_DepthImage.imageView);
-    vkutil::transition_image(cmd, m_DepthImage.image, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+    RenderGraph::Pass& pass = graph.add_pass("Geometry", RenderGraph::PassType::Graphics, MARKER_BLUE);
+    pass.write(drawImage, ResourceUsage::ColorAttachment)
+      .read(depthImage, ResourceUsage::DepthRead)
+      .read(shadowMap, ResourceUsage::DepthSampled);
+    if (ssaoEnabled.get())
+      pass.read(ssaoBlurred, ResourceUsage::Sampled);
+    if (shadowMaskOn)
+      pass.read(shadowMask, ResourceUsage::Sampled);
+    if (lightCount > 0)
+      pass.read(lightBuffer, ResourceUsage::StorageRead).read(lightClusters, ResourceUsage::StorageRead);
+
+    draws(pass, opaqueEarly);
+    if (occlusion)
+      draws(pass, opaqueLate);
+    if (!oitOn)
+    {
+      draws(pass, transparentEarly);
+      if (occlusion)
+        draws(pass, transparentLate);
+    }
+
+    pass.record([this, oitOn](VkCommandBuffer cmd) {
+      draw_geometry(cmd, !oitOn);
+      draw_debug_lines(cmd);
+    });
   }
 
-  vkutil::transition_image(cmd, m_DrawImage.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-  draw_geometry(cmd);
-  draw_debug_lines(cmd);
+  // transparent_set unsorted into the oit targets against the opaque depth, then resolved over the draw image
+  if (oitOn)
+  {
+    RenderGraph::Pass& pass = graph.add_pass("Transparent", RenderGraph::PassType::Graphics, MARKER_BLUE);
+    pass.write(oitAccumulation, ResourceUsage::ColorAttachment)
+      .write(oitRevealage, ResourceUsage::ColorAttachment)
+      .read(depthImage, ResourceUsage::DepthRead)
+      .read(shadowMap, ResourceUsage::DepthSampled);
+    if (ssaoEnabled.get())
+      pass.read(ssaoBlurred, ResourceUsage::Sampled);
+    if (lightCount > 0)
+      pass.read(lightBuffer, ResourceUsage::StorageRead).read(lightClusters, ResourceUsage::StorageRead);
+    draws(pass, transparentEarly);
+    if (occlusion)
+      draws(pass, transparentLate);
+    pass.record([this](VkCommandBuffer cmd) { draw_transparent_oit(cmd); });
+
+    graph.add_pass("OIT Composite", RenderGraph::PassType::Compute, MARKER_GREEN)
+      .read(oitAccumulation, ResourceUsage::Sampled)
+      .read(oitRevealage, ResourceUsage::Sampled)
+      .write(drawImage, ResourceUsage::StorageWrite)
+      .record([this](VkCommandBuffer cmd) { weighted_oit::composite(cmd, m_DrawImage.imageView); });
+  }
 
   // NOTE: Post Effects
-  vkutil::transition_image(cmd, m_DrawImage.image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
-  bloom::run(cmd, m_DrawImage.imageView);
-  vkutil::transition_image(cmd, m_DrawImage.image, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-  
-  
+  // bloom stays on graphics, the editor samples the draw image right after so there is nothing to overlap with
+  if (bloomOn)
+  {
+    RenderGraph::Pass& pass = graph.add_pass("Bloom", RenderGraph::PassType::Compute, MARKER_GREEN);
+    pass.write(drawImage, ResourceUsage::StorageWrite);
+    for (RGHandle mip : bloomMips)
+    {
+      pass.write(mip, ResourceUsage::StorageWrite);
+    }
+    pass.record([this, bloomMips](VkCommandBuffer cmd) {
+      std::array<AllocatedImage, bloom::mipCount> mips;
+      for (uint32_t i = 0; i < bloomMips.size(); i++)
+      {
+        mips[i] = renderGraph.image(bloomMips[i]);
+      }
+      bloom::run(cmd, m_DrawImage.imageView, std::span(mips.data(), bloomMips.size()));
+    });
+  }
+
+  // internal resolution to output resolution, the editor shows the result
+  if (upscaleOn)
+  {
+    RenderGraph::Pass& pass = graph.add_pass("Upscale", RenderGraph::PassType::Compute, MARKER_GREEN);
+    pass.read(drawImage, ResourceUsage::Sampled).write(outputImage, ResourceUsage::StorageWrite);
+    pass.record([this](VkCommandBuffer cmd) {
+      upscale::run(cmd, m_DrawImage.imageView, m_DrawExtent, m_OutputImage.imageView, m_OutputExtent);
+    });
+  }
+
   // draw ui directly on swapchain image
-  vkutil::transition_image(cmd, m_Swapchain.images[swapchainImageIndex], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-  Renderer::draw_editor(cmd, m_Swapchain.views[swapchainImageIndex]);
-  vkutil::transition_image(cmd, m_Swapchain.images[swapchainImageIndex], VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+  if (!headless)
+  {
+    RGHandle swapchainImage = graph.import_image("Swapchain", m_Swapchain.images[swapchainImageIndex], VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT);
 
+    // imgui edits the cvars the other passes read, it records once they are done
+    RenderGraph::Pass& pass = graph.add_pass("Editor", RenderGraph::PassType::Graphics, MARKER_RED).main_thread();
+    pass.write(swapchainImage, ResourceUsage::ColorAttachment).read(upscaleOn ? outputImage : drawImage, ResourceUsage::Sampled);
+    if (showPyramid)
+      pass.read(pyramidDebug, ResourceUsage::Sampled);
+    pass.record([this, swapchainImageIndex](VkCommandBuffer cmd) { Renderer::draw_editor(cmd, m_Swapchain.views[swapchainImageIndex]); });
 
-  update_descriptors();
+    graph.export_resource(swapchainImage, ResourceUsage::Present);
+  }
+  graph.export_resource(drawImage, ResourceUsage::Sampled);
+  if (upscaleOn)
+    graph.export_resource(outputImage, ResourceUsage::Sampled);
+
+  graph.compile();
+  m_DepthImage.image = graph.image(depthImage).image;
+  m_DepthImage.imageView = graph.image(depthImage).imageView;
+  ssao::outputAmbient = graph.image(ssaoAmbient);
+  ssao::outputBlurred = graph.image(ssaoBlurred);
+  shadow_mask::output = graph.image(shadowMask);
+  weighted_oit::accumulation = graph.image(oitAccumulation);
+  weighted_oit::revealage = graph.image(oitRevealage);
+
+  auto recordStart = std::chrono::system_clock::now();
+  graph.execute(cmd);
+  stats.record_time = std::chrono::duration<float, std::milli>(std::chrono::system_clock::now() - recordStart).count();
+  stats.pass_record_times = graph.record_timings();
+  // the graph may have cut the frame into several submissions, it ends in the last graphics one
+  cmd = graph.graphics_cmd();
 
+  update_descriptors();
 
-  VK_CHECK_RESULT(vkEndCommandBuffer(cmd));
+  GpuProfiler::end_frame(cmd);
 
-  // submit 
-  VkCommandBufferSubmitInfo cmdInfo = vkinit::command_buffer_submit_info(cmd);
+  // anything enqueued since the last frame (runtime texture loads etc) is submitted ahead of this frame
+  VkSemaphoreSubmitInfo uploadWait = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, uploader.semaphore());
+  uploadWait.value = uploader.flush();
 
-  VkSemaphoreSubmitInfo waitInfo = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR, get_current_frame().swapchainSemaphore);
-  VkSemaphoreSubmitInfo signalInfo = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT, get_current_frame().renderSemaphore);
+  std::array<VkSemaphoreSubmitInfo, 2> waitInfos = {
+    uploadWait,
+    vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR, get_current_frame().swapchainSemaphore),
+  };
+  // the timeline tells the cpu which frames are done, the binary semaphore is for present
+  VkSemaphoreSubmitInfo timelineSignal = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, frameTimeline);
+  timelineSignal.value = frame_timeline_value();
+  std::array<VkSemaphoreSubmitInfo, 2> signalInfos = {
+    timelineSignal,
+    vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT, get_current_frame().renderSemaphore),
+  };
+  get_current_frame().timelineValue = timelineSignal.value;
 
-  VkSubmitInfo2 submit = vkinit::submit_info(&cmdInfo, &signalInfo, &waitInfo);
-  VK_CHECK_RESULT(vkQueueSubmit2(graphicsQueue, 1, &submit, get_current_frame().renderFence));
+  graph.submit({
+    .waits = std::span(waitInfos.data(), headless ? 1 : 2),
+    .signals = std::span(signalInfos.data(), headless ? 1 : 2),
+  });
  
+  if (headless)
+  {
+    frameNumber++;
+    return;
+  }
   
   VkPresentInfoKHR presentInfo = {
     .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
@@ -386,7 +782,10 @@ void Engine::draw()
     .pImageIndices = &swapchainImageIndex
   };
 
-  r = vkQueuePresentKHR(presentQueue, &presentInfo);
+  {
+    std::lock_guard<std::mutex> lock(graphicsQueueMutex);
+    r = vkQueuePresentKHR(presentQueue, &presentInfo);
+  }
   if (r == VK_ERROR_OUT_OF_DATE_KHR)
   {
     valid_swapchain = false;
@@ -414,27 +813,17 @@ void Engine::draw_background(VkCommandBuffer cmd)
 
   VkClearColorValue clearValue{{0.1, 0.2, 0.25, 1.0}};
   VkImageSubresourceRange range = vkinit::image_subresource_range(VK_IMAGE_ASPECT_COLOR_BIT);
-  vkCmdClearColorImage(cmd, m_DrawImage.image, VK_IMAGE_LAYOUT_GENERAL, &clearValue, 1, &range);
+  vkCmdClearColorImage(cmd, m_DrawImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &clearValue, 1, &range);
     
 }
 
-void Engine::draw_shadow_pass(VkCommandBuffer cmd)
+void Engine::update_shadow_view()
 {
-  if (shadowEnabled.get() == false) return;
-
-  
-  VkRenderingAttachmentInfo depthAttachment = vkinit::depth_attachment_info(m_ShadowDepthImage.imageView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
-  VkRenderingInfo renderInfo = vkinit::rendering_info({m_ShadowExtent.width, m_ShadowExtent.height}, nullptr, &depthAttachment);
-  vkCmdBeginRendering(cmd, &renderInfo);
-
- lightProj = glm::ortho(
-    -pcss_settings.ortho_size,
-    pcss_settings.ortho_size,
-    -pcss_settings.ortho_size,
-    pcss_settings.ortho_size,
-    pcss_settings.far, pcss_settings.near); //FIXME: arbritary znear zfar planes
-
-  lightProj[1][1] *= -1;
+  uint32_t resolution = std::clamp(shadowResolution.get(), 256, 8192);
+  if (resolution != m_ShadowExtent.width)
+  {
+    create_shadow_map(resolution);
+  }
 
   float x_value = sin(pcss_settings.shadowNumber/200.0) * pcss_settings.distance;
   float z_value = cos(pcss_settings.shadowNumber/200.0) * pcss_settings.distance;
@@ -444,73 +833,280 @@ void Engine::draw_shadow_pass(VkCommandBuffer cmd)
     pcss_settings.shadowNumber++;
   }
 
-  lView = glm::lookAt(
-    glm::vec3{x_value, pcss_settings.distance, z_value},
-    glm::vec3{0.0f, 0.0f, 0.0f},
-    glm::vec3{0.0f, 1.0f, 0.0f}
-  );
-  
   sceneData.sunlightDirection = glm::normalize(glm::vec4{x_value, pcss_settings.distance, z_value, 1.0f}); // .w for sun power
+  glm::vec3 lightDir = glm::normalize(glm::vec3{x_value, pcss_settings.distance, z_value});
+
+  // the light view never moves with the camera, only the cascade centres do. a straight down light needs another up
+  glm::vec3 up = glm::abs(lightDir.y) > 0.99f ? glm::vec3{0.0f, 0.0f, 1.0f} : glm::vec3{0.0f, 1.0f, 0.0f};
+  glm::mat4 lightView = glm::lookAt(glm::vec3{0.0f}, -lightDir, up);
+
+  float near = cameraNear.get();
+  float far = glm::clamp(shadowDistance.get(), near * 2.0f, cameraFar.get());
+  float lambda = glm::clamp(shadowSplitLambda.get(), 0.0f, 1.0f);
+  float tanY = glm::tan(glm::radians(cameraFOV.get()) * 0.5f);
+  float tanX = tanY * (float) m_DrawExtent.width / (float) m_DrawExtent.height;
+  glm::mat4 invView = glm::inverse(sceneData.view);
+
+  cascades.count = std::clamp(shadowCascades.get(), 1, MAX_SHADOW_CASCADES);
+  float begin = near;
+  for (uint32_t c = 0; c < cascades.count; c++)
+  {
+    // practical split scheme, logarithmic close to the camera and uniform further out
+    float p = (c + 1) / (float) cascades.count;
+    float end = glm::mix(near + (far - near) * p, near * glm::pow(far / near, p), lambda);
+
+    // bounding sphere of the slice, unlike a box around it the size doesnt change when the camera turns
+    std::array<glm::vec3, 8> corners;
+    glm::vec3 centre{0.0f};
+    for (uint32_t i = 0; i < corners.size(); i++)
+    {
+      float depth = i < 4 ? begin : end;
+      glm::vec4 corner{(i & 1 ? 1.0f : -1.0f) * tanX * depth, (i & 2 ? 1.0f : -1.0f) * tanY * depth, -depth, 1.0f};
+      corners[i] = glm::vec3(invView * corner);
+      centre += corners[i] / (float) corners.size();
+    }
 
-  shadowPass.lightView = lightProj * lView; 
-  pcss_settings.lightViewProj = lightProj * lView;
+    float radius = 0.0f;
+    for (const glm::vec3& corner : corners)
+    {
+      radius = glm::max(radius, glm::length(corner - centre));
+    }
+    radius = glm::ceil(radius * 16.0f) / 16.0f; // float noise would resize the cascade every frame
+
+    // snapped to whole texels so the shadow edges stay put while the camera moves
+    glm::vec3 centreLight = glm::vec3(lightView * glm::vec4(centre, 1.0f));
+    float texel = 2.0f * radius / (float) m_ShadowExtent.width;
+    centreLight.x = glm::floor(centreLight.x / texel) * texel;
+    centreLight.y = glm::floor(centreLight.y / texel) * texel;
+
+    // reverse z like the camera, extended towards the light for the casters in front of the slice
+    float depth = -centreLight.z;
+    glm::mat4 proj = glm::ortho(
+      centreLight.x - radius, centreLight.x + radius,
+      centreLight.y - radius, centreLight.y + radius,
+      depth + radius, depth - radius - shadowCasterRange.get());
+    proj[1][1] *= -1;
+
+    cascades.viewProj[c] = proj * lightView;
+    cascades.splits[c] = end;
+    if (c == 0)
+    {
+      lightProj = proj;
+    }
+    begin = end;
+  }
 
-  std::vector<uint32_t> shadow_draws;
-  // shadow_draws.reserve(mainDrawContext.OpaqueSurfaces.size());
-  
-  // for (uint32_t i = 0; i < mainDrawContext.OpaqueSurfaces.size(); i++)
-  // {
-  //   if (is_visible(mainDrawContext.OpaqueSurfaces[i], lightProj*lView))
-  //   {
-  //     shadow_draws.push_back(i);
-  //   }
-  // }
+  lView = lightView;
+  shadowPass.lightView = cascades.viewProj[0];
+  pcss_settings.lightViewProj = cascades.viewProj[0];
 
-  // NOTE: CMS Settings?? different mat proj or a scale to basic 1 or smth
-  
-  u_ShadowPass data;
-  data.lightViewProj = lightProj * lView;
+  // the fit is snapped, a camera that moved less than a texel gives exactly the same matrix
+  if (shadowCacheEnabled.get() == false || shadowCache.sceneVersion != sceneVersion)
+  {
+    shadowCache.valid = 0;
+    shadowCache.sceneVersion = sceneVersion;
+  }
+  shadowCache.dirty = 0;
+  for (uint32_t c = 0; c < cascades.count; c++)
+  {
+    if ((shadowCache.valid & (1u << c)) == 0 || shadowCache.viewProj[c] != cascades.viewProj[c])
+      shadowCache.dirty |= 1u << c;
+  }
+}
 
-  u_ShadowPass* shadowPassUniform = (u_ShadowPass*) shadowPass.buffer.allocation->GetMappedData();
-  *shadowPassUniform = data;
+void Engine::update_lights()
+{
+  LightScatter scatter{
+    .count = std::clamp(lightsCount.get(), 0, 4096),
+    .range = glm::max(lightsRange.get(), 0.01f),
+    .intensity = glm::max(lightsIntensity.get(), 0.0f),
+    .spotFraction = glm::clamp(lightsSpotFraction.get(), 0.0f, 1.0f),
+  };
+  if (scatter.count == lightScatter.count && scatter.range == lightScatter.range
+    && scatter.intensity == lightScatter.intensity && scatter.spotFraction == lightScatter.spotFraction)
+  {
+    return;
+  }
+  lightScatter = scatter;
 
-  VkDescriptorSet shadowDescriptor = get_current_frame().frameDescriptors.allocate(device, m_ShadowSetLayout);
-  DescriptorWriter writer;
-  writer.write_buffer(0, shadowPass.buffer.buffer, sizeof(u_ShadowPass), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER); // FIXME: .buffer .buffer :sob:
+  // NOTE: the gltf punctual lights are not loaded (the scene cache has no section for them), they are scattered
+  // over the world bounds of the drawn surfaces with a fixed seed so every run gets the same ones
+  glm::vec3 sceneMin{std::numeric_limits<float>::max()};
+  glm::vec3 sceneMax{std::numeric_limits<float>::lowest()};
+  for (const DrawSet* set : {&opaque_set, &transparent_set})
+  {
+    for (const DrawData& draw : set->draw_datas)
+    {
+      glm::vec4 sphere = mainDrawContext.sphere_bounds[draw.bounds_idx];
+      glm::vec3 centre = mainDrawContext.transforms[draw.mesh_idx] * glm::vec4(glm::vec3(sphere), 1.0f);
+      sceneMin = glm::min(sceneMin, centre);
+      sceneMax = glm::max(sceneMax, centre);
+    }
+  }
+  if (sceneMin.x > sceneMax.x)
+  {
+    sceneMin = glm::vec3{-10.0f};
+    sceneMax = glm::vec3{10.0f};
+  }
 
-  writer.write_buffer(1, opaque_set.buffers.draw_data.buffer, opaque_set.draw_datas.size() * sizeof(DrawData), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-  writer.write_buffer(2, mainDrawContext.sceneBuffers.transformBuffer.buffer, mainDrawContext.transforms.size() * sizeof(glm::mat4x3), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-  writer.write_buffer(3, mainDrawContext.sceneBuffers.positionBuffer.buffer, mainDrawContext.positions.size() * sizeof(glm::vec3), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-     
-  writer.update_set(device, shadowDescriptor);
-  
-  VkViewport viewport = vkinit::dynamic_viewport(m_ShadowExtent);
-  vkCmdSetViewport(cmd, 0, 1, &viewport);
+  std::mt19937 rng(1337);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+  std::vector<GPULight>& lights = mainDrawContext.lights;
+  lights.resize(scatter.count);
+  for (GPULight& light : lights)
+  {
+    light.position = glm::mix(sceneMin, sceneMax, glm::vec3{unit(rng), unit(rng), unit(rng)});
+    light.range = scatter.range * glm::mix(0.5f, 1.0f, unit(rng));
+    light.colour = glm::normalize(glm::vec3{unit(rng), unit(rng), unit(rng)} + 0.2f) * scatter.intensity;
+    light.direction = glm::normalize(glm::vec3{unit(rng) - 0.5f, -1.0f, unit(rng) - 0.5f});
+    if (unit(rng) < scatter.spotFraction)
+    {
+      float outer = glm::cos(glm::radians(glm::mix(25.0f, 45.0f, unit(rng))));
+      float inner = glm::mix(outer, 1.0f, 0.5f);
+      light.spotScale = 1.0f / glm::max(inner - outer, 1e-4f);
+      light.spotOffset = -outer * light.spotScale;
+    }
+    else
+    {
+      light.spotScale = 0.0f;
+      light.spotOffset = 1.0f;
+    }
+  }
+
+  // the frames in flight may still read the old one
+  AllocatedBuffer old = mainDrawContext.sceneBuffers.lightBuffer;
+  if (old.buffer != VK_NULL_HANDLE)
+  {
+    defer_delete([this, old]() { destroy_buffer(old); });
+  }
+
+  const size_t lightBufferSize = glm::max<size_t>(lights.size(), 1) * sizeof(GPULight);
+  AllocatedBuffer& lightBuffer = mainDrawContext.sceneBuffers.lightBuffer;
+  lightBuffer = create_buffer(lightBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+  vklog::label_buffer(device, lightBuffer.buffer, "light buffer");
+  if (!lights.empty())
+  {
+    uploader.enqueue_buffer(lightBuffer.buffer, 0, lights.data(), lights.size() * sizeof(GPULight));
+  }
+}
+
+void Engine::create_shadow_map(uint32_t resolution)
+{
+  // the frames in flight may still sample the old one
+  if (m_ShadowDepthImage.image != VK_NULL_HANDLE)
+  {
+    defer_delete([this, image = m_ShadowDepthImage, layerViews = m_ShadowLayerViews]() { destroy_shadow_map(image, layerViews); });
+  }
+
+  m_ShadowExtent = {resolution, resolution, 1};
+  shadowCache.valid = 0;
+  shadowCache.written = false;
+
+  // NOTE: not made with create_image, the array view cant go into the bindless texture array
+  VkImageCreateInfo imgInfo = vkinit::image_create_info(VK_FORMAT_D32_SFLOAT, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, m_ShadowExtent);
+  imgInfo.arrayLayers = MAX_SHADOW_CASCADES;
+
+  VmaAllocationCreateInfo allocInfo{};
+  allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+  allocInfo.requiredFlags = VkMemoryPropertyFlags{VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT};
+  m_ShadowDepthImage = {};
+  VK_CHECK_RESULT(vmaCreateImage(m_Allocator, &imgInfo, &allocInfo, &m_ShadowDepthImage.image, &m_ShadowDepthImage.allocation, nullptr));
+  m_ShadowDepthImage.imageFormat = imgInfo.format;
+  m_ShadowDepthImage.imageExtent = m_ShadowExtent;
+
+  VkImageViewCreateInfo viewInfo = vkinit::imageview_create_info(imgInfo.format, m_ShadowDepthImage.image, VK_IMAGE_ASPECT_DEPTH_BIT);
+  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+  viewInfo.subresourceRange.layerCount = MAX_SHADOW_CASCADES;
+  VK_CHECK_RESULT(vkCreateImageView(device, &viewInfo, nullptr, &m_ShadowDepthImage.imageView));
+
+  viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+  viewInfo.subresourceRange.layerCount = 1;
+  for (uint32_t i = 0; i < MAX_SHADOW_CASCADES; i++)
+  {
+    viewInfo.subresourceRange.baseArrayLayer = i;
+    VK_CHECK_RESULT(vkCreateImageView(device, &viewInfo, nullptr, &m_ShadowLayerViews[i]));
+  }
+
+  vklog::label_image(device, m_ShadowDepthImage.image, "Shadow Mapping Image");
+}
 
+void Engine::destroy_shadow_map(const AllocatedImage& image, const std::array<VkImageView, MAX_SHADOW_CASCADES>& layerViews) const
+{
+  for (VkImageView view : layerViews)
+  {
+    vkDestroyImageView(device, view, nullptr);
+  }
+  vkDestroyImageView(device, image.imageView, nullptr);
+  vmaDestroyImage(m_Allocator, image.image, image.allocation);
+}
+
+void Engine::draw_shadow_pass(VkCommandBuffer cmd, uint32_t cascadeMask)
+{
+  if (shadowEnabled.get() == false || opaque_set.draw_datas.size() == 0) return;
+
+  GPUSceneBuffers& scene = mainDrawContext.sceneBuffers;
+  PersistentDescriptorSet& shadowSet = get_current_frame().shadowPassSet;
+
+  VkViewport viewport = vkinit::dynamic_viewport(m_ShadowExtent);
   VkRect2D scissor = vkinit::dynamic_scissor(m_ShadowExtent);
-  vkCmdSetScissor(cmd, 0, 1, &scissor);
-  
-  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_ShadowPipeline);
-  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_ShadowPipelineLayout, 0, 1, &shadowDescriptor, 0, nullptr);
 
+  // a layer per cascade, each only draws the casters culled against its own projection. the others keep what they hold
+  for (uint32_t c = 0; c < cascades.count; c++)
+  {
+    if ((cascadeMask & (1u << c)) == 0)
+      continue;
 
-  
-  vkCmdBindIndexBuffer(cmd, mainDrawContext.sceneBuffers.indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
-  
-  vkCmdDrawIndexedIndirectCount(
-    cmd,
-    opaque_set.buffers.indirect_draws.buffer,
-    0,
-    opaque_set.buffers.indirect_count.buffer,
-    0,
-    opaque_set.draw_datas.size(),
-    sizeof(IndirectDraw)
-  );
+    std::string name = std::format("Shadow Cascade {}", c);
+    GpuProfiler::begin_scope(cmd, name.c_str(), MARKER_BLUE);
 
-  vkCmdEndRendering(cmd);
+    VkRenderingAttachmentInfo depthAttachment = vkinit::depth_attachment_info(m_ShadowLayerViews[c], VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+    VkRenderingInfo renderInfo = vkinit::rendering_info({m_ShadowExtent.width, m_ShadowExtent.height}, nullptr, &depthAttachment);
+    vkCmdBeginRendering(cmd, &renderInfo);
+
+    u_ShadowPass data;
+    data.lightViewProj = cascades.viewProj[c];
+
+    BufferSlice shadowPassUniform = get_current_frame().frameUniforms.push(data);
+
+    uint64_t key = descriptor_key(
+      shadowPassUniform.buffer,
+      opaque_set.buffers.draw_data.buffer, opaque_set.draw_datas.size(),
+      scene.transformBuffer.buffer, mainDrawContext.transforms.size(),
+      scene.positionBuffer.buffer, mainDrawContext.positions.size()
+    );
+
+    if (shadowSet.stale(key))
+    {
+      if (shadowSet.set == VK_NULL_HANDLE)
+        shadowSet.set = persistentDescriptors.allocate(device, m_ShadowSetLayout);
+
+      DescriptorWriter writer;
+      writer.write_buffer(0, shadowPassUniform.buffer, sizeof(u_ShadowPass), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
+      writer.write_buffer(1, opaque_set.buffers.draw_data.buffer, opaque_set.draw_datas.size() * sizeof(DrawData), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+      writer.write_buffer(2, scene.transformBuffer.buffer, mainDrawContext.transforms.size() * sizeof(glm::mat4x3), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+      writer.write_buffer(3, scene.positionBuffer.buffer, mainDrawContext.positions.size() * sizeof(glm::vec3), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+      writer.update_set(device, shadowSet.set);
+      shadowSet.key = key;
+    }
+    uint32_t shadowOffset = shadowPassUniform.offset;
+    
+    vkCmdSetViewport(cmd, 0, 1, &viewport);
+    vkCmdSetScissor(cmd, 0, 1, &scissor);
+    
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_ShadowPipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_ShadowPipelineLayout, 0, 1, &shadowSet.set, 1, &shadowOffset);
+    vkCmdBindIndexBuffer(cmd, mainDrawContext.sceneBuffers.indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+    
+    // casters culled against the cascade, not the camera
+    draw_indirect(cmd, opaque_set.buffers.view_indirect[c], opaque_set.draw_datas.size());
+
+    vkCmdEndRendering(cmd);
+    GpuProfiler::end_scope(cmd);
+  }
 }
 
-void Engine::draw_depth_prepass(VkCommandBuffer cmd)
+void Engine::draw_depth_prepass(VkCommandBuffer cmd, uint32_t phase)
 {
   if (opaque_set.draw_datas.size() == 0)
     return;
@@ -518,6 +1114,11 @@ void Engine::draw_depth_prepass(VkCommandBuffer cmd)
 
   
   VkRenderingAttachmentInfo depthAttachment = vkinit::depth_attachment_info(m_DepthImage.imageView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+  if (phase == CULL_PHASE_LATE)
+  {
+    // adds to the depth the early draws left, the opaque pass tests EQUAL against both
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+  }
   VkRenderingInfo depthPrepassInfo = vkinit::rendering_info(m_DrawExtent, nullptr, &depthAttachment);
   vkCmdBeginRendering(cmd, &depthPrepassInfo);
 
@@ -527,45 +1128,49 @@ void Engine::draw_depth_prepass(VkCommandBuffer cmd)
   VkRect2D scissor = vkinit::dynamic_scissor(m_DrawExtent);
   vkCmdSetScissor(cmd , 0, 1, &scissor);
   
-  AllocatedBuffer gpuSceneDataBuffer = create_buffer(sizeof(GPUSceneData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-  get_current_frame().deletionQueue.push_function([=, this] {
-    destroy_buffer(gpuSceneDataBuffer);
-  });
+  BufferSlice sceneUniform = get_current_frame().frameUniforms.push(sceneData);
+  
+  GPUSceneBuffers& scene = mainDrawContext.sceneBuffers;
+  PersistentDescriptorSet& depth = get_current_frame().depthPrepassSets[phase];
+  uint64_t key = descriptor_key(
+    sceneUniform.buffer,
+    opaque_set.buffers.draw_data.buffer, opaque_set.draw_datas.size(),
+    scene.transformBuffer.buffer, mainDrawContext.transforms.size(),
+    scene.materialBuffer.buffer, mainDrawContext.standard_materials.size(),
+    scene.positionBuffer.buffer, mainDrawContext.positions.size(),
+    scene.vertexBuffer.buffer, mainDrawContext.vertices.size()
+  );
 
-  GPUSceneData* sceneUniformData = (GPUSceneData*) gpuSceneDataBuffer.allocation->GetMappedData();
-  *sceneUniformData = sceneData;
-  
-  VkDescriptorSet depth = get_current_frame().frameDescriptors.allocate(device, zpassDescriptorLayout);
-  DescriptorWriter writer;
-  writer.write_buffer(0, gpuSceneDataBuffer.buffer, sizeof(GPUSceneData), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER); // FIXME: .buffer .buffer :sob:
-  writer.write_buffer(2, mainDrawContext.sceneBuffers.transformBuffer.buffer, mainDrawContext.transforms.size() * sizeof(glm::mat4x3), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-  writer.write_buffer(4, mainDrawContext.sceneBuffers.positionBuffer.buffer, mainDrawContext.positions.size() * sizeof(glm::vec3), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-  writer.write_buffer(1, opaque_set.buffers.draw_data.buffer, opaque_set.draw_datas.size() * sizeof(DrawData), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-  writer.write_buffer(5, mainDrawContext.sceneBuffers.vertexBuffer.buffer, mainDrawContext.vertices.size() * sizeof(Vertex), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-  writer.write_buffer(3, mainDrawContext.sceneBuffers.materialBuffer.buffer, mainDrawContext.standard_materials.size() * sizeof(StandardMaterial), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-  writer.update_set(device, depth);
+  if (depth.stale(key))
+  {
+    if (depth.set == VK_NULL_HANDLE)
+      depth.set = persistentDescriptors.allocate(device, zpassDescriptorLayout);
+
+    DescriptorWriter writer;
+    writer.write_buffer(0, sceneUniform.buffer, sizeof(GPUSceneData), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
+    writer.write_buffer(1, opaque_set.buffers.draw_data.buffer, opaque_set.draw_datas.size() * sizeof(DrawData), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    writer.write_buffer(2, scene.transformBuffer.buffer, mainDrawContext.transforms.size() * sizeof(glm::mat4x3), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    writer.write_buffer(3, scene.materialBuffer.buffer, mainDrawContext.standard_materials.size() * sizeof(StandardMaterial), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    writer.write_buffer(4, scene.positionBuffer.buffer, mainDrawContext.positions.size() * sizeof(glm::vec3), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    writer.write_buffer(5, scene.vertexBuffer.buffer, mainDrawContext.vertices.size() * sizeof(Vertex), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    writer.update_set(device, depth.set);
+    depth.key = key;
+  }
+  uint32_t sceneOffset = sceneUniform.offset;
 
   vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, m_DepthPrepassPipeline);
-  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, zpassLayout, 0, 1, &depth, 0, nullptr);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, zpassLayout, 0, 1, &depth.set, 1, &sceneOffset);
   vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, zpassLayout, 1, 1, &bindless_descriptor_set, 0, nullptr); 
 
   vkCmdBindIndexBuffer(cmd, mainDrawContext.sceneBuffers.indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
 
-  vkCmdDrawIndexedIndirectCount(
-    cmd,
-    opaque_set.buffers.indirect_draws.buffer,
-    0,
-    opaque_set.buffers.indirect_count.buffer,
-    0,
-    opaque_set.draw_datas.size(),
-    sizeof(IndirectDraw)
-  );
+  draw_indirect(cmd, opaque_set, phase);
   
   
   vkCmdEndRendering(cmd);
 }
 
-void Engine::draw_geometry(VkCommandBuffer cmd)
+void Engine::draw_geometry(VkCommandBuffer cmd, bool withTransparent)
 {
   
   auto start = std::chrono::system_clock::now();
@@ -605,7 +1210,10 @@ void Engine::draw_geometry(VkCommandBuffer cmd)
 
 
   render_draw_set(cmd, opaque_set);
-  render_draw_set(cmd, transparent_set);
+  if (withTransparent)
+  {
+    render_draw_set(cmd, transparent_set);
+  }
 
   
 
@@ -620,6 +1228,39 @@ void Engine::draw_geometry(VkCommandBuffer cmd)
   stats.mesh_draw_time = elapsed.count() / 1000.0f;
 }
 
+void Engine::draw_transparent_oit(VkCommandBuffer cmd)
+{
+  // nothing accumulated and fully revealed, the composite skips what no transparent surface covers
+  VkClearValue accumulationClear{.color = {{0.0f, 0.0f, 0.0f, 0.0f}}};
+  VkClearValue revealageClear{.color = {{1.0f, 0.0f, 0.0f, 0.0f}}};
+  std::array<VkRenderingAttachmentInfo, 2> colorAttachments = {
+    vkinit::attachment_info(weighted_oit::accumulation.imageView, &accumulationClear, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL),
+    vkinit::attachment_info(weighted_oit::revealage.imageView, &revealageClear, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL),
+  };
+  // tested against the opaque depth, never written so the transparent surfaces dont hide each other
+  VkRenderingAttachmentInfo depthAttachment = vkinit::depth_attachment_info(m_DepthImage.imageView, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL);
+  depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+
+  VkRenderingInfo renderInfo = vkinit::rendering_info(m_DrawExtent, colorAttachments.data(), &depthAttachment);
+  renderInfo.colorAttachmentCount = colorAttachments.size();
+  vkCmdBeginRendering(cmd, &renderInfo);
+
+  VkViewport viewport = vkinit::dynamic_viewport(m_DrawExtent);
+  vkCmdSetViewport(cmd, 0, 1, &viewport);
+
+  VkRect2D scissor = vkinit::dynamic_scissor(m_DrawExtent);
+  vkCmdSetScissor(cmd , 0, 1, &scissor);
+
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, transparent_set.pipeline);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, bindless_pipeline_layout, 1, 1, &bindless_descriptor_set, 0, nullptr);
+  vkCmdBindIndexBuffer(cmd, mainDrawContext.sceneBuffers.indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+
+  // the culled indirect lists as they are, the blend doesnt depend on the draw order
+  render_draw_set(cmd, transparent_set);
+
+  vkCmdEndRendering(cmd);
+}
+
 void Engine::queue_debug_line(glm::vec3 p1, glm::vec3 p2)
 {
   debugLines.push_back(p1);
@@ -722,11 +1363,8 @@ void Engine::draw_debug_lines(VkCommandBuffer cmd)
   vkCmdBeginRendering(cmd, &renderInfo);
 
 
-  debugLinesBuffer = create_buffer(debugLines.size() * sizeof(glm::vec3), VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
-  std::string n = "debug lines buffer" + std::to_string(frameNumber);
-  vklog::label_buffer(device, debugLinesBuffer.buffer, n.c_str()); // FIXME: kind of ass string manipulation also in gfx_effects.cpp bloom!
-  glm::vec3* data = (glm::vec3*) debugLinesBuffer.allocation->GetMappedData();
-  memcpy(data, debugLines.data(), debugLines.size() * sizeof(glm::vec3)); 
+  BufferSlice linePositions = get_current_frame().frameUniforms.allocate(debugLines.size() * sizeof(glm::vec3));
+  memcpy(linePositions.data, debugLines.data(), debugLines.size() * sizeof(glm::vec3)); 
  
   vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, debugLinePipeline);
   
@@ -736,14 +1374,9 @@ void Engine::draw_debug_lines(VkCommandBuffer cmd)
   VkRect2D scissor = vkinit::dynamic_scissor(m_DrawExtent);
   vkCmdSetScissor(cmd , 0, 1, &scissor);
   
-  VkBufferDeviceAddressInfo positionBDA {
-    .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
-    .buffer = debugLinesBuffer.buffer
-  };
-  
   debug_line_pcs pcs{};
   pcs.viewproj = sceneData.viewproj;
-  pcs.positions = vkGetBufferDeviceAddress(device, &positionBDA);
+  pcs.positions = linePositions.address;
 
   vkCmdPushConstants(cmd, debugLinePipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(debug_line_pcs), &pcs);
 
@@ -752,10 +1385,6 @@ void Engine::draw_debug_lines(VkCommandBuffer cmd)
   debugLines.clear();
 
   vkCmdEndRendering(cmd);
-
-  // get_current_frame().deletionQueue.push_function([=, this]{
-    destroy_buffer(debugLinesBuffer);                                                  
-  // });
 }
 
 
@@ -773,7 +1402,10 @@ void Engine::immediate_submit(std::function<void(VkCommandBuffer cmd)>&& functio
 
   VkCommandBufferSubmitInfo cmdInfo = vkinit::command_buffer_submit_info(cmd);
   VkSubmitInfo2 submit = vkinit::submit_info(&cmdInfo, nullptr, nullptr);
-  VK_CHECK_RESULT(vkQueueSubmit2(graphicsQueue, 1, &submit, m_ImmFence));
+  {
+    std::lock_guard<std::mutex> lock(graphicsQueueMutex);
+    VK_CHECK_RESULT(vkQueueSubmit2(graphicsQueue, 1, &submit, m_ImmFence));
+  }
 
   VK_CHECK_RESULT(vkWaitForFences(device, 1, &m_ImmFence, true, 9999999999));
 
@@ -788,6 +1420,15 @@ AllocatedBuffer Engine::create_buffer(size_t allocSize, VkBufferUsageFlags usage
   bufferInfo.size = allocSize;
   bufferInfo.usage = usage;
 
+  // the async compute queue can be of another family, buffers are shared instead of transferred
+  std::array<uint32_t, 2> families = {graphicsIndex, computeIndex};
+  if (graphicsIndex != computeIndex)
+  {
+    bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    bufferInfo.queueFamilyIndexCount = families.size();
+    bufferInfo.pQueueFamilyIndices = families.data();
+  }
+
   VmaAllocationCreateInfo vmaAllocInfo{};
   vmaAllocInfo.usage = memoryUsage;
   vmaAllocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
@@ -812,6 +1453,7 @@ GPUSceneBuffers Engine::upload_scene(
   std::span<glm::vec4> sphere_bounds,
   std::span<StandardMaterial> materials)
 {
+  sceneVersion++; // moved or new casters, the cached shadow cascades are stale
   const size_t vertexBufferSize = vertices.size() * sizeof(Vertex);
   const size_t positionBufferSize = positions.size() * sizeof(glm::vec3);
   const size_t indexBufferSize = indices.size() * sizeof(uint32_t);
@@ -866,67 +1508,13 @@ GPUSceneBuffers Engine::upload_scene(
   vklog::label_buffer(device, scene.materialBuffer.buffer, "big material buffer");
   vklog::label_buffer(device, scene.boundsBuffer.buffer, "big bounds buffer");
 
-  AllocatedBuffer staging = create_buffer(
-    vertexBufferSize +
-    positionBufferSize +
-    indexBufferSize +
-    transformBufferSize +
-    boundsBufferSize + 
-    materialBufferSize,
-    VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-    VMA_MEMORY_USAGE_CPU_ONLY);
-  void* data = staging.allocation->GetMappedData();
-
-  memcpy(data, positions.data(), positionBufferSize);
-  memcpy((char*) data + positionBufferSize, vertices.data(), vertexBufferSize);
-  memcpy((char*) data + positionBufferSize + vertexBufferSize, indices.data(), indexBufferSize); //FIXME: C style casting
-  memcpy((char*) data + positionBufferSize + vertexBufferSize + indexBufferSize, transforms.data(), transformBufferSize);
-  memcpy((char*) data + positionBufferSize + vertexBufferSize + indexBufferSize + transformBufferSize, sphere_bounds.data(), boundsBufferSize);
-  memcpy((char*) data + positionBufferSize + vertexBufferSize + indexBufferSize + transformBufferSize + boundsBufferSize, materials.data(), materialBufferSize);
-
-
-
-  immediate_submit([&](VkCommandBuffer cmd){
-    VkBufferCopy positionCopy{};
-    positionCopy.dstOffset = 0;
-    positionCopy.srcOffset = 0;
-    positionCopy.size = positionBufferSize;
-    
-    vkCmdCopyBuffer(cmd, staging.buffer, scene.positionBuffer.buffer, 1, &positionCopy);
+  uploader.enqueue_buffer(scene.positionBuffer.buffer, 0, positions.data(), positionBufferSize);
+  uploader.enqueue_buffer(scene.vertexBuffer.buffer, 0, vertices.data(), vertexBufferSize);
+  uploader.enqueue_buffer(scene.indexBuffer.buffer, 0, indices.data(), indexBufferSize);
+  uploader.enqueue_buffer(scene.transformBuffer.buffer, 0, transforms.data(), transformBufferSize);
+  uploader.enqueue_buffer(scene.boundsBuffer.buffer, 0, sphere_bounds.data(), boundsBufferSize);
+  uploader.enqueue_buffer(scene.materialBuffer.buffer, 0, materials.data(), materialBufferSize);
 
-    VkBufferCopy vertexCopy{};
-    vertexCopy.dstOffset = 0;
-    vertexCopy.srcOffset = positionBufferSize;
-    vertexCopy.size = vertexBufferSize;
-    vkCmdCopyBuffer(cmd, staging.buffer, scene.vertexBuffer.buffer, 1, &vertexCopy);
-    
-    VkBufferCopy indexCopy{};
-    indexCopy.dstOffset = 0;
-    indexCopy.srcOffset = positionBufferSize + vertexBufferSize;
-    indexCopy.size = indexBufferSize;
-    vkCmdCopyBuffer(cmd, staging.buffer, scene.indexBuffer.buffer, 1, &indexCopy);
-
-    VkBufferCopy transformCopy{};
-    transformCopy.dstOffset = 0;
-    transformCopy.srcOffset = positionBufferSize + vertexBufferSize + indexBufferSize;
-    transformCopy.size = transformBufferSize;
-    vkCmdCopyBuffer(cmd, staging.buffer, scene.transformBuffer.buffer, 1, &transformCopy);
-
-    VkBufferCopy boundsCopy{};
-    boundsCopy.dstOffset = 0;
-    boundsCopy.srcOffset = positionBufferSize + vertexBufferSize + indexBufferSize + transformBufferSize;
-    boundsCopy.size = boundsBufferSize;
-    vkCmdCopyBuffer(cmd, staging.buffer, scene.boundsBuffer.buffer, 1, &boundsCopy);
-    
-    VkBufferCopy materialCopy{};
-    materialCopy.dstOffset = 0;
-    materialCopy.srcOffset = positionBufferSize + vertexBufferSize + indexBufferSize + transformBufferSize + boundsBufferSize;
-    materialCopy.size = materialBufferSize;
-    vkCmdCopyBuffer(cmd, staging.buffer, scene.materialBuffer.buffer, 1, &materialCopy);
-
- });
-
-  destroy_buffer(staging);
   return scene;
 }
 
@@ -966,18 +1554,22 @@ AllocatedImage Engine::create_image(VkExtent3D size, VkFormat format, VkImageUsa
   bool is_sampled = usage & VK_IMAGE_USAGE_SAMPLED_BIT;
   bool is_storage = usage & VK_IMAGE_USAGE_STORAGE_BIT;
 
+  // slots start at 1, fetch_add keeps them unique when loader threads create images concurrently
   if (is_sampled)
   {
-    sampledCounter++;
-    newImage.texture_idx = sampledCounter;
-    upload_sampled.push_back({newImage.imageView, newImage.texture_idx});
+    newImage.texture_idx = sampledCounter.fetch_add(1) + 1;
   }
 
   if (is_storage)
   {
-    storageCounter++;
-    newImage.image_idx = storageCounter;
-    upload_storage.push_back({newImage.imageView, newImage.image_idx});
+    newImage.image_idx = storageCounter.fetch_add(1) + 1;
+  }
+
+  if (is_sampled || is_storage)
+  {
+    std::lock_guard<std::mutex> lock(bindlessUploadMutex);
+    if (is_sampled) upload_sampled.push_back({newImage.imageView, newImage.texture_idx});
+    if (is_storage) upload_storage.push_back({newImage.imageView, newImage.image_idx});
   }
 
   return newImage;
@@ -988,37 +1580,10 @@ AllocatedImage Engine::create_image(void* data, VkExtent3D size, VkFormat format
 {
   // 4 bytes per pixel RGBA
   size_t dataSize = size.depth * size.width * size.height * 4;
-  AllocatedBuffer uploadBuffer = create_buffer(dataSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-  
-  memcpy(uploadBuffer.info.pMappedData, data, dataSize);
-  
   AllocatedImage newImage = create_image(size, format, usage | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, mipmapped);
 
-  immediate_submit([&](VkCommandBuffer cmd) {
-    vkutil::transition_image(cmd, newImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-    VkBufferImageCopy copyRegion{};
-    copyRegion.bufferOffset = 0;
-    copyRegion.bufferRowLength = 0;
-    copyRegion.bufferImageHeight = 0;
-    copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    copyRegion.imageSubresource.mipLevel = 0;
-    copyRegion.imageSubresource.baseArrayLayer = 0;
-    copyRegion.imageSubresource.layerCount = 1;
-    copyRegion.imageExtent = size;
-
-    vkCmdCopyBufferToImage(cmd, uploadBuffer.buffer, newImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
-    
-    if (mipmapped)
-    {
-      vkutil::generate_mipmaps(cmd, newImage.image, VkExtent2D{newImage.imageExtent.width, newImage.imageExtent.height});
-    }
-    else
-    {
-      vkutil::transition_image(cmd, newImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
-    }
-  });
-  
-  destroy_buffer(uploadBuffer);
+  // recorded into the open upload batch, the first frame waits on the upload timeline before sampling it
+  uploader.enqueue_image(newImage, data, dataSize, mipmapped);
   return newImage;
 }
 
@@ -1104,8 +1669,11 @@ void Engine::validate_instance_supported()
   }
   // validate instance extension support
   uint32_t requiredCount = 0;
-  const char** requiredExtensions = glfwGetRequiredInstanceExtensions(&requiredCount);
-  m_InstanceExtensions.insert(m_InstanceExtensions.end(), requiredExtensions, requiredExtensions + requiredCount);
+  if (!Application::config.headless)
+  {
+    const char** requiredExtensions = glfwGetRequiredInstanceExtensions(&requiredCount);
+    m_InstanceExtensions.insert(m_InstanceExtensions.end(), requiredExtensions, requiredExtensions + requiredCount);
+  }
   
   if (m_UseValidationLayers)
   {
@@ -1151,7 +1719,10 @@ void Engine::init_vulkan()
     });
   }
 
-  glfwCreateWindowSurface(m_Instance, Window::get(), nullptr, &m_Surface);
+  if (!Application::config.headless)
+  {
+    glfwCreateWindowSurface(m_Instance, Window::get(), nullptr, &m_Surface);
+  }
   
   create_device();
 
@@ -1192,6 +1763,11 @@ void Engine::create_instance()
 
 void Engine::create_device()
 {
+  if (Application::config.headless)
+  {
+    std::erase_if(m_DeviceExtensions, [](const char* ext) { return strcmp(ext, VK_KHR_SWAPCHAIN_EXTENSION_NAME) == 0; });
+  }
+
   DeviceContextBuilder builder{ m_Instance, m_Surface };
   m_Device = builder
     .set_minimum_version(1, 3)
@@ -1212,18 +1788,25 @@ void Engine::create_device()
 
   presentQueue = m_Device.present;
   presentIndex = m_Device.presentIndex;
+
+  computeQueue = m_Device.compute;
+  computeIndex = m_Device.computeIndex;
 }
 
 void Engine::init_swapchain()
 {
-  SwapchainContextBuilder builder{ m_Device, m_Surface };
-  m_Swapchain = builder
-    .set_preferred_format(VkFormat::VK_FORMAT_B8G8R8A8_SRGB)
-    .set_preferred_colorspace(VkColorSpaceKHR::VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
-    .set_preferred_present(VkPresentModeKHR::VK_PRESENT_MODE_FIFO_KHR)
-    .build();
-    
-  LA_LOG_INFO("Using {}", vkutil::stringify_present_mode(m_Swapchain.presentMode));
+  // headless only needs the offscreen targets below
+  if (!Application::config.headless)
+  {
+    SwapchainContextBuilder builder{ m_Device, m_Surface };
+    m_Swapchain = builder
+      .set_preferred_format(VkFormat::VK_FORMAT_B8G8R8A8_SRGB)
+      .set_preferred_colorspace(VkColorSpaceKHR::VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
+      .set_preferred_present(VkPresentModeKHR::VK_PRESENT_MODE_FIFO_KHR)
+      .build();
+      
+    LA_LOG_INFO("Using {}", vkutil::stringify_present_mode(m_Swapchain.presentMode));
+  }
 
   m_DrawExtent = {internalExtent.width, internalExtent.height};
 
@@ -1234,24 +1817,30 @@ void Engine::init_swapchain()
 	drawImageUsages |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
   drawImageUsages |= VK_IMAGE_USAGE_SAMPLED_BIT;
 
-  VkImageUsageFlags depthImageUsages{};
-  depthImageUsages |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
-  depthImageUsages |= VK_IMAGE_USAGE_SAMPLED_BIT;
-  
   m_DrawImage = create_image(internalExtent, VK_FORMAT_R16G16B16A16_SFLOAT, drawImageUsages, false);
-  m_DepthImage = create_image(internalExtent, VK_FORMAT_D32_SFLOAT, depthImageUsages, false);
-  m_ShadowDepthImage = create_image(m_ShadowExtent, VK_FORMAT_D32_SFLOAT, depthImageUsages, false);
+  // the upscale only goes up, an internal resolution above the window one makes the output as large
+  VkExtent3D outputExtent = {
+    std::max(Application::config.resolution.x, internalExtent.width),
+    std::max(Application::config.resolution.y, internalExtent.height),
+    1
+  };
+  m_OutputImage = create_image(outputExtent, upscale::outputFormat, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, false);
+  m_OutputExtent = {outputExtent.width, outputExtent.height};
+  // layered, a cascade per layer. recreated by update_shadow_view when shadow_mapping.resolution changes
+  create_shadow_map(std::clamp(shadowResolution.get(), 256, 8192));
+
+  // the depth image is transient, the render graph places it every frame. only the format is needed up front
+  m_DepthImage = {};
+  m_DepthImage.imageFormat = VK_FORMAT_D32_SFLOAT;
   
   vklog::label_image(device, m_DrawImage.image, "Draw Image");
-  vklog::label_image(device, m_DepthImage.image, "Depth Image");
-  vklog::label_image(device, m_ShadowDepthImage.image, "Shadow Mapping Image");
-
+  vklog::label_image(device, m_OutputImage.image, "Output Image");
   // AR_CORE_INFO("draw idx {}", m_DrawImage.texture_idx);
   
   m_DeletionQueue.push_function([=, this]() {
     destroy_image(m_DrawImage);
-    destroy_image(m_DepthImage);
-    destroy_image(m_ShadowDepthImage);
+    destroy_image(m_OutputImage);
+    destroy_shadow_map(m_ShadowDepthImage, m_ShadowLayerViews);
   });
 }
 
@@ -1262,10 +1851,19 @@ void Engine::init_descriptors()
     {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1},
     {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1},
     {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1},
+    {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 3},
     {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1},
   };
   globalDescriptorAllocator.init(device, 10, sizes);
 
+  std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> persistentSizes = 
+  {
+    {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 3},
+    {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 8},
+    {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 3},
+  };
+  persistentDescriptors.init(device, 16, persistentSizes);
+
   // compute background descriptor layout? 
   {
     DescriptorLayoutBuilder builder;
@@ -1283,9 +1881,9 @@ void Engine::init_descriptors()
   // scene data descriptor layout
   {
     DescriptorLayoutBuilder builder;
-    builder.add_binding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+    builder.add_binding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
     builder.add_binding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-    builder.add_binding(2, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+    builder.add_binding(2, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
     builder.add_binding(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
 
 
@@ -1296,6 +1894,10 @@ void Engine::init_descriptors()
 
     builder.add_binding(7, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
     builder.add_binding(8, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    builder.add_binding(9, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER); // shadow mask
+    builder.add_binding(10, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC); // cluster grid
+    builder.add_binding(11, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER); // lights
+    builder.add_binding(12, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER); // light clusters
     m_SceneDescriptorLayout = builder.build(device, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT); 
   }
   
@@ -1306,8 +1908,15 @@ void Engine::init_descriptors()
   }
 
   
+  VkPhysicalDeviceProperties properties{};
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+  VkDeviceSize uniformAlignment = glm::max<VkDeviceSize>(
+    16,
+    glm::max(properties.limits.minUniformBufferOffsetAlignment, properties.limits.minStorageBufferOffsetAlignment)
+  );
+
   // creates global frame descriptor set
-  for (int i = 0; i < FRAME_OVERLAP; i++)
+  for (uint32_t i = 0; i < framesInFlight; i++)
   {
     std::vector<DescriptorAllocatorGrowable::PoolSizeRatio> frameSizes = {
       {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 3},
@@ -1315,17 +1924,21 @@ void Engine::init_descriptors()
       {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 3},
       {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4},
     };
-    m_Frames[i].frameDescriptors = DescriptorAllocatorGrowable{};
     m_Frames[i].frameDescriptors.init(device, 1000, frameSizes);
     
+    std::string uniformsName = "Frame Uniforms " + std::to_string(i);
+    m_Frames[i].frameUniforms.init(device, m_Allocator, 1024 * 1024, uniformAlignment, uniformsName.c_str(), {graphicsIndex, computeIndex});
+
     m_DeletionQueue.push_function([&, i]() {
       m_Frames[i].frameDescriptors.destroy_pools(device);
+      m_Frames[i].frameUniforms.destroy();
     });
 
   }
 
   m_DeletionQueue.push_function([&]() {
     globalDescriptorAllocator.destroy_pools(device);
+    persistentDescriptors.destroy_pools(device);
     vkDestroyDescriptorSetLayout(device, m_DrawDescriptorLayout, nullptr);
     vkDestroyDescriptorSetLayout(device, m_SingleImageDescriptorLayout, nullptr);
     vkDestroyDescriptorSetLayout(device, m_SceneDescriptorLayout, nullptr);
@@ -1431,6 +2044,7 @@ void Engine::init_bindless_pipeline_layout()
 
 void Engine::update_descriptors()
 {
+  std::lock_guard<std::mutex> lock(bindlessUploadMutex);
   if (upload_storage.size() + upload_sampled.size() == 0) return;
 
   std::vector<VkWriteDescriptorSet> writes;
@@ -1495,11 +2109,51 @@ void Engine::update_descriptors()
 //FIXME: this whole function is wack i should divide it up .. or move to init_descriptors or smth
 void Engine::init_pipelines()
 {
+  pipelineCache.init(device, physicalDevice, Application::config.pipeline_cache_path);
+  m_DeletionQueue.push_function([=, this]() {
+    pipelineCache.destroy();
+  });
+
   init_bindless_pipeline_layout();
-  init_depth_prepass_pipeline();
-  init_shadow_map_pipeline();
-  init_indirect_cull_pipeline();
 
+  // the rest only share the bindless layout, compiling them is most of the startup on software rasterisers.
+  // each builds its own pipelines, the deletion queue and the descriptor allocators are locked
+  auto start = std::chrono::system_clock::now();
+  std::array<std::function<void()>, 10> jobs = {
+    [this] { init_depth_prepass_pipeline(); },
+    [this] { init_shadow_map_pipeline(); },
+    [this] { init_indirect_cull_pipeline(); },
+    [this] { init_mesh_pipeline(); },
+    [] { bloom::prepare(); },
+    [] { ssao::prepare(); },
+    [] { upscale::prepare(); },
+    [] { shadow_mask::prepare(); },
+    [] { light_clusters::prepare(); },
+    [] { weighted_oit::prepare(); },
+  };
+  JobSystem::parallel_for(jobs.size(), [&](uint32_t i) { jobs[i](); });
+
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now() - start);
+  LA_LOG_INFO("Created pipelines in {:.1f} ms", elapsed.count() / 1000.0f);
+}
+
+std::vector<uint32_t> Engine::pcf_constants() const
+{
+  uint32_t taps = std::clamp(shadowPcfTaps.get(), 1, 16);
+  return {taps, std::min(taps, 6u)};
+}
+
+void Engine::update_pipeline_variants()
+{
+  std::vector<uint32_t> pcf = pcf_constants();
+  opaque_set.pipeline = opaqueVariants.get(pcf);
+  // the fallback blends straight into the draw image, kept to compare against
+  std::vector<uint32_t> oit = {pcf[0], pcf[1], 1};
+  transparent_set.pipeline = weighted_oit::enabled() ? oitVariants.get(oit) : transparentVariants.get(pcf);
+}
+
+void Engine::init_mesh_pipeline()
+{
   VkShaderModule bindlessFrag, bindlessVert;
   LA_LOG_ASSERT(
     vkutil::load_shader_module("shaders/bindless/bindless.frag.spv", device, &bindlessFrag),
@@ -1512,41 +2166,54 @@ void Engine::init_pipelines()
     "Error when building the bindless shader module vert"
   );
 
-  PipelineBuilder b;
-  b.set_shaders(bindlessVert, bindlessFrag);
-  b.set_color_attachment_format(m_DrawImage.imageFormat);
-  b.set_depth_format(m_DepthImage.imageFormat);
-  b.set_input_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
-  b.set_polygon_mode(VK_POLYGON_MODE_FILL);
-  b.set_cull_mode(VK_CULL_MODE_BACK_BIT, VK_FRONT_FACE_COUNTER_CLOCKWISE);
-  b.set_multisampling_none();
-  b.disable_blending();
-  b.enable_depthtest(true, VK_COMPARE_OP_EQUAL);
-  
-  
-  b.PipelineLayout = bindless_pipeline_layout;
-  std_pipeline = b.build_pipeline(device);
-
-
-  opaque_set.pipeline = std_pipeline;
-
-
-  b.enable_blending_additive();
-  b.enable_depthtest(false, VK_COMPARE_OP_GREATER_OR_EQUAL);  
-  transparent_set.pipeline = b.build_pipeline(device);
-
+  // opaque and transparent only differ in blending and depth, both are built per pcf tap count
+  auto mesh_builder = [this, bindlessVert, bindlessFrag](bool transparent, bool oit) {
+    return [this, bindlessVert, bindlessFrag, transparent, oit](const VkSpecializationInfo& spec) {
+      PipelineBuilder b;
+      b.set_shaders(bindlessVert, bindlessFrag);
+      b.set_specialization(&spec);
+      std::array<VkFormat, 2> oitFormats = {weighted_oit::accumulationFormat, weighted_oit::revealageFormat};
+      if (oit)
+        b.set_color_attachment_formats(oitFormats);
+      else
+        b.set_color_attachment_format(m_DrawImage.imageFormat);
+      b.set_depth_format(m_DepthImage.imageFormat);
+      b.set_input_topology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+      b.set_polygon_mode(VK_POLYGON_MODE_FILL);
+      b.set_cull_mode(VK_CULL_MODE_BACK_BIT, VK_FRONT_FACE_COUNTER_CLOCKWISE);
+      b.set_multisampling_none();
+      if (oit)
+      {
+        b.enable_blending_weighted_oit();
+        b.enable_depthtest(false, VK_COMPARE_OP_GREATER_OR_EQUAL);
+      }
+      else if (transparent)
+      {
+        b.enable_blending_additive();
+        b.enable_depthtest(false, VK_COMPARE_OP_GREATER_OR_EQUAL);
+      }
+      else
+      {
+        b.disable_blending();
+        b.enable_depthtest(true, VK_COMPARE_OP_EQUAL);
+      }
+      b.PipelineLayout = bindless_pipeline_layout;
+      return b.build_pipeline(device, pipelineCache.handle());
+    };
+  };
 
-  vkDestroyShaderModule(device, bindlessFrag, nullptr);
-  vkDestroyShaderModule(device, bindlessVert, nullptr);
+  // the opaque variants own the modules, the transparent ones are destroyed first
+  opaqueVariants.init(device, "bindless opaque", {0, 1}, {bindlessVert, bindlessFrag}, mesh_builder(false, false));
+  transparentVariants.init(device, "bindless transparent", {0, 1}, {}, mesh_builder(true, false));
+  oitVariants.init(device, "bindless weighted oit", {0, 1, 2}, {}, mesh_builder(true, true));
+  update_pipeline_variants();
 
   m_DeletionQueue.push_function([=, this](){
-    vkDestroyPipeline(device, std_pipeline, nullptr);
-    vkDestroyPipeline(device, transparent_set.pipeline, nullptr);
+    oitVariants.destroy();
+    transparentVariants.destroy();
+    opaqueVariants.destroy();
   });
 
-
-  vklog::label_pipeline(device, std_pipeline, "bindless pipeline!");
-
   
   
   // init debug line pipeline
@@ -1582,7 +2249,7 @@ void Engine::init_pipelines()
   builder.disable_depthtest();
   builder.set_cull_mode(VK_CULL_MODE_NONE, VK_FRONT_FACE_COUNTER_CLOCKWISE);
   builder.PipelineLayout = debugLinePipelineLayout;
-  debugLinePipeline = builder.build_pipeline(device);
+  debugLinePipeline = builder.build_pipeline(device, pipelineCache.handle());
   
   vkDestroyShaderModule(device, debugVert, nullptr);
   vkDestroyShaderModule(device, debugFrag, nullptr);
@@ -1612,7 +2279,7 @@ void Engine::init_depth_prepass_pipeline()
 
   {
     DescriptorLayoutBuilder layoutBuilder;
-    layoutBuilder.add_binding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+    layoutBuilder.add_binding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
     layoutBuilder.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
     layoutBuilder.add_binding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
     layoutBuilder.add_binding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
@@ -1641,7 +2308,7 @@ void Engine::init_depth_prepass_pipeline()
   builder.disable_blending();
   builder.enable_depthtest(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
   builder.PipelineLayout = zpassLayout;
-  m_DepthPrepassPipeline = builder.build_pipeline(device);
+  m_DepthPrepassPipeline = builder.build_pipeline(device, pipelineCache.handle());
   
   vkDestroyShaderModule(device, zpassVert, nullptr);
   vkDestroyShaderModule(device, zpassFrag, nullptr);
@@ -1669,7 +2336,7 @@ void Engine::init_shadow_map_pipeline()
  
   { 
     DescriptorLayoutBuilder builder;
-    builder.add_binding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+    builder.add_binding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
     builder.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
     builder.add_binding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
     builder.add_binding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
@@ -1694,7 +2361,7 @@ void Engine::init_shadow_map_pipeline()
   builder.disable_blending();
   builder.enable_depthtest(true, VK_COMPARE_OP_GREATER_OR_EQUAL);
   builder.PipelineLayout = m_ShadowPipelineLayout;
-  m_ShadowPipeline = builder.build_pipeline(device);
+  m_ShadowPipeline = builder.build_pipeline(device, pipelineCache.handle());
   
   vkDestroyShaderModule(device, shadowFrag, nullptr);
   vkDestroyShaderModule(device, shadowVert, nullptr);
@@ -1710,13 +2377,25 @@ void Engine::init_sync_structures()
 {
   VkFenceCreateInfo fence = vkinit::fence_create_info(VK_FENCE_CREATE_SIGNALED_BIT);
   VkSemaphoreCreateInfo semaphore = vkinit::semaphore_create_info();
-  for (int i = 0; i < FRAME_OVERLAP; i++)
+
+  VkSemaphoreTypeCreateInfo typeInfo{.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO, .pNext = nullptr};
+  typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+  typeInfo.initialValue = 0;
+  VkSemaphoreCreateInfo timelineInfo = vkinit::semaphore_create_info(0);
+  timelineInfo.pNext = &typeInfo;
+  VK_CHECK_RESULT(vkCreateSemaphore(device, &timelineInfo, nullptr, &frameTimeline));
+
+  for (uint32_t i = 0; i < framesInFlight; i++)
   {
-    VK_CHECK_RESULT(vkCreateFence(device, &fence, nullptr, &m_Frames[i].renderFence));
     VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphore, nullptr, &m_Frames[i].swapchainSemaphore));
     VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphore, nullptr, &m_Frames[i].renderSemaphore));
   }
 
+  GpuProfiler::init(this);
+  m_DeletionQueue.push_function([=, this] {
+    GpuProfiler::cleanup(this);
+  });
+
   VK_CHECK_RESULT(vkCreateFence(device, &fence, nullptr, &m_ImmFence));
   m_DeletionQueue.push_function([=, this] {
     vkDestroyFence(device, m_ImmFence, nullptr);
@@ -1726,11 +2405,17 @@ void Engine::init_sync_structures()
 void Engine::init_commands()
 {
   VkCommandPoolCreateInfo commandPoolInfo = vkinit::command_pool_create_info(graphicsIndex, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
-  for (int i = 0; i < FRAME_OVERLAP; i++)
+  for (uint32_t i = 0; i < framesInFlight; i++)
   {
     VK_CHECK_RESULT(vkCreateCommandPool(device, &commandPoolInfo, nullptr, &m_Frames[i].commandPool));
     VkCommandBufferAllocateInfo cmdAllocInfo = vkinit::command_buffer_allocate_info(m_Frames[i].commandPool, 1);
     VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &cmdAllocInfo, &m_Frames[i].mainCommandBuffer));
+
+    m_Frames[i].threadCommands.resize(JobSystem::thread_count());
+    for (CommandPools& pools : m_Frames[i].threadCommands)
+    {
+      pools.init(device, {graphicsIndex, computeIndex}, VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+    }
   }
   
   // create immediate submit command pool & buffer
@@ -1741,6 +2426,16 @@ void Engine::init_commands()
     vkDestroyCommandPool(device, m_ImmCommandPool, nullptr);
   });
 
+  uploader.init(device, m_Allocator, graphicsQueue, &graphicsQueueMutex, graphicsIndex, 64 * 1024 * 1024);
+  m_DeletionQueue.push_function([=, this]() {
+    uploader.destroy();
+  });
+
+  renderGraph.init(device, m_Allocator, framesInFlight, {graphicsQueue, graphicsIndex, &graphicsQueueMutex}, {computeQueue, computeIndex});
+  m_DeletionQueue.push_function([=, this]() {
+    renderGraph.destroy();
+  });
+
 }
 
 void Engine::init_imgui()
@@ -1790,6 +2485,7 @@ void Engine::init_indirect_cull_pipeline()
     builder.add_binding(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);    
     builder.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);    
     builder.add_binding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);    
+    builder.add_binding(3, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER); // depth pyramid
     compact_descriptor_layout = builder.build(device, VK_SHADER_STAGE_COMPUTE_BIT);
   }
 
@@ -1798,25 +2494,42 @@ void Engine::init_indirect_cull_pipeline()
   
   VK_CHECK_RESULT(vkCreatePipelineLayout(device, &computeLayout, nullptr, &cullPipelineLayout));
 
-  VkShaderModule cullShader, outCompact, writeIndirect;
+  VkShaderModule cullShader;
   LA_LOG_ASSERT(
     vkutil::load_shader_module("shaders/culling/indirect_cull.comp.spv", device, &cullShader),
     "Error loading Gradient Compute Effect Shader"
   );
 
+  // the driver may pick any subgroup size down to minSubgroupSize for compute, the shader sizes its scan for the smallest
+  VkPhysicalDeviceVulkan13Properties props13{.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_PROPERTIES, .pNext = nullptr};
+  VkPhysicalDeviceSubgroupProperties subgroupProps{.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES, .pNext = &props13};
+  VkPhysicalDeviceProperties2 props2{.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2, .pNext = &subgroupProps};
+  vkGetPhysicalDeviceProperties2(m_Device.physical, &props2);
 
+  VkSubgroupFeatureFlags required = VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_ARITHMETIC_BIT | VK_SUBGROUP_FEATURE_BALLOT_BIT;
   LA_LOG_ASSERT(
-    vkutil::load_shader_module("shaders/culling/indirect_compact.comp.spv", device, &outCompact),
-    "Error loading compute compact shader effect"
+    (subgroupProps.supportedOperations & required) == required && (subgroupProps.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT),
+    "Compute culling needs basic, arithmetic and ballot subgroup operations"
   );
 
+  stats.subgroupSize = subgroupProps.subgroupSize;
+  uint32_t minSubgroupSize = std::max(props13.minSubgroupSize, 1u);
+  LA_LOG_INFO("Culling with subgroup size {} (min {})", subgroupProps.subgroupSize, minSubgroupSize);
 
-  LA_LOG_ASSERT(
-    vkutil::load_shader_module("shaders/culling/indirect_write.comp.spv", device, &writeIndirect),
-    "Error loading compute write to indirect hader"
-  );
+  std::array<uint32_t, 2> specData = {minSubgroupSize, COMPACTION_LOOKBACK};
+  std::array<VkSpecializationMapEntry, 2> specEntries = {
+    VkSpecializationMapEntry{.constantID = 0, .offset = 0, .size = sizeof(uint32_t)},
+    VkSpecializationMapEntry{.constantID = 1, .offset = sizeof(uint32_t), .size = sizeof(uint32_t)},
+  };
+  VkSpecializationInfo specInfo{
+    .mapEntryCount = (uint32_t) specEntries.size(),
+    .pMapEntries = specEntries.data(),
+    .dataSize = sizeof(specData),
+    .pData = specData.data(),
+  };
 
   VkPipelineShaderStageCreateInfo stageInfo = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT, cullShader);
+  stageInfo.pSpecializationInfo = &specInfo;
 
   VkComputePipelineCreateInfo computePipelineCreateInfo{};
   computePipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
@@ -1825,25 +2538,18 @@ void Engine::init_indirect_cull_pipeline()
   computePipelineCreateInfo.stage = stageInfo;
     
 
-  VK_CHECK_RESULT(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &cullPipeline));
-
-  computePipelineCreateInfo.stage = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT, outCompact);
-
-  VK_CHECK_RESULT(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &compactPipeline));
+  VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache.handle(), 1, &computePipelineCreateInfo, nullptr, &cullPipeline));
 
-  computePipelineCreateInfo.stage = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT, writeIndirect);
-  VK_CHECK_RESULT(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &writeIndirectPipeline));
+  specData[1] = COMPACTION_APPEND;
+  VK_CHECK_RESULT(vkCreateComputePipelines(device, pipelineCache.handle(), 1, &computePipelineCreateInfo, nullptr, &cullAppendPipeline));
   
   
   vkDestroyShaderModule(device, cullShader, nullptr);
-  vkDestroyShaderModule(device, outCompact, nullptr);
-  vkDestroyShaderModule(device, writeIndirect, nullptr);
 
   m_DeletionQueue.push_function([&]() {
     vkDestroyPipelineLayout(device, cullPipelineLayout, nullptr);
     vkDestroyPipeline(device, cullPipeline, nullptr);
-    vkDestroyPipeline(device, compactPipeline, nullptr);
-    vkDestroyPipeline(device, writeIndirectPipeline, nullptr);
+    vkDestroyPipeline(device, cullAppendPipeline, nullptr);
 
     vkDestroyDescriptorSetLayout(device, compact_descriptor_layout, nullptr);
   });
@@ -1852,17 +2558,22 @@ void Engine::init_indirect_cull_pipeline()
 
 void Engine::upload_draw_set(DrawSet& set)
 {
+  sceneVersion++; // new casters, the cached shadow cascades dont have them
+  set.sceneSets.resize(framesInFlight);
+  set.cullSets.resize(framesInFlight * 2);
+
   if (set.draw_datas.size() == 0)
     return;
 
 
 
-  set.buffers.outputCompact= create_buffer(sizeof(uint32_t) * glm::ceil(set.draw_datas.size() / 1024.0)*1024, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
-  vklog::label_buffer(device, set.buffers.outputCompact.buffer, std::format("{}- output culling prefix sum", set.name).c_str());
-  
-  // // IMPORTANT: 32 is the subgroup size. should be queried (NVIDIA is 32 and AMD is 64)
-  set.buffers.partialSums= create_buffer(sizeof(uint32_t) * 32, VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
-  vklog::label_buffer(device, set.buffers.partialSums.buffer, std::format("{} - partial sums buffer compact", set.name).c_str());
+  LA_LOG_ASSERT(set.extra_views < MAX_CULL_VIEWS, "{} has more cull views than MAX_CULL_VIEWS", set.name);
+
+  // group counter followed by one look-back state per cull group and view
+  const size_t cullGroups = (set.draw_datas.size() + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE;
+  const size_t cullViews = 1 + set.extra_views;
+  set.buffers.lookback = create_buffer(sizeof(uint32_t) * (1 + cullGroups * cullViews), VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+  vklog::label_buffer(device, set.buffers.lookback.buffer, std::format("{} - compaction look-back", set.name).c_str());
 
 
   
@@ -1871,33 +2582,37 @@ void Engine::upload_draw_set(DrawSet& set)
   const size_t indirectDrawSize = set.draw_datas.size() * sizeof(IndirectDraw);
 
   set.buffers.draw_data = create_buffer(drawDataSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
-  set.buffers.indirect_draws = create_buffer(indirectDrawSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
-
   vklog::label_buffer(device, set.buffers.draw_data.buffer, std::string(set.name + " - Draw Data Buffer").c_str());
-  vklog::label_buffer(device, set.buffers.indirect_draws.buffer, std::string(set.name + " - Indirect Draw Buffer").c_str());
-  
-  AllocatedBuffer staging = create_buffer(
-    drawDataSize,
-    VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-    VMA_MEMORY_USAGE_CPU_ONLY
-  );
-
-  void* data = staging.allocation->GetMappedData();
 
+  // transfer dst so atomic append compaction can clear the count before counting
+  auto create_list = [&](const std::string& label) {
+    IndirectList list;
+    list.draws = create_buffer(indirectDrawSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+    list.count = create_buffer(sizeof(uint32_t), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+    vklog::label_buffer(device, list.draws.buffer, std::format("{} - {} Draw Buffer", set.name, label).c_str());
+    vklog::label_buffer(device, list.count.buffer, std::format("{} - {} Count", set.name, label).c_str());
+    return list;
+  };
 
-  memcpy(data, set.draw_datas.data(), drawDataSize);
-  // memcpy((uint8_t*) data + drawDataSize, set.indirect_draws.data(), indirectDrawSize);
-
+  set.buffers.indirect = create_list("Indirect");
+  set.buffers.late_indirect = create_list("Late Indirect");
+  for (uint32_t v = 0; v < set.extra_views; v++)
+  {
+    set.buffers.view_indirect.push_back(create_list(std::format("View {} Indirect", v + 1)));
+  }
+  
+  uploader.enqueue_buffer(set.buffers.draw_data.buffer, 0, set.draw_datas.data(), drawDataSize);
 
-  immediate_submit([&](VkCommandBuffer cmd){
-    VkBufferCopy drawDataCopy{};
-    drawDataCopy.dstOffset = 0;
-    drawDataCopy.srcOffset = 0;
-    drawDataCopy.size = drawDataSize;
-    vkCmdCopyBuffer(cmd, staging.buffer, set.buffers.draw_data.buffer, 1, &drawDataCopy);
-  });
+  // nothing was visible before the first frame, the late phase draws it all and fills the history
+  const size_t visibilitySize = 2 * set.draw_datas.size() * sizeof(uint32_t);
+  std::vector<uint32_t> hidden(2 * set.draw_datas.size(), 0);
+  set.buffers.visibility = create_buffer(visibilitySize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+  vklog::label_buffer(device, set.buffers.visibility.buffer, std::string(set.name + " - Visibility History").c_str());
+  uploader.enqueue_buffer(set.buffers.visibility.buffer, 0, hidden.data(), visibilitySize);
 
-  destroy_buffer(staging);    
+  set.buffers.cull_counters = create_buffer(framesInFlight * sizeof(CullCounters), VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+  vklog::label_buffer(device, set.buffers.cull_counters.buffer, std::string(set.name + " - Cull Counters").c_str());
+  memset(set.buffers.cull_counters.info.pMappedData, 0, framesInFlight * sizeof(CullCounters));
 }
 
 void Engine::init_draw_sets()
@@ -1910,85 +2625,140 @@ void Engine::init_draw_sets()
   upload_draw_set(opaque_set);
   upload_draw_set(transparent_set);
 
-  opaque_set.buffers.indirect_count = create_buffer(sizeof(uint32_t), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
-  transparent_set.buffers.indirect_count = create_buffer(sizeof(uint32_t), VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
-
   m_DeletionQueue.push_function([=, this](){
     // destroy all draw_sets
-    destroy_buffer(opaque_set.buffers.draw_data);
-    destroy_buffer(opaque_set.buffers.indirect_draws);
-    destroy_buffer(opaque_set.buffers.outputCompact);
-    destroy_buffer(opaque_set.buffers.partialSums);
-    destroy_buffer(opaque_set.buffers.indirect_count);
-
-    destroy_buffer(transparent_set.buffers.draw_data);
-    destroy_buffer(transparent_set.buffers.indirect_draws);
-    destroy_buffer(transparent_set.buffers.outputCompact);
-    destroy_buffer(transparent_set.buffers.partialSums);
-    destroy_buffer(transparent_set.buffers.indirect_count);
+    for (DrawSet* set : {&opaque_set, &transparent_set})
+    {
+      destroy_buffer(set->buffers.draw_data);
+      destroy_buffer(set->buffers.lookback);
+      for (const IndirectList* list : {&set->buffers.indirect, &set->buffers.late_indirect})
+      {
+        destroy_buffer(list->draws);
+        destroy_buffer(list->count);
+      }
+      for (const IndirectList& list : set->buffers.view_indirect)
+      {
+        destroy_buffer(list.draws);
+        destroy_buffer(list.count);
+      }
+      destroy_buffer(set->buffers.visibility);
+      destroy_buffer(set->buffers.cull_counters);
+    }
   });
 }
 
 
-void Engine::render_draw_set(VkCommandBuffer cmd, DrawSet& draw_set)
+ShadowFragmentSettings Engine::shadow_fragment_settings() const
 {
-  AllocatedBuffer shadowSettings = create_buffer(sizeof(ShadowFragmentSettings), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-  get_current_frame().deletionQueue.push_function([=, this] {
-    destroy_buffer(shadowSettings);
-  });
+  ShadowFragmentSettings settings{};
+  settings.lightViewProj = pcss_settings.lightViewProj;
+  settings.near = 0.1;
+  settings.far = 20.0;
+  settings.light_size = 0.1;
+  settings.enabled = shadowEnabled.get();
+  settings.softness = shadowSoftness.get();
+  settings.cascadeCount = cascades.count;
+  settings.blendBand = glm::clamp(shadowBlendBand.get(), 0.0f, 1.0f);
+  // what shadow_mask::run writes of the half resolution mask this frame
+  settings.maskExtent = glm::vec2((m_DrawExtent.width + 1) / 2, (m_DrawExtent.height + 1) / 2);
+  for (uint32_t c = 0; c < cascades.count; c++)
+  {
+    settings.cascadeViewProj[c] = cascades.viewProj[c];
+    settings.cascadeSplits[c] = cascades.splits[c];
+  }
+  return settings;
+}
 
-  ShadowFragmentSettings* settings = (ShadowFragmentSettings*) shadowSettings.allocation->GetMappedData();
-  settings->lightViewProj = pcss_settings.lightViewProj;
-  settings->near = 0.1;
-  settings->far = 20.0;
-  settings->light_size = 0.1;
-  settings->enabled = shadowEnabled.get();
-  settings->softness = shadowSoftness.get();
-  settings->texture_idx = m_ShadowDepthImage.texture_idx; // how to give it a specific sampler
+void Engine::render_draw_set(VkCommandBuffer cmd, DrawSet& draw_set)
+{
+  // the mask only holds what the depth prepass drew, culled when shadow_mapping.screen_mask is off
+  bool maskPlaced = shadow_mask::output.imageView != VK_NULL_HANDLE;
+  VkImageView maskView = maskPlaced ? shadow_mask::output.imageView : m_WhiteImage.imageView;
+  VkImageLayout maskLayout = maskPlaced ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 
-  
-  AllocatedBuffer sceneDataBuf = create_buffer(sizeof(GPUSceneData), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
-  get_current_frame().deletionQueue.push_function([=, this](){
-     destroy_buffer(sceneDataBuf);
-  });
+  ShadowFragmentSettings settings = shadow_fragment_settings();
+  settings.screenMask = maskPlaced && &draw_set == &opaque_set;
 
-  GPUSceneData* sceneUniformData = (GPUSceneData*) sceneDataBuf.allocation->GetMappedData();
-  *sceneUniformData = sceneData;
+  BufferSlice shadowSettings = get_current_frame().frameUniforms.push(settings);
+  BufferSlice sceneDataBuf = get_current_frame().frameUniforms.push(sceneData);
+  BufferSlice clusterGrid = get_current_frame().frameUniforms.push(light_clusters::grid(mainDrawContext.lights.size()));
+  const AllocatedBuffer& lightBuffer = mainDrawContext.sceneBuffers.lightBuffer;
+  const size_t lightBufferSize = glm::max<size_t>(mainDrawContext.lights.size(), 1) * sizeof(GPULight);
 
   
   if (draw_set.draw_datas.size() != 0)
   {
     vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, draw_set.pipeline);
     
-    VkDescriptorSet globalDescriptor = get_current_frame().frameDescriptors.allocate(device, m_SceneDescriptorLayout);
-    DescriptorWriter writer;
-    writer.write_buffer(0, sceneDataBuf.buffer, sizeof(GPUSceneData), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-    writer.write_image(1, m_ShadowDepthImage.imageView, m_ShadowSampler, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-    writer.write_buffer(2, shadowSettings.buffer, sizeof(ShadowFragmentSettings), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-    writer.write_image(3, ssao::outputBlurred.imageView, m_DefaultSamplerLinear, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-
-    // write draw data in a more frequently updated set..? or have it be a global buffer and have an offset..?
+    GPUSceneBuffers& scene = mainDrawContext.sceneBuffers;
+    PersistentDescriptorSet& globalDescriptor = draw_set.sceneSets[frame_slot()];
+    // ssao is culled when disabled, white is no occlusion
+    bool ssaoPlaced = ssao::outputBlurred.imageView != VK_NULL_HANDLE;
+    VkImageView ambientView = ssaoPlaced ? ssao::outputBlurred.imageView : m_WhiteImage.imageView;
+    VkImageLayout ambientLayout = ssaoPlaced ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    uint64_t key = descriptor_key(
+      sceneDataBuf.buffer, shadowSettings.buffer,
+      m_ShadowDepthImage.imageView, ambientView, maskView,
+      draw_set.buffers.draw_data.buffer, draw_set.draw_datas.size(),
+      scene.transformBuffer.buffer, mainDrawContext.transforms.size(),
+      scene.materialBuffer.buffer, mainDrawContext.standard_materials.size(),
+      scene.positionBuffer.buffer, mainDrawContext.positions.size(),
+      scene.vertexBuffer.buffer, mainDrawContext.vertices.size(),
+      clusterGrid.buffer, lightBuffer.buffer, lightBufferSize, light_clusters::clusterBuffer.buffer
+    );
 
-    writer.write_buffer(5, mainDrawContext.sceneBuffers.transformBuffer.buffer, mainDrawContext.transforms.size() * sizeof(glm::mat4x3), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-    writer.write_buffer(6, mainDrawContext.sceneBuffers.materialBuffer.buffer, mainDrawContext.standard_materials.size() * sizeof(StandardMaterial), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    if (globalDescriptor.stale(key))
+    {
+      if (globalDescriptor.set == VK_NULL_HANDLE)
+        globalDescriptor.set = persistentDescriptors.allocate(device, m_SceneDescriptorLayout);
+
+      DescriptorWriter writer;
+      writer.write_buffer(0, sceneDataBuf.buffer, sizeof(GPUSceneData), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
+      writer.write_image(1, m_ShadowDepthImage.imageView, m_ShadowSampler, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+      writer.write_buffer(2, shadowSettings.buffer, sizeof(ShadowFragmentSettings), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
+      writer.write_image(3, ambientView, m_DefaultSamplerLinear, ambientLayout, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+      writer.write_buffer(4, draw_set.buffers.draw_data.buffer, draw_set.draw_datas.size() * sizeof(DrawData), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+      writer.write_buffer(5, scene.transformBuffer.buffer, mainDrawContext.transforms.size() * sizeof(glm::mat4x3), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+      writer.write_buffer(6, scene.materialBuffer.buffer, mainDrawContext.standard_materials.size() * sizeof(StandardMaterial), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+      writer.write_buffer(7, scene.positionBuffer.buffer, mainDrawContext.positions.size() * sizeof(glm::vec3), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+      writer.write_buffer(8, scene.vertexBuffer.buffer, mainDrawContext.vertices.size() * sizeof(Vertex), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+      writer.write_image(9, maskView, m_DefaultSamplerLinear, maskLayout, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+      writer.write_buffer(10, clusterGrid.buffer, sizeof(ClusterGrid), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
+      writer.write_buffer(11, lightBuffer.buffer, lightBufferSize, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+      writer.write_buffer(12, light_clusters::clusterBuffer.buffer, light_clusters::clusterBufferSize, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+      writer.update_set(device, globalDescriptor.set);
+      globalDescriptor.key = key;
+    }
 
-    writer.write_buffer(7, mainDrawContext.sceneBuffers.positionBuffer.buffer, mainDrawContext.positions.size() * sizeof(glm::vec3), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-    writer.write_buffer(8, mainDrawContext.sceneBuffers.vertexBuffer.buffer, mainDrawContext.vertices.size() * sizeof(Vertex), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-    
-    writer.write_buffer(4, draw_set.buffers.draw_data.buffer, draw_set.draw_datas.size() * sizeof(DrawData), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-    writer.update_set(device, globalDescriptor);
-
-    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, bindless_pipeline_layout, 0, 1, &globalDescriptor, 0, nullptr);
-    vkCmdDrawIndexedIndirectCount(
-      cmd,
-      draw_set.buffers.indirect_draws.buffer,
-      0,
-      draw_set.buffers.indirect_count.buffer,
-      0,
-      draw_set.draw_datas.size(),
-      sizeof(IndirectDraw)
-    );
+    // dynamic offsets are consumed in binding order
+    std::array<uint32_t, 3> offsets = {(uint32_t) sceneDataBuf.offset, (uint32_t) shadowSettings.offset, (uint32_t) clusterGrid.offset};
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, bindless_pipeline_layout, 0, 1, &globalDescriptor.set, offsets.size(), offsets.data());
+    draw_indirect(cmd, draw_set, CULL_PHASE_EARLY);
+    if (Renderer::occlusion_active())
+    {
+      draw_indirect(cmd, draw_set, CULL_PHASE_LATE);
+    }
   }
 }
 
+void Engine::draw_indirect(VkCommandBuffer cmd, const DrawSet& draw_set, uint32_t phase)
+{
+  const IndirectList& list = phase == CULL_PHASE_LATE ? draw_set.buffers.late_indirect : draw_set.buffers.indirect;
+  draw_indirect(cmd, list, draw_set.draw_datas.size());
+}
+
+void Engine::draw_indirect(VkCommandBuffer cmd, const IndirectList& list, uint32_t maxDraws)
+{
+  vkCmdDrawIndexedIndirectCount(
+    cmd,
+    list.draws.buffer,
+    0,
+    list.count.buffer,
+    0,
+    maxDraws,
+    sizeof(IndirectDraw)
+  );
+}
+
 } // namespace Lucerna
@@ -2,13 +2,20 @@
 #include "lucerna_pch.h"
 #include "input_structures.glsl"
 #include "vk_descriptors.h"
+#include "vk_buffers.h"
+#include "vk_upload.h"
 #include "vk_types.h"
 #include "vk_loader.h"
 #include "vk_device.h"
 #include "vk_swapchain.h"
+#include "vk_pipelines.h"
+#include "render_graph.h"
 #include "camera.h"
 #include <vulkan/vulkan_core.h>
 
+#include <atomic>
+#include <mutex>
+
 
 namespace Lucerna {
   struct FrameData
@@ -16,11 +23,15 @@ namespace Lucerna {
     VkCommandPool commandPool{};
     VkCommandBuffer mainCommandBuffer{};
     VkSemaphore swapchainSemaphore{}, renderSemaphore{};
-    VkFence renderFence{};
-    DeletionQueue deletionQueue;
-    DescriptorAllocatorGrowable frameDescriptors;
+    uint64_t timelineValue{ 0 }; // frameTimeline reaches it once the last frame recorded in this slot is done
+    DescriptorAllocatorGrowable frameDescriptors; // reset once timelineValue is reached
+    LinearBufferAllocator frameUniforms; // per frame constants, reset once timelineValue is reached
+    std::vector<CommandPools> threadCommands; // secondaries of the passes, one per job system thread
+    std::array<PersistentDescriptorSet, 2> depthPrepassSets; // per cull phase, the two prepasses record in parallel
+    PersistentDescriptorSet shadowPassSet;
   };
-  constexpr uint32_t FRAME_OVERLAP = 2;
+  // frames in flight are a startup setting (--frames-in-flight), the slots are sized for the most
+  constexpr uint32_t MAX_FRAMES_IN_FLIGHT = 4;
 
 
   
@@ -41,6 +52,7 @@ namespace Lucerna {
     std::vector<glm::vec3> positions;
     std::vector<Vertex> vertices;
     std::vector<glm::vec4> sphere_bounds;
+    std::vector<GPULight> lights; // punctual, binned into the light clusters every frame
     GPUSceneBuffers sceneBuffers;
   };
 
@@ -52,9 +64,14 @@ namespace Lucerna {
     int drawcall_count;
     float scene_update_time;
     float mesh_draw_time;
+    float record_time; // the whole render graph execute
+    std::vector<RenderGraph::RecordTiming> pass_record_times;
+    uint32_t shadow_cascades_rendered{ 0 }; // last frame, the rest were sampled from the cache
+    uint64_t shadow_cache_hits{ 0 }; // frames with shadows that rendered no cascade
     
     std::string gpuName{};
     std::string instanceVersion{};
+    uint32_t subgroupSize{ 0 };
   };
 
   
@@ -91,9 +108,19 @@ namespace Lucerna {
       void update_scene();
       static Engine* get();
 
-      FrameData& get_current_frame() { return m_Frames[frameNumber % FRAME_OVERLAP]; }
+      FrameData& get_current_frame() { return m_Frames[frame_slot()]; }
+      uint32_t frame_slot() const { return frameNumber % framesInFlight; }
+      // what frameTimeline is signalled with once the frame being recorded is done
+      uint64_t frame_timeline_value() const { return frameNumber + 1; }
+      // resources the frame being recorded may still use, deleted once the gpu is done with it
+      void defer_delete(std::function<void()>&& function) { frameDeletionQueue.push_function(frame_timeline_value(), std::move(function)); }
+      void wait_frame_timeline(uint64_t value);
       void resize_swapchain(int width, int height);
       void immediate_submit(std::function<void(VkCommandBuffer cmd)>&& function);
+      // PCF_TAPS, PCF_EARLY_TAPS for shadow_mapping.pcf_taps, every pipeline filtering the cascades bakes them
+      std::vector<uint32_t> pcf_constants() const;
+      // cascades and filtering of the current frame, screenMask is left off
+      ShadowFragmentSettings shadow_fragment_settings() const;
      
       // debug lines functions
       void queue_debug_line(glm::vec3 p1, glm::vec3 p2);
@@ -103,7 +130,7 @@ namespace Lucerna {
     public:
 
       // NOTE: unused, just to get an idea of possible architecture
-      DrawSet opaque_set{.name = "Opaque Set"};
+      DrawSet opaque_set{.name = "Opaque Set", .extra_views = MAX_SHADOW_CASCADES}; // a caster list per shadow cascade
       DrawSet transparent_set{.name = "Transparent Set"};
 
       // NOTE: end unused
@@ -119,9 +146,12 @@ namespace Lucerna {
       VkDevice device;
       VkPhysicalDevice physicalDevice;
       VkQueue graphicsQueue;
+      std::mutex graphicsQueueMutex; // the uploader submits from loader threads, present can share the queue
       VkQueue presentQueue;
+      VkQueue computeQueue; // null without async compute
       uint32_t graphicsIndex;
       uint32_t presentIndex;
+      uint32_t computeIndex;
       QueueFamilyIndices indices;
 
       Camera mainCamera;
@@ -130,17 +160,20 @@ namespace Lucerna {
       EngineStats stats{};
       
       size_t frameNumber{ 0 };
+      uint32_t framesInFlight{ 2 };
       bool stopRendering{ false };
 
       bool valid_swapchain{ true };
 
       AllocatedImage m_DrawImage;
+      AllocatedImage m_OutputImage; // the draw image upscaled to the output resolution, what the viewport shows
       AllocatedImage m_DepthImage;
       AllocatedImage m_WhiteImage;
       AllocatedImage m_BlackImage;
       AllocatedImage m_GreyImage;
       AllocatedImage m_ErrorCheckerboardImage;
-      AllocatedImage m_ShadowDepthImage; // used for shadow mapping!
+      AllocatedImage m_ShadowDepthImage; // a layer per cascade, imageView is the 2D_ARRAY view the geometry samples
+      std::array<VkImageView, MAX_SHADOW_CASCADES> m_ShadowLayerViews{}; // rendered into by the shadow pass
       VkSampler m_DefaultSamplerNearest;
       VkSampler m_DefaultSamplerLinear;
       VkSampler m_ShadowSampler;
@@ -156,11 +189,18 @@ namespace Lucerna {
       glm::mat4 lightProj{ 1.0f };
       glm::mat4 lightViewProj{ 1.0f };
       DeletionQueue m_DeletionQueue;
-      FrameData m_Frames[FRAME_OVERLAP];
+      FrameData m_Frames[MAX_FRAMES_IN_FLIGHT]; // the first framesInFlight are used
+      VkSemaphore frameTimeline{}; // signalled with frameNumber + 1 by the last submission of every frame
+      TimelineDeletionQueue frameDeletionQueue;
       DescriptorAllocatorGrowable globalDescriptorAllocator;
+      DescriptorAllocatorGrowable persistentDescriptors; // sets that outlive a frame, see PersistentDescriptorSet
+      UploadBatcher uploader;
+      RenderGraph renderGraph; // rebuilt every frame in draw()
+      PipelineCache pipelineCache; // every pipeline is created through it
       VkExtent3D internalExtent{};
       VmaAllocator m_Allocator{};
       VkExtent2D m_DrawExtent{};
+      VkExtent2D m_OutputExtent{}; // written part of the output image, never smaller than m_DrawExtent
  
     private:
       void init_vulkan();
@@ -172,6 +212,8 @@ namespace Lucerna {
       void init_depth_prepass_pipeline();
       void init_shadow_map_pipeline();
       void init_mesh_pipeline();
+      // points the draw sets at the variants for the current cvars
+      void update_pipeline_variants();
       void init_imgui();
       void init_default_data();
       void validate_instance_supported();
@@ -196,17 +238,17 @@ namespace Lucerna {
       public:
       VkDescriptorSet bindless_descriptor_set;
       VkPipelineLayout bindless_pipeline_layout;
-      VkPipeline std_pipeline;
+      PipelineVariants opaqueVariants; // PCF_TAPS, PCF_EARLY_TAPS
+      PipelineVariants transparentVariants;
+      PipelineVariants oitVariants; // PCF_TAPS, PCF_EARLY_TAPS, WEIGHTED_OIT. transparent_set into the oit targets
       VkDescriptorSet global_descriptor_set;
 
       private:
 
       // indirect culling - FIXME: should use draw_sets one for the different geometry "buckets"
-      // FIXME: scuffed now culls WHOLE DRAWING EVEN FOR SHADOWS
     public:
-      VkPipeline cullPipeline{};
-      VkPipeline compactPipeline{};
-      VkPipeline writeIndirectPipeline{};
+      VkPipeline cullPipeline{};       // COMPACTION_LOOKBACK
+      VkPipeline cullAppendPipeline{}; // COMPACTION_APPEND
       
       VkPipelineLayout cullPipelineLayout{};
       VkDescriptorSetLayout compact_descriptor_layout{};
@@ -220,32 +262,49 @@ namespace Lucerna {
       
       std::vector<std::pair<VkImageView, uint32_t>> upload_sampled;
       std::vector<std::pair<VkImageView, uint32_t>> upload_storage;
+      std::mutex bindlessUploadMutex; // create_image runs on loader threads
       
     public:
 
       // NOTE: use this across the board instead of free list?
-      uint32_t sampledCounter{ 0 };
+      // image slots are reserved from loader threads, samplers are still created on the main thread
+      std::atomic<uint32_t> sampledCounter{ 0 };
       uint32_t samplerCounter{ 0 };
-      uint32_t storageCounter{ 0 };
+      std::atomic<uint32_t> storageCounter{ 0 };
 
     private:
       void init_bindless_pipeline_layout();
       void update_descriptors();
 
       inline bool should_quit();
+      void run_headless();
+      void collect_frame_sample(uint32_t frame_slot, uint64_t frame_idx, float cpu_ms);
       void draw();
       void draw_background(VkCommandBuffer cmd);
-      void draw_depth_prepass(VkCommandBuffer cmd);
-      void draw_geometry(VkCommandBuffer cmd);
-      void draw_shadow_pass(VkCommandBuffer cmd);
+      void draw_depth_prepass(VkCommandBuffer cmd, uint32_t phase);
+      // transparent_set is left to draw_transparent_oit when weighted oit is on
+      void draw_geometry(VkCommandBuffer cmd, bool withTransparent);
+      void draw_transparent_oit(VkCommandBuffer cmd);
+      // renders the cascades in cascadeMask, a bit each
+      void draw_shadow_pass(VkCommandBuffer cmd, uint32_t cascadeMask);
       void draw_debug_lines(VkCommandBuffer cmd);
       
+      void update_shadow_view();
+      // scatters lights.count lights over the scene when the lights cvars change, the old buffer is deferred
+      void update_lights();
+      // (re)creates the layered shadow map, the old one is destroyed once the frames using it are done
+      void create_shadow_map(uint32_t resolution);
+      void destroy_shadow_map(const AllocatedImage& image, const std::array<VkImageView, MAX_SHADOW_CASCADES>& layerViews) const;
+      
       void render_draw_set(VkCommandBuffer cmd, DrawSet& draw_set);
+      // the indirect list of one cull phase (CULL_PHASE_EARLY / CULL_PHASE_LATE)
+      void draw_indirect(VkCommandBuffer cmd, const DrawSet& draw_set, uint32_t phase);
+      void draw_indirect(VkCommandBuffer cmd, const IndirectList& list, uint32_t maxDraws);
       
     private:
-      VkInstance m_Instance;
-      VkDebugUtilsMessengerEXT m_DebugMessenger; //NOTE move to Logger?
-      VkSurfaceKHR m_Surface;
+      VkInstance m_Instance{ VK_NULL_HANDLE };
+      VkDebugUtilsMessengerEXT m_DebugMessenger{ VK_NULL_HANDLE }; //NOTE move to Logger?
+      VkSurfaceKHR m_Surface{ VK_NULL_HANDLE }; // stays null headless, the device picks its queues without present support
       std::vector<const char*> m_InstanceExtensions = {};
       std::vector<const char*> m_DeviceExtensions = {
         VK_KHR_SWAPCHAIN_EXTENSION_NAME,
@@ -289,26 +348,50 @@ namespace Lucerna {
       VkPipelineLayout debugLinePipelineLayout;
       VkPipeline debugLinePipeline;
       std::vector<glm::vec3> debugLines;
-      AllocatedBuffer debugLinesBuffer;
       
 
-      VkExtent3D m_ShadowExtent{ 1024, 1024, 1 };
+      VkExtent3D m_ShadowExtent{ 2048, 2048, 1 }; // of every cascade, shadow_mapping.resolution
+
+      // fitted to slices of the camera frustum every frame in update_shadow_view
+      struct ShadowCascades
+      {
+        std::array<glm::mat4, MAX_SHADOW_CASCADES> viewProj{};
+        std::array<float, MAX_SHADOW_CASCADES> splits{}; // camera view depth each cascade ends at
+        uint32_t count{ 0 };
+      } cascades;
+
+      // layers stay in the shadow map between frames, a cascade is only rendered again when its fit, the light
+      // or the caster geometry changed
+      struct ShadowCache
+      {
+        std::array<glm::mat4, MAX_SHADOW_CASCADES> viewProj{}; // the layers were rendered with
+        uint32_t valid{ 0 };  // layers holding the casters of sceneVersion, a bit each
+        uint32_t dirty{ 0 };  // cascades to render this frame
+        uint64_t sceneVersion{ 0 };
+        bool written{ false }; // the image left UNDEFINED, importing it keeps the layers
+      } shadowCache;
+      uint64_t sceneVersion{ 0 }; // bumped whenever scene or draw set buffers are uploaded
+
+      // what mainDrawContext.lights was generated with, see update_lights
+      struct LightScatter
+      {
+        int32_t count{ -1 };
+        float range{ 0.0f };
+        float intensity{ 0.0f };
+        float spotFraction{ 0.0f };
+      } lightScatter;
 
       struct ShadowMappingSettings
       {
         glm::mat4 lightViewProj;
         bool rotate{ false };
         float light_size_uv{/* 0.25 */ 0.0};
-        float ortho_size{ 5.0 };
-        float distance{ 5.0 };
-        float near{ 0.1 };
-        float far{ 15.0 };
+        float distance{ 5.0 }; // of the orbiting light from the origin, only sets the direction
         uint32_t shadowNumber{ 0 };
       } pcss_settings;
 
        struct ShadowPassSettings
       {
-        AllocatedBuffer buffer;
         glm::mat4 lightView; 
       } shadowPass;
   };
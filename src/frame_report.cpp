@@ -0,0 +1,82 @@
+#include "frame_report.h"
+#include "application.h"
+#include "engine.h"
+#include "logger.h"
+
+#include <fstream>
+#include <format>
+#include <numeric>
+
+namespace Lucerna {
+
+void FrameReport::add_sample(const FrameSample& sample)
+{
+  samples.push_back(sample);
+}
+
+static std::string summarise(std::vector<float> values)
+{
+  if (values.empty())
+  {
+    return "{}";
+  }
+
+  std::sort(values.begin(), values.end());
+  float avg = std::accumulate(values.begin(), values.end(), 0.0f) / values.size();
+  float p95 = values[std::min(values.size() - 1, (size_t) (values.size() * 0.95f))];
+
+  return std::format(
+    "{{ \"avg\": {:.4f}, \"min\": {:.4f}, \"max\": {:.4f}, \"p95\": {:.4f} }}",
+    avg, values.front(), values.back(), p95
+  );
+}
+
+bool FrameReport::write_json(std::string_view path)
+{
+  std::ofstream file{std::string(path)};
+  if (!file.is_open())
+  {
+    LA_LOG_ERROR("Failed to open frame report {}", path);
+    return false;
+  }
+
+  Engine* engine = Engine::get();
+
+  std::vector<float> cpu, gpu;
+  cpu.reserve(samples.size());
+  gpu.reserve(samples.size());
+  for (const FrameSample& s : samples)
+  {
+    cpu.push_back(s.cpu_ms);
+    gpu.push_back(s.gpu_ms);
+  }
+
+  file << "{\n";
+  file << std::format("  \"gpu\": \"{}\",\n", engine->stats.gpuName);
+  file << std::format("  \"instance_version\": \"{}\",\n", engine->stats.instanceVersion);
+  file << std::format("  \"scene\": \"{}\",\n", Application::config.scene_path);
+  file << std::format("  \"resolution\": [{}, {}],\n", engine->internalExtent.width, engine->internalExtent.height);
+  file << std::format("  \"frame_count\": {},\n", samples.size());
+  file << std::format("  \"cpu_ms\": {},\n", summarise(cpu));
+  file << std::format("  \"gpu_ms\": {},\n", summarise(gpu));
+  file << std::format("  \"shadow_cache_hits\": {},\n", engine->stats.shadow_cache_hits);
+  file << "  \"frames\": [\n";
+
+  for (size_t i = 0; i < samples.size(); i++)
+  {
+    const FrameSample& s = samples[i];
+    file << std::format(
+      "    {{ \"frame\": {}, \"cpu_ms\": {:.4f}, \"gpu_ms\": {:.4f}, \"draws\": {}, \"opaque_visible\": {}, \"transparent_visible\": {}, \"render_scale\": {:.3f}, \"shadow_cascades\": {} }}{}\n",
+      s.frame, s.cpu_ms, s.gpu_ms, s.draw_count, s.opaque_visible, s.transparent_visible, s.render_scale, s.shadow_cascades,
+      i + 1 == samples.size() ? "" : ","
+    );
+  }
+
+  file << "  ]\n";
+  file << "}\n";
+
+  LA_LOG_INFO("Wrote frame report ({} frames) to {}", samples.size(), path);
+  return true;
+}
+
+} // namespace Lucerna
@@ -0,0 +1,26 @@
+#pragma once
+#include "lucerna_pch.h"
+
+namespace Lucerna {
+
+  struct FrameSample
+  {
+    uint64_t frame;
+    float cpu_ms;   // update_scene + draw recording/submit
+    float gpu_ms;   // first to last timestamp of the frame command buffer
+    uint32_t draw_count;          // draws fed into culling (all draw sets)
+    uint32_t opaque_visible;      // indirect count written by the cull passes
+    uint32_t transparent_visible;
+    float render_scale;           // per axis, dynamic resolution moves it
+    uint32_t shadow_cascades;     // rendered, 0 when every cascade came from the shadow cache
+  };
+
+  // collects per frame samples in headless runs and dumps them as json
+  struct FrameReport
+  {
+    static void add_sample(const FrameSample& sample);
+    static bool write_json(std::string_view path);
+    static inline std::vector<FrameSample> samples{};
+  };
+
+} // namespace Lucerna
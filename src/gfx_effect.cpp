@@ -12,41 +12,23 @@
 namespace Lucerna {
 
 AutoCVar_Int bloomEnabled{"bloom.enabled", "", 0, CVarFlags::EditCheckbox};
+AutoCVar_Int bloomMips{"bloom.mips", "mips the bloom blurs over, up to 6", 6, CVarFlags::None};
+AutoCVar_Int ssaoKernelSize{"ssao.kernel_size", "samples per pixel, rounded down to a power of two in [8, 64]. baked into the pipeline", 32, CVarFlags::None};
+AutoCVar_Int pyramidShowDebug{"culling.show_pyramid", "write the depth pyramid to a debug texture every frame", 0, CVarFlags::EditCheckbox};
+AutoCVar_Int pyramidDebugLevel{"culling.pyramid_level", "depth pyramid level shown by the debug view", 0, CVarFlags::None};
+AutoCVar_Int upscaleEnabled{"upscale.enabled", "upscale the draw image to the output resolution, off shows the draw image as is", 1, CVarFlags::EditCheckbox};
+AutoCVar_Int shadowScreenMask{"shadow_mapping.screen_mask", "resolve the opaque shadows at half resolution before the geometry pass, off filters them per fragment", 1, CVarFlags::EditCheckbox};
+AutoCVar_Int weightedOit{"transparency.weighted_oit", "draw the transparent set unsorted into weighted blended oit targets, off blends it straight into the draw image", 1, CVarFlags::EditCheckbox};
+AutoCVar_Int lightsShowClusters{"lights.show_clusters", "tint the scene by the lights binned into each cluster, blue is few and red is MAX_LIGHTS_PER_CLUSTER", 0, CVarFlags::EditCheckbox};
+AutoCVar_Float lightsClusterFar{"lights.cluster_far", "view depth the last cluster slice starts at, capped by camera.far", 200.0f, CVarFlags::Advanced};
+AutoCVar_Float upscaleSharpness{"upscale.sharpness", "contrast adaptive sharpening after the upscale, 0 is off and 1 the strongest", 0.5f, CVarFlags::EditFloatDrag};
 
 void bloom::prepare()
 {
   Engine* engine = Engine::get();
   VkDevice device = engine->device;
 
-  // create mip chain
-  VkFormat format = VK_FORMAT_R16G16B16A16_SFLOAT;
-  VkExtent3D size = {engine->internalExtent.width / 2, engine->internalExtent.height / 2, 1};
-
-  VkImageUsageFlags usages{};
-  usages |= VK_IMAGE_USAGE_STORAGE_BIT;
-  usages |= VK_IMAGE_USAGE_SAMPLED_BIT;
-  
-  for (uint32_t i = 0; i < 6; i++)
-  {
-    VkExtent3D mipSize = 
-    {
-      static_cast<uint32_t>(size.width /  glm::exp2(i)),
-      static_cast<uint32_t>(size.height / glm::exp2(i)), 
-      1
-    };
-    AllocatedImage img = engine->create_image(mipSize, format, usages);
-    std::string identifier = "Bloom Mipmap Level" + std::to_string(i); 
-    vklog::label_image(device, img.image, identifier.c_str());
-    blurredMips.push_back(img);
-  }
-    
-  // FIXME: kind of ass having to do one full immediate submit just to transfer an img
-  engine->immediate_submit([=](VkCommandBuffer cmd){
-    for (auto img : blurredMips)
-    {
-      vkutil::transition_image(cmd, img.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
-    }
-  });
+  // the mip chain is transient, see mip_extent
 
   {
     DescriptorLayoutBuilder builder;
@@ -63,7 +45,7 @@ void bloom::prepare()
 
   VkPushConstantRange pcs{};
   pcs.offset = 0;
-  pcs.size = sizeof(BloomPushConstants);
+  pcs.size = sizeof(bloom_pcs);
   pcs.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
 
   computeLayout.pPushConstantRanges = &pcs;
@@ -86,10 +68,10 @@ void bloom::prepare()
   VkComputePipelineCreateInfo pipelineInfo{ .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO, .pNext = nullptr};
   pipelineInfo.layout = pipelineLayout;
   pipelineInfo.stage = stageInfo;
-  VK_CHECK_RESULT(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &downsamplePipeline));
+  VK_CHECK_RESULT(vkCreateComputePipelines(device, engine->pipelineCache.handle(), 1, &pipelineInfo, nullptr, &downsamplePipeline));
   
   pipelineInfo.stage.module = upsample;
-  VK_CHECK_RESULT(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &upsamplePipeline));
+  VK_CHECK_RESULT(vkCreateComputePipelines(device, engine->pipelineCache.handle(), 1, &pipelineInfo, nullptr, &upsamplePipeline));
  
 
   descriptorSet = engine->globalDescriptorAllocator.allocate(device, descriptorLayout);
@@ -108,10 +90,6 @@ void bloom::prepare()
   vkDestroyShaderModule(device, upsample, nullptr);
 
   engine->m_DeletionQueue.push_function([device, engine] {
-    for (auto img : blurredMips)
-    {
-      engine->destroy_image(img);
-    }
     vkDestroySampler(device, sampler, nullptr);
     vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
     vkDestroyPipeline(device, upsamplePipeline, nullptr);
@@ -122,7 +100,38 @@ void bloom::prepare()
 
 }
 
-void bloom::run(VkCommandBuffer cmd, VkImageView targetImage)
+// each step samples the mip the step before it wrote, the upsample also blends into it.
+// the steps depend on each other so this stays one barrier per mip, the draw image is handled by the render graph
+static void mip_barrier(VkCommandBuffer cmd, VkImage mip)
+{
+  VkImageMemoryBarrier2 imgBarrier{ .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2, .pNext = nullptr};
+  imgBarrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+  imgBarrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+  imgBarrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+  imgBarrier.dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+  imgBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+  imgBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+  imgBarrier.image = mip;
+  imgBarrier.subresourceRange = vkinit::image_subresource_range(VK_IMAGE_ASPECT_COLOR_BIT);
+
+  VkDependencyInfo depInfo{ .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO, .pNext = nullptr};
+  depInfo.imageMemoryBarrierCount = 1;
+  depInfo.pImageMemoryBarriers = &imgBarrier;
+  vkCmdPipelineBarrier2(cmd, &depInfo);
+}
+
+uint32_t bloom::mip_count()
+{
+  return std::clamp(bloomMips.get(), 1, (int) mipCount);
+}
+
+VkExtent3D bloom::mip_extent(uint32_t mip)
+{
+  VkExtent3D size = Engine::get()->internalExtent;
+  return {std::max(size.width >> (mip + 1), 1u), std::max(size.height >> (mip + 1), 1u), 1};
+}
+
+void bloom::run(VkCommandBuffer cmd, VkImageView targetImage, std::span<const AllocatedImage> blurredMips)
 {
 
   if (bloomEnabled.get() == false) return;
@@ -132,10 +141,23 @@ void bloom::run(VkCommandBuffer cmd, VkImageView targetImage)
   // mix with target img
   
   Engine* engine = Engine::get();
-  VkExtent3D size = {engine->internalExtent.width, engine->internalExtent.height, 1};
+  VkExtent3D size = engine->internalExtent;
+
+  // the mips are sized for the internal resolution, only the part under the draw extent is used
+  VkExtent2D drawn = engine->m_DrawExtent;
+  auto drawn_mip = [drawn](uint32_t mip) -> VkExtent2D {
+    return {std::max(drawn.width >> (mip + 1), 1u), std::max(drawn.height >> (mip + 1), 1u)};
+  };
+  auto set_extents = [](bloom_pcs& pcs, VkExtent3D srcSize, VkExtent2D src, VkExtent2D dst) {
+    pcs.srcResolution = {srcSize.width, srcSize.height};
+    pcs.srcExtent = {src.width, src.height};
+    pcs.dstExtent = {dst.width, dst.height};
+  };
+  auto dispatch = [cmd](VkExtent2D dst) {
+    vkCmdDispatch(cmd, std::ceil(dst.width / 16.0), std::ceil(dst.height / 16.0), 1);
+  };
 
   bloom_pcs pcs{};
-  pcs.srcResolution = {size.width, size.height};
   pcs.filterRadius = 0.005;
   pcs.mipLevel = 0;
   
@@ -151,34 +173,16 @@ void bloom::run(VkCommandBuffer cmd, VkImageView targetImage)
   }
   vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &firstSet, 0, nullptr);
 
+  set_extents(pcs, size, drawn, drawn_mip(0));
   vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(bloom_pcs), &pcs);
-  size.width *= 0.5;
-  size.height *= 0.5;
-  vkCmdDispatch(cmd, std::ceil(size.width / 16.0), std::ceil(size.height / 16.0), 1);
-
-  VkImageMemoryBarrier2 imgBarrier{ .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2, .pNext = nullptr};
-  imgBarrier.srcStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
-  imgBarrier.srcAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT;
-  imgBarrier.dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
-  imgBarrier.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT;
-  imgBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
-  imgBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
-  imgBarrier.image = blurredMips[0].image;
-  imgBarrier.subresourceRange = vkinit::image_subresource_range(VK_IMAGE_ASPECT_COLOR_BIT);
-  
-  VkDependencyInfo depInfo{ .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO, .pNext = nullptr};
-  depInfo.imageMemoryBarrierCount = 1;
-  depInfo.pImageMemoryBarriers = &imgBarrier;
+  dispatch(drawn_mip(0));
 
-  vkCmdPipelineBarrier2(cmd, &depInfo);
+  mip_barrier(cmd, blurredMips[0].image);
 
   // mip to mip downsample
    
-  for (uint32_t i = 1; i < 6; i++)
+  for (uint32_t i = 1; i < blurredMips.size(); i++)
   {
-    pcs.srcResolution = {size.width, size.height};
-
-
     //FIXME : per frame descriptor set allocs not freed :/
     VkDescriptorSet set = engine->get_current_frame().frameDescriptors.allocate(engine->device, descriptorLayout);
     {
@@ -189,34 +193,16 @@ void bloom::run(VkCommandBuffer cmd, VkImageView targetImage)
     }
     vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &set, 0, nullptr);
 
+    set_extents(pcs, mip_extent(i - 1), drawn_mip(i - 1), drawn_mip(i));
     vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(bloom_pcs), &pcs);
-    size.width *= 0.5;
-    size.height *= 0.5;
-    vkCmdDispatch(cmd, std::ceil(size.width / 16.0), std::ceil(size.height / 16.0), 1);
-    
+    dispatch(drawn_mip(i));
 
-    VkImageMemoryBarrier2 imgBarrier{ .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2, .pNext = nullptr};
-    imgBarrier.srcStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
-    imgBarrier.srcAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT;
-    imgBarrier.dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
-    imgBarrier.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT;
-    imgBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
-    imgBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
-    imgBarrier.image = blurredMips[i].image;
-    imgBarrier.subresourceRange = vkinit::image_subresource_range(VK_IMAGE_ASPECT_COLOR_BIT);
-    
-    VkDependencyInfo depInfo{ .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO, .pNext = nullptr};
-    depInfo.imageMemoryBarrierCount = 1;
-    depInfo.pImageMemoryBarriers = &imgBarrier;
-
-    vkCmdPipelineBarrier2(cmd, &depInfo);
-
-    // barrier until compute dispatch is finished
+    mip_barrier(cmd, blurredMips[i].image);
   }
   
   vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, upsamplePipeline); 
   
-  for (uint32_t i = 5; i > 0; i--)
+  for (uint32_t i = blurredMips.size() - 1; i > 0; i--)
   {
     VkDescriptorSet set = engine->get_current_frame().frameDescriptors.allocate(engine->device, descriptorLayout);
     {
@@ -227,28 +213,11 @@ void bloom::run(VkCommandBuffer cmd, VkImageView targetImage)
     }
     vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &set, 0, nullptr);
     
-    pcs.srcResolution = {size.width, size.height};
-    size.width *= 2;
-    size.height *= 2;
-
+    set_extents(pcs, mip_extent(i), drawn_mip(i), drawn_mip(i - 1));
     vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(bloom_pcs), &pcs);
-    vkCmdDispatch(cmd, std::ceil(size.width / 16.0), std::ceil(size.height / 16.0), 1);
+    dispatch(drawn_mip(i - 1));
 
-    VkImageMemoryBarrier2 imgBarrier{ .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2, .pNext = nullptr};
-    imgBarrier.srcStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
-    imgBarrier.srcAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT;
-    imgBarrier.dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
-    imgBarrier.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT;
-    imgBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
-    imgBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
-    imgBarrier.image = blurredMips[i-1].image;
-    imgBarrier.subresourceRange = vkinit::image_subresource_range(VK_IMAGE_ASPECT_COLOR_BIT);
-    
-    VkDependencyInfo depInfo{ .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO, .pNext = nullptr};
-    depInfo.imageMemoryBarrierCount = 1;
-    depInfo.pImageMemoryBarriers = &imgBarrier;
-
-    vkCmdPipelineBarrier2(cmd, &depInfo);
+    mip_barrier(cmd, blurredMips[i-1].image);
   }
   
   
@@ -264,19 +233,20 @@ void bloom::run(VkCommandBuffer cmd, VkImageView targetImage)
     writer.update_set(engine->device, set);
   }
   vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &set, 0, nullptr);
-  vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(BloomPushConstants), &pcs);
-  
-  pcs.srcResolution = {size.width, size.height};
-  size.width *= 2;
-  size.height *= 2;
 
-  vkCmdDispatch(cmd, std::ceil(size.width / 16.0), std::ceil(size.height / 16.0), 1);
+  set_extents(pcs, mip_extent(0), drawn_mip(0), drawn);
+  vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(bloom_pcs), &pcs);
+  dispatch(drawn);
+}
 
 
-  // FIXME: do i need a barrier here?
+std::vector<uint32_t> ssao::kernel_constants()
+{
+  // a power of two so the shader can stride evenly over the 64 kernel samples
+  uint32_t size = std::clamp(ssaoKernelSize.get(), 8, 64);
+  return {1u << (uint32_t) std::log2(size)};
 }
 
-
 void ssao::prepare()
 {
   /*
@@ -340,29 +310,27 @@ void ssao::prepare()
     "Error loading Bilateral Blur SSAO Effect Shader" 
   );
 
-  VkPipelineShaderStageCreateInfo stageInfo = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT, ssaoShader);
-  
+  ssaoVariants.init(device, "ssao", {0}, {ssaoShader}, [device, engine, ssaoShader](const VkSpecializationInfo& spec) {
+    VkComputePipelineCreateInfo info{.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO, .pNext = nullptr};
+    info.layout = pipelineLayout;
+    info.stage = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT, ssaoShader);
+    info.stage.pSpecializationInfo = &spec;
+
+    VkPipeline pipeline;
+    VK_CHECK_RESULT(vkCreateComputePipelines(device, engine->pipelineCache.handle(), 1, &info, nullptr, &pipeline));
+    return pipeline;
+  });
+  ssaoVariants.get(kernel_constants());
+
   VkComputePipelineCreateInfo computePipelineCreateInfo{};
   computePipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
   computePipelineCreateInfo.pNext = nullptr;
-  computePipelineCreateInfo.layout = pipelineLayout;
-  computePipelineCreateInfo.stage = stageInfo;
-  
-  VK_CHECK_RESULT(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &ssaoPipeline));
-
   computePipelineCreateInfo.layout = blurPipelineLayout;
   computePipelineCreateInfo.stage = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT, blurShader);
-  VK_CHECK_RESULT(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &computePipelineCreateInfo, nullptr, &blurPipeline));
+  VK_CHECK_RESULT(vkCreateComputePipelines(device, engine->pipelineCache.handle(), 1, &computePipelineCreateInfo, nullptr, &blurPipeline));
   
 
-  // create output image
-  VkFormat format = VK_FORMAT_R8_UNORM;
-  VkImageUsageFlags usages = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT; /*last one for debugging*/
-  VkExtent3D size = engine->internalExtent;
-  outputAmbient = engine->create_image(size, format, usages);
-  outputBlurred = engine->create_image(size, format, usages);
-  vklog::label_image(device, outputAmbient.image, "SSAO Output Ambient Texture");
-  vklog::label_image(device, outputBlurred.image, "SSAO Output Blurred Ambient Texture");  // noise image
+  // the output images are transient, the render graph places them
 
   std::uniform_real_distribution<float> randomFloats(0.0, 1.0); // random floats between [0.0, 1.0]
   std::default_random_engine generator(std::chrono::system_clock::now().time_since_epoch().count()); // using default seed!
@@ -383,12 +351,6 @@ void ssao::prepare()
 
 
 
-  //FIXME: i might be a dumbass and u dont do this!!
-  engine->immediate_submit([=](VkCommandBuffer cmd){
-    vkutil::transition_image(cmd, outputAmbient.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
-    vkutil::transition_image(cmd, outputBlurred.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
-  });
-  
   VkSamplerCreateInfo sampl{.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO, .pNext = nullptr};
   sampl.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
   sampl.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
@@ -400,7 +362,6 @@ void ssao::prepare()
   sampl.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
   vkCreateSampler(device, &sampl, nullptr, &noiseSampler);
   
-  ssaoUniform = engine->create_buffer(sizeof(u_ssao), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
   std::array<glm::vec3, 64> samples;
 
   auto lerp = [](float a, float b, float f) {
@@ -424,23 +385,18 @@ void ssao::prepare()
       samples[i] = sample;  
   }
   
-  memcpy(ssaoUniform.info.pMappedData, samples.data(), sizeof(glm::vec3) * 64);
-  // allocate uniform buffer 64 vec3
+  memcpy(&kernel, samples.data(), sizeof(glm::vec3) * 64);
 
-  vkDestroyShaderModule(device, ssaoShader, nullptr);
   vkDestroyShaderModule(device, blurShader, nullptr);
   
   engine->m_DeletionQueue.push_function([device, engine](){
+    ssaoVariants.destroy();
     vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
-    engine->destroy_image(outputAmbient);
-    vkDestroyPipeline(device, ssaoPipeline, nullptr);
     vkDestroyDescriptorSetLayout(device, descLayout, nullptr);
     vkDestroySampler(device, depthSampler, nullptr);
     vkDestroySampler(device, noiseSampler, nullptr);
-    engine->destroy_buffer(ssaoUniform);
     engine->destroy_image(noiseImage);
 
-    engine->destroy_image(outputBlurred);
     vkDestroyPipeline(device, blurPipeline, nullptr);
     vkDestroyPipelineLayout(device, blurPipelineLayout, nullptr);
     vkDestroyDescriptorSetLayout(device, blurDescLayout, nullptr);
@@ -448,7 +404,6 @@ void ssao::prepare()
 
 }
 
-// FIXME: NEED BARRIER OR SMTH CAUSE IF IT TAKES TOO LONG IT MESSES WITH FORWARD PASS
 void ssao::run(VkCommandBuffer cmd, VkImageView depth)
 {
   /*
@@ -458,19 +413,22 @@ void ssao::run(VkCommandBuffer cmd, VkImageView depth)
 
   
   Engine* engine = Engine::get();
-  VkExtent3D size = engine->internalExtent;
+  // only the drawn part, the outputs stay internal resolution sized and the geometry pass reads them per pixel
+  VkExtent2D size = engine->m_DrawExtent;
+
+  BufferSlice kernelUniform = engine->get_current_frame().frameUniforms.push(kernel);
 
   VkDescriptorSet set = engine->get_current_frame().frameDescriptors.allocate(engine->device, descLayout);
   {
     DescriptorWriter writer;
     writer.write_image(0, depth, depthSampler, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
     writer.write_image(1, outputAmbient.imageView, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
-    writer.write_buffer(2, ssaoUniform.buffer, sizeof(glm::vec3)*64, 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+    writer.write_buffer(2, kernelUniform.buffer, sizeof(u_ssao), kernelUniform.offset, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
     writer.write_image(3, noiseImage.imageView, noiseSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
     writer.update_set(engine->device, set);
   }
 
-  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, ssaoPipeline);
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, ssaoVariants.get(kernel_constants()));
   vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &set, 0, nullptr);
 
   float near = *CVarSystem::get()->get_float_cvar("camera.near");
@@ -482,6 +440,8 @@ void ssao::run(VkCommandBuffer cmd, VkImageView depth)
   ssao_pcs pcs{};
   pcs.kernelRadius = *CVarSystem::get()->get_float_cvar("ssao.kernel_radius");
   pcs.inv_viewproj = glm::inverse(Engine::get()->sceneData.viewproj);
+  pcs.extent = {size.width, size.height};
+  pcs.uvScale = {(float) size.width / engine->internalExtent.width, (float) size.height / engine->internalExtent.height};
   vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ssao_pcs), &pcs);
 
   vkCmdDispatch(cmd, std::ceil(size.width / 16.0), std::ceil(size.height / 16.0), 1);
@@ -515,30 +475,572 @@ void ssao::run(VkCommandBuffer cmd, VkImageView depth)
   }
   
   bilateral_filter_pcs blurpcs{};
+  blurpcs.extent = {size.width, size.height};
   vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, blurPipelineLayout, 0, 1, &set2, 0, nullptr);
   vkCmdPushConstants(cmd, blurPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(bilateral_filter_pcs), &blurpcs);
   
   vkCmdDispatch(cmd, std::ceil(size.width / 16.0), std::ceil(size.height / 16.0), 1);
-  
-  
+  // outputBlurred is handed to its readers by the render graph
+}
+
+void depth_pyramid::prepare()
+{
+  Engine* engine = Engine::get();
+  VkDevice device = engine->device;
+
+  // level 0 is half the internal resolution, every level halves rounding down down to 1x1
+  baseExtent = {std::max(engine->internalExtent.width / 2, 1u), std::max(engine->internalExtent.height / 2, 1u)};
+  levels = static_cast<uint32_t>(std::floor(std::log2(std::max(baseExtent.width, baseExtent.height)))) + 1;
+
+  // NOTE: not made with create_image, storage views have to be a single level so it cant go into the bindless storage array
+  VkFormat format = VK_FORMAT_R32_SFLOAT;
+  VkImageCreateInfo imgInfo = vkinit::image_create_info(format, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VkExtent3D{baseExtent.width, baseExtent.height, 1});
+  imgInfo.mipLevels = levels;
+
+  VmaAllocationCreateInfo allocInfo{};
+  allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+  allocInfo.requiredFlags = VkMemoryPropertyFlags{VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT};
+  VK_CHECK_RESULT(vmaCreateImage(engine->m_Allocator, &imgInfo, &allocInfo, &pyramid.image, &pyramid.allocation, nullptr));
+  pyramid.imageFormat = format;
+  pyramid.imageExtent = imgInfo.extent;
+
+  VkImageViewCreateInfo viewInfo = vkinit::imageview_create_info(format, pyramid.image, VK_IMAGE_ASPECT_COLOR_BIT);
+  viewInfo.subresourceRange.levelCount = levels;
+  VK_CHECK_RESULT(vkCreateImageView(device, &viewInfo, nullptr, &pyramid.imageView));
+  vklog::label_image(device, pyramid.image, "Depth Pyramid");
+
+  levelViews.resize(levels);
+  for (uint32_t i = 0; i < levels; i++)
+  {
+    viewInfo.subresourceRange.baseMipLevel = i;
+    viewInfo.subresourceRange.levelCount = 1;
+    VK_CHECK_RESULT(vkCreateImageView(device, &viewInfo, nullptr, &levelViews[i]));
+  }
+
+  debugImage = engine->create_image(VkExtent3D{baseExtent.width, baseExtent.height, 1}, format, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+  vklog::label_image(device, debugImage.image, "Depth Pyramid Debug Texture");
+
+  engine->immediate_submit([=](VkCommandBuffer cmd){
+    vkutil::transition_image(cmd, pyramid.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+    vkutil::transition_image(cmd, debugImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+  });
+
+  // only texelFetch is used, the sampler is there to make the descriptor valid
+  VkSamplerCreateInfo samplerInfo{.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO, .pNext = nullptr};
+  samplerInfo.magFilter = VK_FILTER_NEAREST;
+  samplerInfo.minFilter = VK_FILTER_NEAREST;
+  samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+  VK_CHECK_RESULT(vkCreateSampler(device, &samplerInfo, nullptr, &sampler));
+
+  {
+    DescriptorLayoutBuilder builder;
+    builder.add_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    builder.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+    descriptorLayout = builder.build(device, VK_SHADER_STAGE_COMPUTE_BIT);
+  }
+
+  VkPushConstantRange range{};
+  range.offset = 0;
+  range.size = sizeof(depth_pyramid_pcs);
+  range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+  VkPipelineLayoutCreateInfo layout = vkinit::pipeline_layout_create_info();
+  layout.pushConstantRangeCount = 1;
+  layout.pPushConstantRanges = &range;
+  layout.setLayoutCount = 1;
+  layout.pSetLayouts = &descriptorLayout;
+  VK_CHECK_RESULT(vkCreatePipelineLayout(device, &layout, nullptr, &pipelineLayout));
+
+  VkShaderModule shader;
+  LA_LOG_ASSERT(
+    vkutil::load_shader_module("shaders/culling/depth_pyramid.comp.spv", device, &shader),
+    "Error loading Depth Pyramid Compute Shader"
+  );
+
+  VkComputePipelineCreateInfo pipelineInfo{ .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO, .pNext = nullptr};
+  pipelineInfo.layout = pipelineLayout;
+  pipelineInfo.stage = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT, shader);
+  VK_CHECK_RESULT(vkCreateComputePipelines(device, engine->pipelineCache.handle(), 1, &pipelineInfo, nullptr, &pipeline));
+
+  vkDestroyShaderModule(device, shader, nullptr);
+
+  // the level views never change so those sets are written once instead of allocated every frame,
+  // the depth image is transient so level 0 gets a frame set in run
+  levelSets.resize(levels);
+  for (uint32_t i = 1; i < levels; i++)
+  {
+    levelSets[i] = engine->persistentDescriptors.allocate(device, descriptorLayout);
+
+    DescriptorWriter writer;
+    writer.write_image(0, levelViews[i - 1], sampler, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    writer.write_image(1, levelViews[i], VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+    writer.update_set(device, levelSets[i]);
+  }
+
+  debugSet = engine->persistentDescriptors.allocate(device, descriptorLayout);
+  {
+    DescriptorWriter writer;
+    writer.write_image(0, pyramid.imageView, sampler, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    writer.write_image(1, debugImage.imageView, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+    writer.update_set(device, debugSet);
+  }
+
+  engine->m_DeletionQueue.push_function([device, engine](){
+    for (VkImageView view : levelViews)
+    {
+      vkDestroyImageView(device, view, nullptr);
+    }
+    engine->destroy_image(pyramid);
+    engine->destroy_image(debugImage);
+    vkDestroySampler(device, sampler, nullptr);
+    vkDestroyPipeline(device, pipeline, nullptr);
+    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, descriptorLayout, nullptr);
+  });
+}
+
+void depth_pyramid::set_draw_extent(VkExtent2D drawExtent)
+{
+  // only the drawn part of the depth image is reduced, levels past its chain just end up 1x1
+  baseExtent = {std::max(drawExtent.width / 2, 1u), std::max(drawExtent.height / 2, 1u)};
+}
+
+VkExtent2D depth_pyramid::level_extent(uint32_t level)
+{
+  return {std::max(baseExtent.width >> level, 1u), std::max(baseExtent.height >> level, 1u)};
+}
+
+void depth_pyramid::run(VkCommandBuffer cmd, VkExtent2D drawExtent, VkImageView depth)
+{
+  Engine* engine = Engine::get();
+  levelSets[0] = engine->get_current_frame().frameDescriptors.allocate(engine->device, descriptorLayout);
+  {
+    DescriptorWriter writer;
+    writer.write_image(0, depth, sampler, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    writer.write_image(1, levelViews[0], VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+    writer.update_set(engine->device, levelSets[0]);
+  }
+
+  // the render graph orders this against last frames late cull, only the level to level barriers are here
   VkImageMemoryBarrier2 imgBarrier{ .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2, .pNext = nullptr};
-  imgBarrier.srcStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
-  imgBarrier.srcAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT;
-  imgBarrier.dstStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
-  imgBarrier.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT;
   imgBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
   imgBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
-  imgBarrier.image = outputBlurred.image;
-  imgBarrier.subresourceRange = vkinit::image_subresource_range(VK_IMAGE_ASPECT_COLOR_BIT);
-  
+  imgBarrier.image = pyramid.image;
+  imgBarrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+  imgBarrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+
   VkDependencyInfo depInfo{ .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO, .pNext = nullptr};
   depInfo.imageMemoryBarrierCount = 1;
   depInfo.pImageMemoryBarriers = &imgBarrier;
 
-  vkCmdPipelineBarrier2(cmd, &depInfo);
-  // FIXME: do i need a barrier here??
-  //
-  //
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+
+  depth_pyramid_pcs pcs{};
+  pcs.mode = DEPTH_PYRAMID_REDUCE;
+
+  for (uint32_t i = 0; i < levels; i++)
+  {
+    VkExtent2D src = i == 0 ? drawExtent : level_extent(i - 1);
+    VkExtent2D dst = level_extent(i);
+    pcs.src_size = {src.width, src.height};
+    pcs.dst_size = {dst.width, dst.height};
+
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &levelSets[i], 0, nullptr);
+    vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(depth_pyramid_pcs), &pcs);
+    vkCmdDispatch(cmd, std::ceil(dst.width / 16.0), std::ceil(dst.height / 16.0), 1);
+
+    // the next level (or the debug view after the last one) reads this one, the late cull is ordered by the render graph
+    if (i + 1 == levels && pyramidShowDebug.get() == false)
+      break;
+
+    imgBarrier.srcAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT;
+    imgBarrier.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT;
+    imgBarrier.subresourceRange = vkinit::image_subresource_range(VK_IMAGE_ASPECT_COLOR_BIT);
+    imgBarrier.subresourceRange.baseMipLevel = i;
+    imgBarrier.subresourceRange.levelCount = 1;
+    vkCmdPipelineBarrier2(cmd, &depInfo);
+  }
+
+  if (pyramidShowDebug.get() == false) return;
+
+  pcs.mode = DEPTH_PYRAMID_DEBUG;
+  pcs.level = std::clamp<int32_t>(pyramidDebugLevel.get(), 0, levels - 1);
+  VkExtent2D src = level_extent(pcs.level);
+  pcs.src_size = {src.width, src.height};
+  pcs.dst_size = {baseExtent.width, baseExtent.height};
+
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &debugSet, 0, nullptr);
+  vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(depth_pyramid_pcs), &pcs);
+  vkCmdDispatch(cmd, std::ceil(baseExtent.width / 16.0), std::ceil(baseExtent.height / 16.0), 1);
+}
+
+bool upscale::enabled()
+{
+  return upscaleEnabled.get();
+}
+
+void upscale::prepare()
+{
+  Engine* engine = Engine::get();
+  VkDevice device = engine->device;
+
+  {
+    DescriptorLayoutBuilder builder;
+    builder.add_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    builder.add_binding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+    descriptorLayout = builder.build(device, VK_SHADER_STAGE_COMPUTE_BIT);
+  }
+
+  VkPushConstantRange range{};
+  range.offset = 0;
+  range.size = sizeof(upscale_pcs);
+  range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+  VkPipelineLayoutCreateInfo layout = vkinit::pipeline_layout_create_info();
+  layout.pushConstantRangeCount = 1;
+  layout.pPushConstantRanges = &range;
+  layout.setLayoutCount = 1;
+  layout.pSetLayouts = &descriptorLayout;
+  VK_CHECK_RESULT(vkCreatePipelineLayout(device, &layout, nullptr, &pipelineLayout));
+
+  VkShaderModule shader;
+  LA_LOG_ASSERT(
+    vkutil::load_shader_module("shaders/upscale/upscale.comp.spv", device, &shader),
+    "Error loading Upscale Compute Shader"
+  );
+
+  VkComputePipelineCreateInfo pipelineInfo{ .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO, .pNext = nullptr};
+  pipelineInfo.layout = pipelineLayout;
+  pipelineInfo.stage = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT, shader);
+  VK_CHECK_RESULT(vkCreateComputePipelines(device, engine->pipelineCache.handle(), 1, &pipelineInfo, nullptr, &pipeline));
+
+  vkDestroyShaderModule(device, shader, nullptr);
+
+  engine->m_DeletionQueue.push_function([device](){
+    vkDestroyPipeline(device, pipeline, nullptr);
+    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, descriptorLayout, nullptr);
+  });
+}
+
+void upscale::run(VkCommandBuffer cmd, VkImageView src, VkExtent2D srcExtent, VkImageView dst, VkExtent2D dstExtent)
+{
+  // the shared tile of a group only has room for the texels of an upscale
+  LA_LOG_ASSERT(dstExtent.width >= srcExtent.width && dstExtent.height >= srcExtent.height, "Upscale output is smaller than its source");
+
+  Engine* engine = Engine::get();
+  VkDescriptorSet set = engine->get_current_frame().frameDescriptors.allocate(engine->device, descriptorLayout);
+  {
+    DescriptorWriter writer;
+    writer.write_image(0, src, engine->m_DefaultSamplerNearest, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    writer.write_image(1, dst, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+    writer.update_set(engine->device, set);
+  }
+
+  upscale_pcs pcs{};
+  pcs.srcExtent = {srcExtent.width, srcExtent.height};
+  pcs.dstExtent = {dstExtent.width, dstExtent.height};
+  pcs.sharpness = std::clamp(upscaleSharpness.get(), 0.0f, 1.0f);
+
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &set, 0, nullptr);
+  vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(upscale_pcs), &pcs);
+  vkCmdDispatch(cmd, std::ceil(dstExtent.width / 16.0), std::ceil(dstExtent.height / 16.0), 1);
+}
+
+bool shadow_mask::enabled()
+{
+  return shadowScreenMask.get();
+}
+
+VkExtent3D shadow_mask::extent()
+{
+  VkExtent3D internal = Engine::get()->internalExtent;
+  return {(internal.width + 1) / 2, (internal.height + 1) / 2, 1};
+}
+
+void shadow_mask::prepare()
+{
+  Engine* engine = Engine::get();
+  VkDevice device = engine->device;
+
+  {
+    DescriptorLayoutBuilder builder;
+    builder.add_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    builder.add_binding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    builder.add_binding(2, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+    builder.add_binding(3, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+    descriptorLayout = builder.build(device, VK_SHADER_STAGE_COMPUTE_BIT);
+  }
+
+  VkPushConstantRange range{};
+  range.offset = 0;
+  range.size = sizeof(shadow_mask_pcs);
+  range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+  VkPipelineLayoutCreateInfo layout = vkinit::pipeline_layout_create_info();
+  layout.pushConstantRangeCount = 1;
+  layout.pPushConstantRanges = &range;
+  layout.setLayoutCount = 1;
+  layout.pSetLayouts = &descriptorLayout;
+  VK_CHECK_RESULT(vkCreatePipelineLayout(device, &layout, nullptr, &pipelineLayout));
+
+  VkShaderModule shader;
+  LA_LOG_ASSERT(
+    vkutil::load_shader_module("shaders/shadow/shadow_mask.comp.spv", device, &shader),
+    "Error loading Shadow Mask Compute Shader"
+  );
+
+  variants.init(device, "shadow mask", {0, 1}, {shader}, [device, engine, shader](const VkSpecializationInfo& spec) {
+    VkComputePipelineCreateInfo info{.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO, .pNext = nullptr};
+    info.layout = pipelineLayout;
+    info.stage = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT, shader);
+    info.stage.pSpecializationInfo = &spec;
+
+    VkPipeline pipeline;
+    VK_CHECK_RESULT(vkCreateComputePipelines(device, engine->pipelineCache.handle(), 1, &info, nullptr, &pipeline));
+    return pipeline;
+  });
+  variants.get(engine->pcf_constants());
+
+  // only texelFetch is used, the sampler is there to make the descriptor valid
+  VkSamplerCreateInfo samplerInfo{.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO, .pNext = nullptr};
+  samplerInfo.magFilter = VK_FILTER_NEAREST;
+  samplerInfo.minFilter = VK_FILTER_NEAREST;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  VK_CHECK_RESULT(vkCreateSampler(device, &samplerInfo, nullptr, &depthSampler));
+
+  engine->m_DeletionQueue.push_function([device](){
+    variants.destroy();
+    vkDestroySampler(device, depthSampler, nullptr);
+    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, descriptorLayout, nullptr);
+  });
+}
+
+void shadow_mask::run(VkCommandBuffer cmd, VkImageView depth)
+{
+  Engine* engine = Engine::get();
+  VkExtent2D drawn = engine->m_DrawExtent;
+  VkExtent2D size = {(drawn.width + 1) / 2, (drawn.height + 1) / 2};
+
+  ShadowFragmentSettings settings = engine->shadow_fragment_settings();
+  BufferSlice settingsUniform = engine->get_current_frame().frameUniforms.push(settings);
+
+  VkDescriptorSet set = engine->get_current_frame().frameDescriptors.allocate(engine->device, descriptorLayout);
+  {
+    DescriptorWriter writer;
+    writer.write_image(0, depth, depthSampler, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    writer.write_image(1, engine->m_ShadowDepthImage.imageView, engine->m_ShadowSampler, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    writer.write_buffer(2, settingsUniform.buffer, sizeof(ShadowFragmentSettings), settingsUniform.offset, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+    writer.write_image(3, output.imageView, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+    writer.update_set(engine->device, set);
+  }
+
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, variants.get(engine->pcf_constants()));
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &set, 0, nullptr);
+
+  const glm::mat4& view = engine->sceneData.view;
+  shadow_mask_pcs pcs{};
+  pcs.inv_viewproj = glm::inverse(engine->sceneData.viewproj);
+  pcs.viewDepth = -glm::vec4(view[0][2], view[1][2], view[2][2], view[3][2]);
+  pcs.depthExtent = {drawn.width, drawn.height};
+  pcs.maskExtent = {size.width, size.height};
+  vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(shadow_mask_pcs), &pcs);
+
+  vkCmdDispatch(cmd, std::ceil(size.width / 8.0), std::ceil(size.height / 8.0), 1);
+  // output is handed to the geometry pass by the render graph
+}
+
+ClusterGrid light_clusters::grid(uint32_t lightCount)
+{
+  Engine* engine = Engine::get();
+  VkExtent2D drawn = engine->m_DrawExtent;
+
+  ClusterGrid grid{};
+  grid.tilesX = (drawn.width + CLUSTER_TILE_SIZE - 1) / CLUSTER_TILE_SIZE;
+  grid.tilesY = (drawn.height + CLUSTER_TILE_SIZE - 1) / CLUSTER_TILE_SIZE;
+  grid.lightCount = lightCount;
+  grid.heatmap = lightsShowClusters.get();
+  grid.near = *CVarSystem::get()->get_float_cvar("camera.near");
+  grid.far = glm::clamp(lightsClusterFar.get(), grid.near * 2.0f, *CVarSystem::get()->get_float_cvar("camera.far"));
+  grid.sliceScale = CLUSTER_SLICES / std::log(grid.far / grid.near);
+  grid.sliceBias = -grid.sliceScale * std::log(grid.near);
+  return grid;
+}
+
+void light_clusters::prepare()
+{
+  Engine* engine = Engine::get();
+  VkDevice device = engine->device;
+
+  {
+    DescriptorLayoutBuilder builder;
+    builder.add_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    builder.add_binding(1, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+    builder.add_binding(2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    builder.add_binding(3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    descriptorLayout = builder.build(device, VK_SHADER_STAGE_COMPUTE_BIT);
+  }
+
+  VkPushConstantRange range{};
+  range.offset = 0;
+  range.size = sizeof(light_cull_pcs);
+  range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+  VkPipelineLayoutCreateInfo layout = vkinit::pipeline_layout_create_info();
+  layout.pushConstantRangeCount = 1;
+  layout.pPushConstantRanges = &range;
+  layout.setLayoutCount = 1;
+  layout.pSetLayouts = &descriptorLayout;
+  VK_CHECK_RESULT(vkCreatePipelineLayout(device, &layout, nullptr, &pipelineLayout));
+
+  VkShaderModule shader;
+  LA_LOG_ASSERT(
+    vkutil::load_shader_module("shaders/lighting/light_cull.comp.spv", device, &shader),
+    "Error loading Light Culling Compute Shader"
+  );
+
+  VkComputePipelineCreateInfo info{.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO, .pNext = nullptr};
+  info.layout = pipelineLayout;
+  info.stage = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT, shader);
+  VK_CHECK_RESULT(vkCreateComputePipelines(device, engine->pipelineCache.handle(), 1, &info, nullptr, &pipeline));
+  vkDestroyShaderModule(device, shader, nullptr);
+
+  // the render scale only shrinks the grid, the internal extent has the most tiles
+  VkExtent3D internal = engine->internalExtent;
+  uint64_t clusters = (uint64_t) ((internal.width + CLUSTER_TILE_SIZE - 1) / CLUSTER_TILE_SIZE)
+    * ((internal.height + CLUSTER_TILE_SIZE - 1) / CLUSTER_TILE_SIZE) * CLUSTER_SLICES;
+  clusterBufferSize = clusters * (MAX_LIGHTS_PER_CLUSTER + 1) * sizeof(uint32_t);
+  clusterBuffer = engine->create_buffer(clusterBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+  vklog::label_buffer(device, clusterBuffer.buffer, "Light Clusters");
+
+  // only texelFetch is used, the sampler is there to make the descriptor valid
+  VkSamplerCreateInfo samplerInfo{.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO, .pNext = nullptr};
+  samplerInfo.magFilter = VK_FILTER_NEAREST;
+  samplerInfo.minFilter = VK_FILTER_NEAREST;
+  samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+  VK_CHECK_RESULT(vkCreateSampler(device, &samplerInfo, nullptr, &depthSampler));
+
+  engine->m_DeletionQueue.push_function([device, engine](){
+    engine->destroy_buffer(clusterBuffer);
+    vkDestroySampler(device, depthSampler, nullptr);
+    vkDestroyPipeline(device, pipeline, nullptr);
+    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, descriptorLayout, nullptr);
+  });
+}
+
+void light_clusters::run(VkCommandBuffer cmd, VkImageView depth, VkBuffer lights, uint32_t lightCount)
+{
+  Engine* engine = Engine::get();
+  VkExtent2D drawn = engine->m_DrawExtent;
+
+  ClusterGrid clusterGrid = grid(lightCount);
+  BufferSlice gridUniform = engine->get_current_frame().frameUniforms.push(clusterGrid);
+
+  VkDescriptorSet set = engine->get_current_frame().frameDescriptors.allocate(engine->device, descriptorLayout);
+  {
+    DescriptorWriter writer;
+    writer.write_image(0, depth, depthSampler, VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    writer.write_buffer(1, gridUniform.buffer, sizeof(ClusterGrid), gridUniform.offset, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+    writer.write_buffer(2, lights, lightCount * sizeof(GPULight), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    writer.write_buffer(3, clusterBuffer.buffer, clusterBufferSize, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    writer.update_set(engine->device, set);
+  }
+
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &set, 0, nullptr);
+
+  const glm::mat4& proj = engine->sceneData.proj;
+  light_cull_pcs pcs{};
+  pcs.view = engine->sceneData.view;
+  pcs.projParams = {1.0f / proj[0][0], 1.0f / proj[1][1], proj[2][2], proj[3][2]};
+  pcs.depthExtent = {drawn.width, drawn.height};
+  pcs.binFromNear = engine->transparent_set.draw_datas.size() != 0;
+  vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(light_cull_pcs), &pcs);
+
+  // a group per tile
+  vkCmdDispatch(cmd, clusterGrid.tilesX, clusterGrid.tilesY, 1);
+  // clusterBuffer is handed to the geometry pass by the render graph
+}
+
+bool weighted_oit::enabled()
+{
+  return weightedOit.get();
+}
+
+void weighted_oit::prepare()
+{
+  Engine* engine = Engine::get();
+  VkDevice device = engine->device;
+
+  {
+    DescriptorLayoutBuilder builder;
+    builder.add_binding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    builder.add_binding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    builder.add_binding(2, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+    descriptorLayout = builder.build(device, VK_SHADER_STAGE_COMPUTE_BIT);
+  }
+
+  VkPushConstantRange range{};
+  range.offset = 0;
+  range.size = sizeof(oit_composite_pcs);
+  range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+  VkPipelineLayoutCreateInfo layout = vkinit::pipeline_layout_create_info();
+  layout.pushConstantRangeCount = 1;
+  layout.pPushConstantRanges = &range;
+  layout.setLayoutCount = 1;
+  layout.pSetLayouts = &descriptorLayout;
+  VK_CHECK_RESULT(vkCreatePipelineLayout(device, &layout, nullptr, &pipelineLayout));
+
+  VkShaderModule shader;
+  LA_LOG_ASSERT(
+    vkutil::load_shader_module("shaders/oit/oit_composite.comp.spv", device, &shader),
+    "Error loading OIT Composite Compute Shader"
+  );
+
+  VkComputePipelineCreateInfo pipelineInfo{ .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO, .pNext = nullptr};
+  pipelineInfo.layout = pipelineLayout;
+  pipelineInfo.stage = vkinit::pipeline_shader_stage_create_info(VK_SHADER_STAGE_COMPUTE_BIT, shader);
+  VK_CHECK_RESULT(vkCreateComputePipelines(device, engine->pipelineCache.handle(), 1, &pipelineInfo, nullptr, &pipeline));
+
+  vkDestroyShaderModule(device, shader, nullptr);
+
+  engine->m_DeletionQueue.push_function([device](){
+    vkDestroyPipeline(device, pipeline, nullptr);
+    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(device, descriptorLayout, nullptr);
+  });
+}
+
+void weighted_oit::composite(VkCommandBuffer cmd, VkImageView target)
+{
+  Engine* engine = Engine::get();
+  VkExtent2D drawn = engine->m_DrawExtent;
+
+  VkDescriptorSet set = engine->get_current_frame().frameDescriptors.allocate(engine->device, descriptorLayout);
+  {
+    DescriptorWriter writer;
+    writer.write_image(0, accumulation.imageView, engine->m_DefaultSamplerNearest, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    writer.write_image(1, revealage.imageView, engine->m_DefaultSamplerNearest, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    writer.write_image(2, target, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+    writer.update_set(engine->device, set);
+  }
+
+  oit_composite_pcs pcs{};
+  pcs.extent = {drawn.width, drawn.height};
+
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &set, 0, nullptr);
+  vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(oit_composite_pcs), &pcs);
+  vkCmdDispatch(cmd, std::ceil(drawn.width / 8.0), std::ceil(drawn.height / 8.0), 1);
 }
 
 } // namespace Lucerna
@@ -1,5 +1,8 @@
 #pragma once
 #include "vk_types.h"
+#include "vk_pipelines.h"
+
+#include <span>
 
 namespace Lucerna {
 
@@ -10,17 +13,15 @@ namespace Lucerna {
   {
     public:
       static void prepare();
-      static void run(VkCommandBuffer cmd, VkImageView targetImage);
-    public:
-      struct BloomPushConstants
-      {
-        glm::vec2 srcResolution;
-        float filterRadius;
-        int finalPass{0};
-      };
+      // mips are transient, placed by the render graph. only the part under the draw extent is touched
+      static void run(VkCommandBuffer cmd, VkImageView targetImage, std::span<const AllocatedImage> mips);
+      static VkExtent3D mip_extent(uint32_t mip);
+      // bloom.mips clamped to mipCount, read once per frame when the graph is built
+      static uint32_t mip_count();
     public:
+      static constexpr uint32_t mipCount = 6; // the most mips bloom.mips can ask for
+      static constexpr VkFormat mipFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
     private:
-      static inline std::vector<AllocatedImage> blurredMips{};
       static inline VkPipelineLayout pipelineLayout{};
       static inline VkPipeline upsamplePipeline{};
       static inline VkPipeline downsamplePipeline{};
@@ -34,13 +35,17 @@ namespace Lucerna {
     public:
       static void prepare();
       static void run(VkCommandBuffer cmd, VkImageView depth);
+      // specialization constants of the ssao pipeline for the current cvars
+      static std::vector<uint32_t> kernel_constants();
     public:
-      static inline AllocatedImage outputAmbient;
-      static inline AllocatedImage outputBlurred;
+      // transient, set to what the render graph placed them as for the current frame
+      static inline AllocatedImage outputAmbient{};
+      static inline AllocatedImage outputBlurred{};
+      static constexpr VkFormat outputFormat = VK_FORMAT_R8_UNORM;
     private:
     private:
       static inline VkPipelineLayout pipelineLayout{};
-      static inline VkPipeline ssaoPipeline{};
+      static inline PipelineVariants ssaoVariants{}; // KERNEL_SIZE from ssao.kernel_size
       static inline VkDescriptorSetLayout descLayout{};
       static inline VkSampler depthSampler{};
       static inline VkSampler noiseSampler{};
@@ -49,7 +54,116 @@ namespace Lucerna {
       static inline VkPipeline blurPipeline{};
       static inline VkDescriptorSetLayout blurDescLayout{};
       
-      static inline AllocatedBuffer ssaoUniform{};
+      static inline u_ssao kernel{}; // pushed into the frame uniforms every run
       static inline AllocatedImage noiseImage{}; // NOTE: could be part of engine as might be reused a lot!
   };
+
+  // min depth mip chain of the depth prepass for hi-z occlusion culling, kept in GENERAL
+  class depth_pyramid
+  {
+    public:
+      static void prepare();
+      // depth has to be in DEPTH_READ_ONLY_OPTIMAL, only the drawExtent part of it is reduced
+      static void run(VkCommandBuffer cmd, VkExtent2D drawExtent, VkImageView depth);
+      // before the frame is recorded, the cull passes read the level extents while run records
+      static void set_draw_extent(VkExtent2D drawExtent);
+      static VkExtent2D level_extent(uint32_t level);
+    public:
+      static inline AllocatedImage pyramid{}; // not bindless, the storage views have to be single level
+      static inline AllocatedImage debugImage{};
+      static inline VkSampler sampler{};
+      static inline uint32_t levels{ 0 };
+      static inline VkExtent2D baseExtent{}; // level 0 for the last drawExtent
+    private:
+      static inline std::vector<VkImageView> levelViews{};
+      static inline std::vector<VkDescriptorSet> levelSets{}; // reads level - 1, writes level. level 0 reads the depth image and is written every run
+      static inline VkDescriptorSet debugSet{};
+      static inline VkPipelineLayout pipelineLayout{};
+      static inline VkPipeline pipeline{};
+      static inline VkDescriptorSetLayout descriptorLayout{};
+  };
+
+  // sun shadows of the depth prepass resolved at half resolution, the opaque geometry pass samples the lit fraction
+  // instead of filtering the cascades per fragment
+  class shadow_mask
+  {
+    public:
+      static void prepare();
+      // depth is the depth prepass in DEPTH_READ_ONLY_OPTIMAL, the cascades have to be rendered
+      static void run(VkCommandBuffer cmd, VkImageView depth);
+      // shadow_mapping.screen_mask, read once per frame when the graph is built
+      static bool enabled();
+      // of the whole draw image, only the half of the draw extent is written
+      static VkExtent3D extent();
+    public:
+      // transient, set to what the render graph placed it as for the current frame
+      static inline AllocatedImage output{};
+      static constexpr VkFormat outputFormat = VK_FORMAT_R8_UNORM;
+    private:
+      static inline VkPipelineLayout pipelineLayout{};
+      static inline PipelineVariants variants{}; // PCF_TAPS, PCF_EARLY_TAPS like the mesh pipelines
+      static inline VkDescriptorSetLayout descriptorLayout{};
+      static inline VkSampler depthSampler{};
+  };
+
+  // punctual lights binned into a view space froxel grid, CLUSTER_TILE_SIZE tiles of the draw extent times
+  // CLUSTER_SLICES exponential depth slices. the forward shader only loops over the lights of its cluster
+  class light_clusters
+  {
+    public:
+      static void prepare();
+      // depth is the depth prepass in DEPTH_READ_ONLY_OPTIMAL, lights holds lightCount GPULights
+      static void run(VkCommandBuffer cmd, VkImageView depth, VkBuffer lights, uint32_t lightCount);
+      // tiles of the current draw extent and the slices of the current camera, heatmap from lights.show_clusters
+      static ClusterGrid grid(uint32_t lightCount);
+    public:
+      // per cluster a count followed by MAX_LIGHTS_PER_CLUSTER light indices, sized for the internal extent
+      static inline AllocatedBuffer clusterBuffer{};
+      static inline VkDeviceSize clusterBufferSize{ 0 };
+    private:
+      static inline VkPipelineLayout pipelineLayout{};
+      static inline VkPipeline pipeline{};
+      static inline VkDescriptorSetLayout descriptorLayout{};
+      static inline VkSampler depthSampler{};
+  };
+
+  // weighted blended order independent transparency. transparent_set is drawn unsorted into the accumulation and
+  // revealage targets, the composite blends their weighted average over the draw image
+  class weighted_oit
+  {
+    public:
+      static void prepare();
+      // accumulation and revealage are sampled in GENERAL, target is the draw image as a storage image
+      static void composite(VkCommandBuffer cmd, VkImageView target);
+      // transparency.weighted_oit, off draws transparent_set straight into the draw image. read once per frame
+      static bool enabled();
+    public:
+      // transient, set to what the render graph placed them as for the current frame
+      static inline AllocatedImage accumulation{};
+      static inline AllocatedImage revealage{};
+      static constexpr VkFormat accumulationFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
+      static constexpr VkFormat revealageFormat = VK_FORMAT_R16_SFLOAT;
+    private:
+      static inline VkPipelineLayout pipelineLayout{};
+      static inline VkPipeline pipeline{};
+      static inline VkDescriptorSetLayout descriptorLayout{};
+  };
+
+  // edge adaptive upscale plus contrast adaptive sharpening from the drawn part of the draw image to the output image,
+  // one dispatch. only upscales, the output extent is never smaller than the source
+  class upscale
+  {
+    public:
+      static void prepare();
+      // src is sampled in GENERAL, dst is a storage image
+      static void run(VkCommandBuffer cmd, VkImageView src, VkExtent2D srcExtent, VkImageView dst, VkExtent2D dstExtent);
+      // upscale.enabled, read once per frame when the graph is built
+      static bool enabled();
+    public:
+      static constexpr VkFormat outputFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
+    private:
+      static inline VkPipelineLayout pipelineLayout{};
+      static inline VkPipeline pipeline{};
+      static inline VkDescriptorSetLayout descriptorLayout{};
+  };
 } // namespace Lucerna
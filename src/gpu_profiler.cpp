@@ -0,0 +1,325 @@
+#include "gpu_profiler.h"
+#include "engine.h"
+#include "la_asserts.h"
+#include "logger.h"
+
+#include <imgui.h>
+#include <fstream>
+
+namespace Lucerna {
+
+AutoCVar_Int profilerEnabled("profiler.enabled", "record per pass gpu timestamps", 1, CVarFlags::EditCheckbox);
+
+void GpuProfiler::init(Engine* engine)
+{
+  device = engine->device;
+
+  VkPhysicalDeviceProperties properties{};
+  vkGetPhysicalDeviceProperties(engine->physicalDevice, &properties);
+  timestampPeriod = properties.limits.timestampPeriod;
+
+  uint32_t familyCount = 0;
+  vkGetPhysicalDeviceQueueFamilyProperties(engine->physicalDevice, &familyCount, nullptr);
+  std::vector<VkQueueFamilyProperties> families(familyCount);
+  vkGetPhysicalDeviceQueueFamilyProperties(engine->physicalDevice, &familyCount, families.data());
+
+  supported = families[engine->graphicsIndex].timestampValidBits != 0 && timestampPeriod > 0.0f;
+  if (!supported)
+  {
+    LA_LOG_WARN("Graphics queue does not support timestamps, gpu profiler disabled");
+    return;
+  }
+
+  VkQueryPoolCreateInfo info{.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO, .pNext = nullptr};
+  info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  info.queryCount = MAX_QUERIES;
+
+  frames.resize(engine->framesInFlight);
+  for (FrameQueries& f : frames)
+  {
+    VK_CHECK_RESULT(vkCreateQueryPool(device, &info, nullptr, &f.pool));
+    f.scopes.reserve(MAX_QUERIES / 2);
+  }
+}
+
+void GpuProfiler::cleanup(Engine* engine)
+{
+  for (FrameQueries& f : frames)
+  {
+    vkDestroyQueryPool(engine->device, f.pool, nullptr);
+  }
+  frames.clear();
+  current = nullptr;
+}
+
+void GpuProfiler::begin_frame(VkCommandBuffer cmd, uint32_t frame_slot, uint64_t frame_number)
+{
+  current = nullptr;
+  if (!supported || profilerEnabled.get() == false)
+    return;
+
+  FrameQueries& f = frames[frame_slot];
+
+  // the caller already waited on the frame timeline for this slot so this never blocks
+  if (f.pending)
+  {
+    resolve(frame_slot);
+  }
+
+  f.scopes.clear();
+  open.clear();
+  frameThread = std::this_thread::get_id();
+  f.queryCount = 0;
+  f.openScopes = 0;
+  f.frameNumber = frame_number;
+  f.pending = false;
+  current = &f;
+
+  vkCmdResetQueryPool(cmd, f.pool, 0, MAX_QUERIES);
+  begin_scope(cmd, "Frame", MARKER_BLUE);
+}
+
+void GpuProfiler::end_frame(VkCommandBuffer cmd)
+{
+  if (current == nullptr)
+    return;
+
+  end_scope(cmd);
+  LA_LOG_ASSERT(open.empty(), "GpuProfiler has {} unclosed scopes", open.size());
+
+  current->pending = true;
+  current = nullptr;
+}
+
+void GpuProfiler::begin_scope(VkCommandBuffer cmd, const char* name, glm::vec4 colour)
+{
+  vklog::start_debug_label(cmd, name, colour);
+
+  if (current == nullptr)
+    return;
+
+  std::lock_guard<std::mutex> lock(mutex);
+
+  // out of queries, keep the stack balanced but dont time this scope
+  if (current->queryCount + current->openScopes + 2 > MAX_QUERIES)
+  {
+    open.push_back(UINT32_MAX);
+    return;
+  }
+
+  // other threads record passes of the frame, they sit under its scope
+  uint32_t depth = open.size() + (std::this_thread::get_id() == frameThread ? 0 : 1);
+  uint32_t query = current->queryCount++;
+  current->openScopes++;
+  open.push_back(current->scopes.size());
+  current->scopes.push_back({
+    .name = name,
+    .depth = depth,
+    .beginQuery = query,
+  });
+
+  vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, current->pool, query);
+}
+
+void GpuProfiler::end_scope(VkCommandBuffer cmd)
+{
+  if (current != nullptr && !open.empty())
+  {
+    uint32_t idx = open.back();
+    open.pop_back();
+
+    if (idx != UINT32_MAX)
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      Scope& scope = current->scopes[idx];
+      scope.endQuery = current->queryCount++;
+      current->openScopes--;
+      vkCmdWriteTimestamp2(cmd, VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT, current->pool, scope.endQuery);
+    }
+  }
+
+  vklog::end_debug_label(cmd);
+}
+
+bool GpuProfiler::resolve(uint32_t frame_slot)
+{
+  if (!supported || frame_slot >= frames.size())
+    return false;
+
+  FrameQueries& f = frames[frame_slot];
+  if (!f.pending || f.queryCount == 0)
+    return false;
+
+  // value + availability pairs
+  std::array<uint64_t, MAX_QUERIES * 2> results{};
+  vkGetQueryPoolResults(
+    device,
+    f.pool,
+    0,
+    f.queryCount,
+    sizeof(uint64_t) * 2 * f.queryCount,
+    results.data(),
+    sizeof(uint64_t) * 2,
+    VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT
+  );
+
+  auto available = [&](uint32_t q) { return results[q * 2 + 1] != 0; };
+  auto timestamp = [&](uint32_t q) { return results[q * 2]; };
+
+  for (uint32_t q = 0; q < f.queryCount; q++)
+  {
+    if (!available(q))
+      return false;
+  }
+
+  const float toMs = timestampPeriod / 1000000.0f;
+  uint64_t origin = timestamp(f.scopes.front().beginQuery);
+
+  FrameTimings timings{.frame = f.frameNumber};
+  timings.passes.reserve(f.scopes.size());
+  for (const Scope& s : f.scopes)
+  {
+    if (s.endQuery == UINT32_MAX)
+      continue;
+
+    uint64_t begin = timestamp(s.beginQuery);
+    uint64_t end = timestamp(s.endQuery);
+    timings.passes.push_back({
+      .name = s.name,
+      .depth = s.depth,
+      .start_ms = (begin - origin) * toMs,
+      .duration_ms = end > begin ? (end - begin) * toMs : 0.0f,
+    });
+  }
+
+  // threads record in any order, the gpu order is what the panel shows. parents start no later than their children
+  std::stable_sort(timings.passes.begin(), timings.passes.end(), [](const PassTiming& a, const PassTiming& b) {
+    return a.start_ms < b.start_ms || (a.start_ms == b.start_ms && a.depth < b.depth);
+  });
+
+  f.pending = false;
+
+  lastFrame = timings;
+  history.push_back(std::move(timings));
+  if (history.size() > historySize) history.pop_front();
+
+  return true;
+}
+
+float GpuProfiler::last_frame_ms()
+{
+  return lastFrame.passes.empty() ? 0.0f : lastFrame.passes.front().duration_ms;
+}
+
+void GpuProfiler::render_panel()
+{
+  ImGui::Begin("GPU Profiler");
+
+  if (!supported)
+  {
+    ImGui::Text("timestamps not supported on this queue");
+    ImGui::End();
+    return;
+  }
+
+  if (ImGui::Button("Export CSV"))
+  {
+    write_csv("gpu_profile.csv");
+  }
+  ImGui::SameLine();
+  ImGui::Text("frame %llu", (unsigned long long) lastFrame.frame);
+
+  if (lastFrame.passes.empty())
+  {
+    ImGui::End();
+    return;
+  }
+
+  // average over the history so the numbers are readable
+  std::map<std::string, std::pair<float, uint32_t>> averages;
+  for (const FrameTimings& f : history)
+  {
+    for (const PassTiming& p : f.passes)
+    {
+      auto& [sum, count] = averages[p.name];
+      sum += p.duration_ms;
+      count++;
+    }
+  }
+
+  const float frameMs = glm::max(last_frame_ms(), 0.001f);
+  const float rowHeight = ImGui::GetTextLineHeightWithSpacing();
+  const float width = ImGui::GetContentRegionAvail().x;
+
+  ImVec2 origin = ImGui::GetCursorScreenPos();
+  ImDrawList* list = ImGui::GetWindowDrawList();
+
+  uint32_t maxDepth = 0;
+  for (const PassTiming& p : lastFrame.passes)
+  {
+    maxDepth = glm::max(maxDepth, p.depth);
+
+    float x0 = origin.x + width * (p.start_ms / frameMs);
+    float x1 = origin.x + width * ((p.start_ms + p.duration_ms) / frameMs);
+    float y0 = origin.y + p.depth * rowHeight;
+    x1 = glm::max(x1, x0 + 1.0f);
+
+    ImU32 colour = ImGui::GetColorU32(ImVec4{0.2f + 0.15f * p.depth, 0.45f, 0.75f - 0.15f * p.depth, 1.0f});
+    list->AddRectFilled({x0, y0}, {x1, y0 + rowHeight - 2.0f}, colour);
+    list->PushClipRect({x0, y0}, {x1, y0 + rowHeight}, true);
+    list->AddText({x0 + 2.0f, y0}, IM_COL32(255, 255, 255, 255), p.name.c_str());
+    list->PopClipRect();
+  }
+  ImGui::Dummy({width, (maxDepth + 1) * rowHeight});
+
+  ImGui::Separator();
+
+  if (ImGui::BeginTable("passes", 3, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingStretchProp))
+  {
+    ImGui::TableSetupColumn("pass");
+    ImGui::TableSetupColumn("ms");
+    ImGui::TableSetupColumn("avg ms");
+    ImGui::TableHeadersRow();
+
+    for (const PassTiming& p : lastFrame.passes)
+    {
+      auto [sum, count] = averages[p.name];
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      ImGui::Indent(p.depth * 10.0f + 0.001f);
+      ImGui::TextUnformatted(p.name.c_str());
+      ImGui::Unindent(p.depth * 10.0f + 0.001f);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.3f", p.duration_ms);
+      ImGui::TableNextColumn();
+      ImGui::Text("%.3f", sum / count);
+    }
+    ImGui::EndTable();
+  }
+
+  ImGui::End();
+}
+
+bool GpuProfiler::write_csv(std::string_view path)
+{
+  std::ofstream file{std::string(path)};
+  if (!file.is_open())
+  {
+    LA_LOG_ERROR("Failed to open gpu profile {}", path);
+    return false;
+  }
+
+  file << "frame,pass,depth,start_ms,duration_ms\n";
+  for (const FrameTimings& f : history)
+  {
+    for (const PassTiming& p : f.passes)
+    {
+      file << std::format("{},{},{},{:.4f},{:.4f}\n", f.frame, p.name, p.depth, p.start_ms, p.duration_ms);
+    }
+  }
+
+  LA_LOG_INFO("Wrote gpu profile ({} frames) to {}", history.size(), path);
+  return true;
+}
+
+} // namespace Lucerna
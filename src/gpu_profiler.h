@@ -0,0 +1,81 @@
+#pragma once
+#include "lucerna_pch.h"
+#include <volk.h>
+
+#include <mutex>
+#include <thread>
+
+namespace Lucerna {
+
+  class Engine;
+
+  // timestamp based per pass profiler, one query pool per frame in flight.
+  // scopes also open a debug label so renderdoc/nsight captures line up with the timings.
+  // scopes can be opened from several recording threads at once, each thread nests its own
+  class GpuProfiler
+  {
+    public:
+      static void init(Engine* engine);
+      static void cleanup(Engine* engine);
+
+      static void begin_frame(VkCommandBuffer cmd, uint32_t frame_slot, uint64_t frame_number);
+      static void end_frame(VkCommandBuffer cmd);
+      static void begin_scope(VkCommandBuffer cmd, const char* name, glm::vec4 colour);
+      static void end_scope(VkCommandBuffer cmd);
+
+      // reads back a frame slot without waiting, false if the queries are not ready yet
+      static bool resolve(uint32_t frame_slot);
+      static float last_frame_ms();
+
+      static void render_panel();
+      static bool write_csv(std::string_view path);
+    public:
+      struct PassTiming
+      {
+        std::string name;
+        uint32_t depth;
+        float start_ms; // relative to the start of the frame
+        float duration_ms;
+      };
+
+      struct FrameTimings
+      {
+        uint64_t frame;
+        std::vector<PassTiming> passes;
+      };
+
+      static inline FrameTimings lastFrame{};
+      static inline std::deque<FrameTimings> history{};
+      static inline uint32_t historySize{ 240 }; // frames kept for averages and csv export
+    private:
+      struct Scope
+      {
+        std::string name;
+        uint32_t depth;
+        uint32_t beginQuery;
+        uint32_t endQuery{UINT32_MAX};
+      };
+
+      struct FrameQueries
+      {
+        VkQueryPool pool{};
+        std::vector<Scope> scopes;
+        uint32_t queryCount{ 0 };
+        uint32_t openScopes{ 0 }; // each still needs its end query
+        uint64_t frameNumber{ 0 };
+        bool pending{ false };
+      };
+
+      static constexpr uint32_t MAX_QUERIES = 128;
+
+      static inline std::vector<FrameQueries> frames{};
+      static inline FrameQueries* current{ nullptr };
+      static inline std::mutex mutex{};
+      static inline std::thread::id frameThread{}; // the one that called begin_frame
+      static inline thread_local std::vector<uint32_t> open{}; // stack of scopes waiting for end_scope
+      static inline VkDevice device{};
+      static inline float timestampPeriod{ 1.0f };
+      static inline bool supported{ false };
+  };
+
+} // namespace Lucerna
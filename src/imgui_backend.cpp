@@ -77,10 +77,12 @@ void VulkanImGuiBackend::init(Engine* engine)
   };
 
   
+  // only the bindless set, at 0 in the imgui shaders
   VkDescriptorSetLayout sets[] = {engine->bindless_descriptor_layout};
   
   VkPipelineLayoutCreateInfo pipelineLayout = vkinit::pipeline_layout_create_info();
   pipelineLayout.pSetLayouts = &sets[0];
+  pipelineLayout.setLayoutCount = 1;
   pipelineLayout.pPushConstantRanges = &range;
   pipelineLayout.pushConstantRangeCount = 1;
 
@@ -105,8 +107,8 @@ void VulkanImGuiBackend::init(Engine* engine)
     
     b.disable_depthtest();
     b.set_color_attachment_format(engine->m_Swapchain.format);
-    b.PipelineLayout = engine->bindless_pipeline_layout;
-    pipeline = b.build_pipeline(device);
+    b.PipelineLayout = pipLayout;
+    pipeline = b.build_pipeline(device, engine->pipelineCache.handle());
   }
 
   vkDestroyShaderModule(device, vert, nullptr);
@@ -147,8 +149,8 @@ void VulkanImGuiBackend::draw(
   vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
 
 
-  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, engine->bindless_pipeline_layout, 0, 1, &engine->global_descriptor_set, 0, nullptr);
-  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, engine->bindless_pipeline_layout, 1, 1, &engine->bindless_descriptor_set, 0, nullptr);
+  // own layout, push constants and the bindless textures. no scene set to bind
+  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipLayout, 0, 1, &engine->bindless_descriptor_set, 0, nullptr);
 
 
   float targetWidth = (float) swapchainExtent.width;
@@ -446,8 +448,9 @@ void FrameGraph::render_graph()
     ImGui::Text(" sd: %.3f\t cv: %.3f", sd, sd/avg);
     ImGui::Text("min: %.3f\tmax: %.3f", min, max);
 
-    uint32_t* cnt = (uint32_t*) Engine::get()->opaque_set.buffers.indirect_count.info.pMappedData;
-    ImGui::Text("indirect count: %i", *cnt);
+    const IndirectList& list = Engine::get()->opaque_set.buffers.indirect;
+    uint32_t cnt = list.count.info.pMappedData ? *(uint32_t*) list.count.info.pMappedData : 0;
+    ImGui::Text("indirect count: %i", cnt);
     
   ImGui::End();
 }
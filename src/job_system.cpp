@@ -0,0 +1,120 @@
+#include "job_system.h"
+#include "logger.h"
+
+namespace Lucerna {
+
+void JobSystem::init(uint32_t workerCount)
+{
+  if (workerCount == 0)
+  {
+    workerCount = glm::max(1u, std::thread::hardware_concurrency()) - 1;
+  }
+
+  stopping = false;
+  workers.reserve(workerCount);
+  for (uint32_t i = 0; i < workerCount; i++)
+  {
+    workers.emplace_back(worker_loop, i + 1);
+  }
+
+  LA_LOG_INFO("Job system started with {} workers", workerCount);
+}
+
+void JobSystem::shutdown()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wake.notify_all();
+
+  for (std::thread& t : workers)
+  {
+    t.join();
+  }
+  workers.clear();
+  jobs.clear();
+}
+
+void JobSystem::worker_loop(uint32_t index)
+{
+  threadIndex = index;
+  while (true)
+  {
+    std::function<void()> job;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wake.wait(lock, []{ return stopping || !jobs.empty(); });
+
+      if (stopping && jobs.empty())
+        return;
+
+      job = std::move(jobs.front());
+      jobs.pop_front();
+    }
+    job();
+  }
+}
+
+void JobSystem::dispatch(std::function<void()>&& job)
+{
+  if (workers.empty())
+  {
+    job();
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    jobs.push_back(std::move(job));
+  }
+  wake.notify_one();
+}
+
+void JobSystem::parallel_for(uint32_t count, const std::function<void(uint32_t)>& fn, uint32_t maxThreads)
+{
+  if (count == 0)
+    return;
+
+  // shared with the helpers, they may only get scheduled after this call already returned
+  struct Work
+  {
+    std::function<void(uint32_t)> fn;
+    uint32_t count;
+    std::atomic<uint32_t> next{ 0 };
+    std::atomic<uint32_t> done{ 0 };
+  };
+
+  auto work = std::make_shared<Work>();
+  work->fn = fn;
+  work->count = count;
+
+  auto run = [](Work& w) {
+    uint32_t i;
+    while ((i = w.next.fetch_add(1)) < w.count)
+    {
+      w.fn(i);
+      if (w.done.fetch_add(1) + 1 == w.count)
+      {
+        w.done.notify_all();
+      }
+    }
+  };
+
+  uint32_t helpers = std::min({(uint32_t) workers.size(), count - 1, glm::max(maxThreads, 1u) - 1});
+  for (uint32_t h = 0; h < helpers; h++)
+  {
+    dispatch([work, run] { run(*work); });
+  }
+
+  run(*work);
+
+  uint32_t done = work->done.load();
+  while (done < count)
+  {
+    work->done.wait(done);
+    done = work->done.load();
+  }
+}
+
+} // namespace Lucerna
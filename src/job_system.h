@@ -0,0 +1,38 @@
+#pragma once
+#include "lucerna_pch.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+namespace Lucerna {
+
+  // small fixed size worker pool. parallel_for is the main entry point, the calling thread
+  // takes part in the work so nesting it inside a job can not deadlock
+  class JobSystem
+  {
+    public:
+      // 0 workers = hardware threads - 1
+      static void init(uint32_t workers = 0);
+      static void shutdown();
+
+      static void dispatch(std::function<void()>&& job);
+
+      // runs fn(i) for every i in [0, count) on at most maxThreads threads (caller included), returns once all ran
+      static void parallel_for(uint32_t count, const std::function<void(uint32_t)>& fn, uint32_t maxThreads = UINT32_MAX);
+
+      static uint32_t thread_count() { return workers.size() + 1; }
+      // 0 for threads outside the pool, 1..workers for the workers. indexes per thread resources
+      static uint32_t thread_index() { return threadIndex; }
+    private:
+      static void worker_loop(uint32_t index);
+    private:
+      static inline std::vector<std::thread> workers{};
+      static inline std::deque<std::function<void()>> jobs{};
+      static inline std::mutex mutex{};
+      static inline std::condition_variable wake{};
+      static inline bool stopping{ false };
+      static inline thread_local uint32_t threadIndex{ 0 };
+  };
+
+} // namespace Lucerna
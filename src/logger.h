@@ -97,8 +97,11 @@ namespace vklog {
   #define MARKER_GREEN glm::vec4(0.0, 0.5, 0.0, 1.0)
   #define MARKER_BLUE glm::vec4(0.0, 0.0, 0.5, 1.0)
   
+  // NOTE: debug utils is only enabled with validation layers, the entry points are null otherwise
   inline void start_debug_label(VkCommandBuffer cmd, const char* name, glm::vec4 colour)
   {
+    if (vkCmdBeginDebugUtilsLabelEXT == nullptr) return;
+
    const VkDebugUtilsLabelEXT cmdLabel = {
         .sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_LABEL_EXT,
         .pLabelName = name,
@@ -111,6 +114,7 @@ namespace vklog {
 
   inline void end_debug_label(VkCommandBuffer cmd)
   {
+    if (vkCmdEndDebugUtilsLabelEXT == nullptr) return;
     vkCmdEndDebugUtilsLabelEXT(cmd);
   }
 
@@ -0,0 +1,807 @@
+#include "render_graph.h"
+#include "vk_initialisers.h"
+#include "gpu_profiler.h"
+#include "job_system.h"
+#include "la_asserts.h"
+#include "logger.h"
+
+namespace Lucerna {
+
+static constexpr VkAccessFlags2 WRITE_ACCESS =
+  VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT |
+  VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT;
+
+struct UsageInfo
+{
+  VkImageLayout layout;
+  VkPipelineStageFlags2 stages;
+  VkAccessFlags2 access;
+};
+
+static UsageInfo usage_info(ResourceUsage usage, RenderGraph::PassType type)
+{
+  VkPipelineStageFlags2 shaderStages = VK_PIPELINE_STAGE_2_NONE;
+  switch (type)
+  {
+    case RenderGraph::PassType::Graphics: shaderStages = VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT; break;
+    case RenderGraph::PassType::Compute: shaderStages = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT; break;
+    case RenderGraph::PassType::Transfer: break;
+  }
+
+  constexpr VkPipelineStageFlags2 depthTests = VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT;
+
+  switch (usage)
+  {
+    case ResourceUsage::ColorAttachment:
+      return {VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT};
+    case ResourceUsage::DepthAttachment:
+      return {VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, depthTests, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT};
+    case ResourceUsage::DepthRead:
+      return {VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL, depthTests, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT};
+    case ResourceUsage::DepthSampled:
+      return {VK_IMAGE_LAYOUT_DEPTH_READ_ONLY_OPTIMAL, shaderStages, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT};
+    case ResourceUsage::Sampled:
+      return {VK_IMAGE_LAYOUT_GENERAL, shaderStages, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT};
+    case ResourceUsage::StorageRead:
+      return {VK_IMAGE_LAYOUT_GENERAL, shaderStages, VK_ACCESS_2_SHADER_STORAGE_READ_BIT};
+    case ResourceUsage::StorageWrite:
+      return {VK_IMAGE_LAYOUT_GENERAL, shaderStages, VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT};
+    case ResourceUsage::TransferSrc:
+      return {VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_READ_BIT};
+    case ResourceUsage::TransferDst:
+      return {VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT};
+    case ResourceUsage::IndirectBuffer:
+      return {VK_IMAGE_LAYOUT_UNDEFINED, VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT};
+    case ResourceUsage::Present:
+      return {VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE};
+  }
+
+  LA_LOG_ASSERT(false, "Unhandled resource usage {}", (uint32_t) usage);
+  return {};
+}
+
+void CommandPools::init(VkDevice device, std::array<uint32_t, 2> families, VkCommandBufferLevel level)
+{
+  this->level = level;
+  for (uint32_t q = 0; q < 2; q++)
+  {
+    VkCommandPoolCreateInfo poolInfo = vkinit::command_pool_create_info(families[q]);
+    VK_CHECK_RESULT(vkCreateCommandPool(device, &poolInfo, nullptr, &pools[q]));
+  }
+}
+
+void CommandPools::destroy(VkDevice device)
+{
+  for (uint32_t q = 0; q < 2; q++)
+  {
+    vkDestroyCommandPool(device, pools[q], nullptr);
+    cmds[q].clear();
+    used[q] = 0;
+  }
+}
+
+void CommandPools::reset(VkDevice device)
+{
+  for (uint32_t q = 0; q < 2; q++)
+  {
+    if (used[q] > 0)
+    {
+      VK_CHECK_RESULT(vkResetCommandPool(device, pools[q], 0));
+    }
+    used[q] = 0;
+  }
+}
+
+VkCommandBuffer CommandPools::next(VkDevice device, uint32_t queue)
+{
+  if (used[queue] == cmds[queue].size())
+  {
+    VkCommandBufferAllocateInfo allocInfo = vkinit::command_buffer_allocate_info(pools[queue]);
+    allocInfo.level = level;
+    VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &allocInfo, &cmds[queue].emplace_back()));
+  }
+  return cmds[queue][used[queue]++];
+}
+
+RenderGraph::Pass& RenderGraph::Pass::read(RGHandle resource, ResourceUsage usage)
+{
+  for (const Use& u : uses)
+  {
+    LA_LOG_ASSERT(u.resource != resource, "Pass {} declares a resource twice", name);
+  }
+  uses.push_back({.resource = resource, .usage = usage, .write = false});
+  return *this;
+}
+
+RenderGraph::Pass& RenderGraph::Pass::write(RGHandle resource, ResourceUsage usage)
+{
+  for (const Use& u : uses)
+  {
+    LA_LOG_ASSERT(u.resource != resource, "Pass {} declares a resource twice", name);
+  }
+  uses.push_back({.resource = resource, .usage = usage, .write = true});
+  return *this;
+}
+
+RenderGraph::Pass& RenderGraph::Pass::side_effects()
+{
+  sideEffects = true;
+  return *this;
+}
+
+RenderGraph::Pass& RenderGraph::Pass::async_compute()
+{
+  LA_LOG_ASSERT(type == PassType::Compute, "Pass {} cant run on the compute queue", name);
+  async = true;
+  return *this;
+}
+
+RenderGraph::Pass& RenderGraph::Pass::main_thread()
+{
+  mainThread = true;
+  return *this;
+}
+
+RenderGraph::Pass& RenderGraph::Pass::record(std::function<void(VkCommandBuffer cmd)>&& fn)
+{
+  this->fn = std::move(fn);
+  return *this;
+}
+
+void RenderGraph::init(VkDevice device, VmaAllocator allocator, uint32_t framesInFlight, Queue graphics, Queue compute)
+{
+  this->device = device;
+  pool.init(device, allocator);
+
+  // without a compute queue everything stays on graphics, the second queue is never used
+  queues = {graphics, compute.queue != VK_NULL_HANDLE ? compute : graphics};
+
+  VkSemaphoreTypeCreateInfo typeInfo{.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO, .pNext = nullptr};
+  typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+  typeInfo.initialValue = 0;
+
+  VkSemaphoreCreateInfo semaphoreInfo = vkinit::semaphore_create_info(0);
+  semaphoreInfo.pNext = &typeInfo;
+  for (VkSemaphore& timeline : timelines)
+  {
+    VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &timeline));
+  }
+
+  frames.resize(framesInFlight);
+  for (CommandPools& frame : frames)
+  {
+    frame.init(device, {queues[0].family, queues[1].family}, VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+  }
+}
+
+void RenderGraph::destroy()
+{
+  pool.destroy();
+
+  for (CommandPools& frame : frames)
+  {
+    frame.destroy(device);
+  }
+  frames.clear();
+
+  for (VkSemaphore timeline : timelines)
+  {
+    vkDestroySemaphore(device, timeline, nullptr);
+  }
+}
+
+void RenderGraph::begin(uint32_t frameSlot, bool asyncCompute, std::span<CommandPools> threadPools)
+{
+  resources.clear();
+  passes.clear();
+  requestResources.clear();
+  segments.clear();
+  lastSegment = {UINT32_MAX, UINT32_MAX};
+  culledCount = 0;
+  batchCount = 0;
+  compiled = false;
+
+  this->frameSlot = frameSlot;
+  asyncEnabled = asyncCompute && queues[1].queue != queues[0].queue;
+  this->threadPools = threadPools;
+  frames[frameSlot].reset(device);
+}
+
+uint64_t RenderGraph::key(const Resource& r)
+{
+  return r.image != VK_NULL_HANDLE ? (uint64_t) r.image : (uint64_t) r.buffer;
+}
+
+RGHandle RenderGraph::import_image(std::string_view name, VkImage image, VkImageAspectFlags aspect, VkImageLayout layout, VkPipelineStageFlags2 readyStage)
+{
+  Resource r{.name = std::string(name), .image = image, .aspect = aspect};
+
+  // the last frame may still be using it, only the layout is taken from the caller
+  auto it = remembered.find(key(r));
+  if (it != remembered.end())
+  {
+    r.state = it->second;
+  }
+  r.state.layout = layout;
+  r.state.readStages |= readyStage;
+
+  resources.push_back(r);
+  return resources.size() - 1;
+}
+
+RGHandle RenderGraph::import_buffer(std::string_view name, VkBuffer buffer)
+{
+  Resource r{.name = std::string(name), .buffer = buffer};
+
+  auto it = remembered.find(key(r));
+  if (it != remembered.end())
+  {
+    r.state = it->second;
+  }
+
+  resources.push_back(r);
+  return resources.size() - 1;
+}
+
+RGHandle RenderGraph::create_image(std::string_view name, const TransientImageDesc& desc)
+{
+  Resource r{.name = std::string(name)};
+  r.aspect = desc.format == VK_FORMAT_D32_SFLOAT ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+  r.transient = desc;
+
+  resources.push_back(r);
+  return resources.size() - 1;
+}
+
+const AllocatedImage& RenderGraph::image(RGHandle resource) const
+{
+  const Resource& r = resources[resource];
+  if (r.request == UINT32_MAX)
+    return unplaced;
+  return pool.image(r.request);
+}
+
+void RenderGraph::export_resource(RGHandle resource, ResourceUsage finalUsage)
+{
+  LA_LOG_ASSERT(!resources[resource].transient.has_value(), "Transient {} cant be exported", resources[resource].name);
+  resources[resource].exported = finalUsage;
+}
+
+RenderGraph::Pass& RenderGraph::add_pass(std::string_view name, PassType type, glm::vec4 colour)
+{
+  passes.push_back({.name = std::string(name), .colour = colour, .type = type});
+  return passes.back();
+}
+
+void RenderGraph::cull()
+{
+  // walk back from the exported resources, a pass lives if it writes something a live pass (or the export) uses.
+  // a write keeps earlier writers alive too since attachments load and storage images are read-modify-write
+  std::vector<bool> needed(resources.size(), false);
+  for (uint32_t i = 0; i < resources.size(); i++)
+  {
+    needed[i] = resources[i].exported.has_value();
+  }
+
+  for (auto it = passes.rbegin(); it != passes.rend(); it++)
+  {
+    Pass& pass = *it;
+    bool live = pass.sideEffects;
+    for (const Pass::Use& use : pass.uses)
+    {
+      live = live || (use.write && needed[use.resource]);
+    }
+
+    pass.culled = !live;
+    if (pass.culled)
+    {
+      culledCount++;
+      continue;
+    }
+
+    for (const Pass::Use& use : pass.uses)
+    {
+      needed[use.resource] = true;
+    }
+  }
+}
+
+void RenderGraph::compile()
+{
+  cull();
+
+  // lifetime of a transient is the first to the last live pass that uses it
+  std::vector<TransientPool::Request> requests;
+  for (uint32_t p = 0; p < passes.size(); p++)
+  {
+    if (passes[p].culled)
+      continue;
+
+    for (const Pass::Use& use : passes[p].uses)
+    {
+      Resource& r = resources[use.resource];
+      if (!r.transient.has_value())
+        continue;
+
+      if (r.request == UINT32_MAX)
+      {
+        r.request = requests.size();
+        requests.push_back({.name = r.name, .desc = *r.transient, .first = p, .last = p});
+        requestResources.push_back(use.resource);
+      }
+      requests[r.request].last = p;
+    }
+  }
+
+  pool.place(requests);
+
+  for (uint32_t i = 0; i < requestResources.size(); i++)
+  {
+    Resource& r = resources[requestResources[i]];
+    r.image = pool.image(i).image;
+
+    // contents dont survive a frame, but the memory may still be in use by the last frame
+    auto it = remembered.find(key(r));
+    if (it != remembered.end())
+    {
+      r.state = it->second;
+    }
+    r.state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+  }
+
+  compiled = true;
+}
+
+bool RenderGraph::needs_transfer(const Resource& r) const
+{
+  // buffers are shared between the families, images keep their contents only through an ownership transfer
+  return queues[0].family != queues[1].family && r.image != VK_NULL_HANDLE && r.state.layout != VK_IMAGE_LAYOUT_UNDEFINED;
+}
+
+void RenderGraph::release(Resource& r, VkImageLayout layout, VkPipelineStageFlags2 dstStages, VkAccessFlags2 dstAccess, Barriers& releases, Barriers& acquires)
+{
+  QueueType to = r.queue == QueueType::Graphics ? QueueType::Compute : QueueType::Graphics;
+
+  // the layout change happens between the release and the acquire, both have to name it
+  VkImageMemoryBarrier2 barrier{.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2, .pNext = nullptr};
+  barrier.srcStageMask = r.state.writeStages | r.state.readStages;
+  barrier.srcAccessMask = r.state.writeAccess;
+  barrier.dstStageMask = VK_PIPELINE_STAGE_2_NONE;
+  barrier.dstAccessMask = VK_ACCESS_2_NONE;
+  barrier.oldLayout = r.state.layout;
+  barrier.newLayout = layout;
+  barrier.srcQueueFamilyIndex = queues[(uint32_t) r.queue].family;
+  barrier.dstQueueFamilyIndex = queues[(uint32_t) to].family;
+  barrier.image = r.image;
+  barrier.subresourceRange = vkinit::image_subresource_range(r.aspect);
+  releases.images.push_back(barrier);
+
+  // the acquire on the other queue mirrors it
+  barrier.srcStageMask = VK_PIPELINE_STAGE_2_NONE;
+  barrier.srcAccessMask = VK_ACCESS_2_NONE;
+  barrier.dstStageMask = dstStages;
+  barrier.dstAccessMask = dstAccess;
+  acquires.images.push_back(barrier);
+  r.acquire = true;
+}
+
+void RenderGraph::transition(Resource& r, ResourceUsage usage, bool write, PassType type, QueueType queue, Barriers& barriers)
+{
+  // empty draw sets have no buffers
+  if (r.image == VK_NULL_HANDLE && r.buffer == VK_NULL_HANDLE)
+    return;
+
+  UsageInfo info = usage_info(usage, type);
+  State& s = r.state;
+
+  if (r.queue != queue)
+  {
+    // the semaphore wait ordered it after the other queue, stages of that queue mean nothing here
+    VkImageLayout layout = s.layout;
+    s = State{.layout = layout};
+    if (r.acquire)
+    {
+      // the acquire is in the barriers of this pass, it made the new layout visible to it
+      s.layout = info.layout;
+      s.visibleStages = info.stages;
+      s.visibleAccess = info.access;
+      r.acquire = false;
+    }
+    r.queue = queue;
+  }
+
+  // first use of a transient, wait for everything that used the same memory before it.
+  // uses on the other queue are behind a semaphore wait, so is the last frame for the compute queue
+  if (r.request != UINT32_MAX && !r.used)
+  {
+    for (uint32_t alias : pool.aliases(r.request))
+    {
+      const Resource& other = resources[requestResources[alias]];
+      bool sameQueue = other.used ? other.queue == queue : queue == QueueType::Graphics;
+      if (!sameQueue)
+        continue;
+
+      s.writeStages |= other.state.writeStages;
+      s.readStages |= other.state.readStages;
+      s.writeAccess |= other.state.writeAccess;
+    }
+  }
+  r.used = true;
+  bool layoutChange = r.image != VK_NULL_HANDLE && info.layout != s.layout;
+
+  VkPipelineStageFlags2 srcStages = VK_PIPELINE_STAGE_2_NONE;
+  VkAccessFlags2 srcAccess = VK_ACCESS_2_NONE;
+  if (write || layoutChange)
+  {
+    // waw and war, reads only need an execution dependency
+    srcStages = s.writeStages | s.readStages;
+    srcAccess = s.writeAccess;
+  }
+  else if ((info.stages & ~s.visibleStages) != 0 || (info.access & ~s.visibleAccess) != 0)
+  {
+    // raw, skipped when an earlier barrier already made the write visible to these stages
+    srcStages = s.writeStages;
+    srcAccess = s.writeAccess;
+  }
+
+  if (srcStages != VK_PIPELINE_STAGE_2_NONE || layoutChange)
+  {
+    if (r.image != VK_NULL_HANDLE)
+    {
+      VkImageMemoryBarrier2 barrier{.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2, .pNext = nullptr};
+      barrier.srcStageMask = srcStages;
+      barrier.srcAccessMask = srcAccess;
+      barrier.dstStageMask = info.stages;
+      barrier.dstAccessMask = info.access;
+      barrier.oldLayout = s.layout;
+      barrier.newLayout = info.layout;
+      barrier.image = r.image;
+      barrier.subresourceRange = vkinit::image_subresource_range(r.aspect);
+      barriers.images.push_back(barrier);
+    }
+    else
+    {
+      VkBufferMemoryBarrier2 barrier{.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2, .pNext = nullptr};
+      barrier.srcStageMask = srcStages;
+      barrier.srcAccessMask = srcAccess;
+      barrier.dstStageMask = info.stages;
+      barrier.dstAccessMask = info.access;
+      barrier.buffer = r.buffer;
+      barrier.size = VK_WHOLE_SIZE;
+      barriers.buffers.push_back(barrier);
+    }
+  }
+
+  if (write)
+  {
+    s.writeStages = info.stages;
+    s.writeAccess = info.access & WRITE_ACCESS;
+    s.readStages = VK_PIPELINE_STAGE_2_NONE;
+    s.visibleStages = VK_PIPELINE_STAGE_2_NONE;
+    s.visibleAccess = VK_ACCESS_2_NONE;
+  }
+  else if (layoutChange)
+  {
+    // the transition is the last write, later readers chain off the stages it was made visible to
+    s.writeStages = info.stages;
+    s.writeAccess = VK_ACCESS_2_NONE;
+    s.readStages = info.stages;
+    s.visibleStages = info.stages;
+    s.visibleAccess = info.access;
+  }
+  else
+  {
+    s.readStages |= info.stages;
+    s.visibleStages |= info.stages;
+    s.visibleAccess |= info.access;
+  }
+
+  if (r.image != VK_NULL_HANDLE)
+  {
+    s.layout = info.layout;
+  }
+}
+
+void RenderGraph::flush(VkCommandBuffer cmd, Barriers& barriers)
+{
+  if (barriers.images.empty() && barriers.buffers.empty())
+    return;
+
+  VkDependencyInfo depInfo{.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO, .pNext = nullptr};
+  depInfo.imageMemoryBarrierCount = barriers.images.size();
+  depInfo.pImageMemoryBarriers = barriers.images.data();
+  depInfo.bufferMemoryBarrierCount = barriers.buffers.size();
+  depInfo.pBufferMemoryBarriers = barriers.buffers.data();
+  vkCmdPipelineBarrier2(cmd, &depInfo);
+
+  batchCount++;
+  barriers.images.clear();
+  barriers.buffers.clear();
+}
+
+uint32_t RenderGraph::open_segment(QueueType queue)
+{
+  uint32_t q = (uint32_t) queue;
+  VkCommandBuffer cmd = frames[frameSlot].next(device, q);
+  VkCommandBufferBeginInfo beginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+  VK_CHECK_RESULT(vkBeginCommandBuffer(cmd, &beginInfo));
+
+  segments.push_back({.queue = queue, .cmd = cmd});
+  lastSegment[q] = segments.size() - 1;
+  return lastSegment[q];
+}
+
+void RenderGraph::close_segment(uint32_t segment)
+{
+  Segment& seg = segments[segment];
+  if (seg.signal == 0)
+    seg.signal = ++timelineValues[(uint32_t) seg.queue];
+}
+
+void RenderGraph::wait_for_other(QueueType queue)
+{
+  uint32_t q = (uint32_t) queue;
+  uint32_t other = q ^ 1;
+  LA_LOG_ASSERT(lastSegment[other] != UINT32_MAX, "Nothing to wait for on the other queue");
+
+  close_segment(lastSegment[other]);
+  uint64_t value = segments[lastSegment[other]].signal;
+  if (lastSegment[q] != UINT32_MAX && segments[lastSegment[q]].waits[other] >= value)
+    return;
+
+  // a segment that already recorded something cant wait in the middle, it is cut
+  if (lastSegment[q] == UINT32_MAX || segments[lastSegment[q]].signal != 0 || !segments[lastSegment[q]].empty)
+  {
+    if (lastSegment[q] != UINT32_MAX)
+      close_segment(lastSegment[q]);
+    open_segment(queue);
+  }
+
+  Segment& seg = segments[lastSegment[q]];
+  seg.waits[other] = std::max(seg.waits[other], value);
+}
+
+void RenderGraph::execute(VkCommandBuffer cmd)
+{
+  if (!compiled)
+    compile();
+
+  // the frame starts on the caller's command buffer, the compute queue may still hold the last frame
+  segments.push_back({.queue = QueueType::Graphics, .cmd = cmd, .empty = false});
+  lastSegment[(uint32_t) QueueType::Graphics] = 0;
+  segments[0].waits[(uint32_t) QueueType::Compute] = lastFrameCompute;
+
+  // passes record into their own secondaries first, the loop below only stitches them in with the barriers
+  if (!threadPools.empty())
+  {
+    std::vector<Pass*> parallel;
+    for (Pass& pass : passes)
+    {
+      if (!pass.culled && !pass.mainThread && pass.fn)
+        parallel.push_back(&pass);
+    }
+
+    JobSystem::parallel_for(parallel.size(), [&](uint32_t i) {
+      Pass& pass = *parallel[i];
+      uint32_t thread = JobSystem::thread_index();
+      LA_LOG_ASSERT(thread < threadPools.size(), "No command pools for recording thread {}", thread);
+
+      // no render pass to inherit, the passes begin their own rendering
+      VkCommandBufferInheritanceInfo inheritance{.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO, .pNext = nullptr};
+      VkCommandBufferBeginInfo beginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+      beginInfo.pInheritanceInfo = &inheritance;
+
+      VkCommandBuffer secondary = threadPools[thread].next(device, (uint32_t) queue_of(pass));
+      VK_CHECK_RESULT(vkBeginCommandBuffer(secondary, &beginInfo));
+      record(pass, secondary);
+      VK_CHECK_RESULT(vkEndCommandBuffer(secondary));
+      pass.secondary = secondary;
+    });
+  }
+
+  Barriers barriers;
+  Barriers releases;
+  for (Pass& pass : passes)
+  {
+    if (pass.culled)
+      continue;
+
+    QueueType queue = queue_of(pass);
+    uint32_t q = (uint32_t) queue;
+
+    // anything the other queue used this frame, or images whose contents have to change family.
+    // the first compute work of a frame waits on the graphics queue, that covers the last frame and the query reset
+    bool wait = queue == QueueType::Compute && lastSegment[q] == UINT32_MAX;
+    for (const Pass::Use& use : pass.uses)
+    {
+      const Resource& r = resources[use.resource];
+      if (r.image == VK_NULL_HANDLE && r.buffer == VK_NULL_HANDLE)
+        continue;
+
+      wait = wait || (r.queue != queue && (r.used || needs_transfer(r)));
+      if (r.request != UINT32_MAX && !r.used)
+      {
+        for (uint32_t alias : pool.aliases(r.request))
+        {
+          const Resource& other = resources[requestResources[alias]];
+          wait = wait || (other.used && other.queue != queue);
+        }
+      }
+    }
+
+    if (wait)
+    {
+      // released on the other queue before the cut, acquired in the barriers of this pass
+      uint32_t other = q ^ 1;
+      for (const Pass::Use& use : pass.uses)
+      {
+        Resource& r = resources[use.resource];
+        if (r.queue != queue && needs_transfer(r))
+        {
+          UsageInfo info = usage_info(use.usage, pass.type);
+          release(r, info.layout, info.stages, info.access, releases, barriers);
+        }
+      }
+      if (lastSegment[other] != UINT32_MAX)
+        flush(segments[lastSegment[other]].cmd, releases);
+
+      wait_for_other(queue);
+    }
+    else if (lastSegment[q] == UINT32_MAX || segments[lastSegment[q]].signal != 0)
+    {
+      open_segment(queue);
+    }
+
+    Segment& seg = segments[lastSegment[q]];
+    seg.empty = false;
+
+    for (const Pass::Use& use : pass.uses)
+    {
+      transition(resources[use.resource], use.usage, use.write, pass.type, queue, barriers);
+    }
+    flush(seg.cmd, barriers);
+
+    if (pass.secondary != VK_NULL_HANDLE)
+    {
+      vkCmdExecuteCommands(seg.cmd, 1, &pass.secondary);
+    }
+    else
+    {
+      record(pass, seg.cmd);
+    }
+  }
+
+  // join, the frame ends on graphics with everything compute touched handed back
+  const uint32_t compute = (uint32_t) QueueType::Compute;
+  if (lastSegment[compute] != UINT32_MAX)
+  {
+    for (Resource& r : resources)
+    {
+      // transients are dead by now, the next frame discards them
+      if (r.queue == QueueType::Compute && !r.transient.has_value() && needs_transfer(r))
+        release(r, r.state.layout, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT, releases, barriers);
+    }
+    flush(segments[lastSegment[compute]].cmd, releases);
+    wait_for_other(QueueType::Graphics);
+
+    for (Resource& r : resources)
+    {
+      if (r.queue != QueueType::Compute)
+        continue;
+
+      // the acquire and the semaphore wait cover every later command
+      r.state = State{.layout = r.state.layout};
+      r.queue = QueueType::Graphics;
+      r.acquire = false;
+    }
+  }
+
+  VkCommandBuffer last = graphics_cmd();
+  segments[lastSegment[(uint32_t) QueueType::Graphics]].empty = false;
+  flush(last, barriers);
+
+  for (Resource& r : resources)
+  {
+    if (r.exported.has_value())
+      transition(r, *r.exported, false, PassType::Graphics, QueueType::Graphics, barriers);
+  }
+  flush(last, barriers);
+
+  for (const Resource& r : resources)
+  {
+    if (r.image != VK_NULL_HANDLE || r.buffer != VK_NULL_HANDLE)
+      remembered[key(r)] = r.state;
+  }
+
+  recordTimings.clear();
+  for (const Pass& pass : passes)
+  {
+    if (!pass.culled)
+      recordTimings.push_back({.name = pass.name, .ms = pass.recordMs, .thread = pass.recordThread});
+  }
+}
+
+RenderGraph::QueueType RenderGraph::queue_of(const Pass& pass) const
+{
+  return pass.async && asyncEnabled ? QueueType::Compute : QueueType::Graphics;
+}
+
+void RenderGraph::record(Pass& pass, VkCommandBuffer cmd)
+{
+  auto start = std::chrono::high_resolution_clock::now();
+
+  GpuProfiler::begin_scope(cmd, pass.name.c_str(), pass.colour);
+  if (pass.fn)
+    pass.fn(cmd);
+  GpuProfiler::end_scope(cmd);
+
+  pass.recordMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+  pass.recordThread = JobSystem::thread_index();
+}
+
+VkCommandBuffer RenderGraph::graphics_cmd() const
+{
+  return segments[lastSegment[(uint32_t) QueueType::Graphics]].cmd;
+}
+
+void RenderGraph::submit(const SubmitInfo& info)
+{
+  for (uint32_t i = 0; i < segments.size(); i++)
+  {
+    close_segment(i);
+    VK_CHECK_RESULT(vkEndCommandBuffer(segments[i].cmd));
+  }
+
+  const uint32_t graphics = (uint32_t) QueueType::Graphics;
+  const uint32_t compute = (uint32_t) QueueType::Compute;
+
+  std::vector<VkCommandBufferSubmitInfo> cmdInfos(segments.size());
+  std::vector<std::vector<VkSemaphoreSubmitInfo>> waits(segments.size());
+  std::vector<std::vector<VkSemaphoreSubmitInfo>> signals(segments.size());
+  std::array<std::vector<VkSubmitInfo2>, 2> batches;
+
+  for (uint32_t i = 0; i < segments.size(); i++)
+  {
+    const Segment& seg = segments[i];
+    cmdInfos[i] = vkinit::command_buffer_submit_info(seg.cmd);
+
+    for (uint32_t q = 0; q < 2; q++)
+    {
+      if (seg.waits[q] == 0)
+        continue;
+
+      VkSemaphoreSubmitInfo wait = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, timelines[q]);
+      wait.value = seg.waits[q];
+      waits[i].push_back(wait);
+    }
+
+    VkSemaphoreSubmitInfo signal = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, timelines[(uint32_t) seg.queue]);
+    signal.value = seg.signal;
+    signals[i].push_back(signal);
+
+    if (i == 0)
+      waits[i].insert(waits[i].end(), info.waits.begin(), info.waits.end());
+    if (i == lastSegment[graphics])
+      signals[i].insert(signals[i].end(), info.signals.begin(), info.signals.end());
+
+    VkSubmitInfo2 submitInfo = vkinit::submit_info(&cmdInfos[i], nullptr, nullptr);
+    submitInfo.waitSemaphoreInfoCount = waits[i].size();
+    submitInfo.pWaitSemaphoreInfos = waits[i].data();
+    submitInfo.signalSemaphoreInfoCount = signals[i].size();
+    submitInfo.pSignalSemaphoreInfos = signals[i].data();
+    batches[(uint32_t) seg.queue].push_back(submitInfo);
+  }
+
+  // timeline waits may be submitted before their signal, the order of the two queues doesnt matter
+  if (!batches[compute].empty())
+  {
+    VK_CHECK_RESULT(vkQueueSubmit2(queues[compute].queue, batches[compute].size(), batches[compute].data(), VK_NULL_HANDLE));
+    lastFrameCompute = segments[lastSegment[compute]].signal;
+  }
+  std::unique_lock<std::mutex> lock;
+  if (queues[graphics].mutex != nullptr)
+    lock = std::unique_lock<std::mutex>(*queues[graphics].mutex);
+  VK_CHECK_RESULT(vkQueueSubmit2(queues[graphics].queue, batches[graphics].size(), batches[graphics].data(), info.fence));
+}
+
+} // namespace Lucerna
@@ -0,0 +1,244 @@
+#pragma once
+#include <volk.h>
+#include "lucerna_pch.h"
+#include "vk_types.h"
+#include "transient_pool.h"
+
+#include <span>
+#include <mutex>
+
+namespace Lucerna {
+
+// how a pass touches a resource. resolves to the layout, stages and access of the barrier,
+// shader usages take their stages from the type of the pass
+enum class ResourceUsage : uint8_t
+{
+  ColorAttachment,
+  DepthAttachment, // depth test and write
+  DepthRead,       // depth test against a read only attachment
+  DepthSampled,    // DEPTH_READ_ONLY_OPTIMAL, sampled by the shaders of the pass
+  Sampled,         // GENERAL, images compute touches stay in it
+  StorageRead,
+  StorageWrite,    // read and write, storage images and buffers
+  TransferSrc,
+  TransferDst,
+  IndirectBuffer,  // draw arguments and counts
+  Present,         // only as the final usage of an exported image
+};
+
+using RGHandle = uint32_t;
+
+// a command pool for each queue of the graph (graphics, compute), reset as a whole once the frame that used it is done.
+// buffers are handed out in order and reused after the reset
+struct CommandPools
+{
+  std::array<VkCommandPool, 2> pools{};
+  std::array<std::vector<VkCommandBuffer>, 2> cmds;
+  std::array<uint32_t, 2> used{};
+  VkCommandBufferLevel level{ VK_COMMAND_BUFFER_LEVEL_PRIMARY };
+
+  void init(VkDevice device, std::array<uint32_t, 2> families, VkCommandBufferLevel level);
+  void destroy(VkDevice device);
+  void reset(VkDevice device);
+  VkCommandBuffer next(VkDevice device, uint32_t queue);
+};
+
+// passes declare the images and buffers they use and are submitted in declaration order. with thread pools
+// every pass records into its own secondary command buffer on the job system and the graph only records the
+// barriers and the vkCmdExecuteCommands into the primaries, pass functions have to be safe to run next to
+// each other. before each pass the graph emits a single batched barrier with the minimal
+// stages and access of the resources the pass declared, passes that dont contribute to an exported
+// resource are culled. every pass gets a debug label and a GpuProfiler scope.
+// resource state carries over between frames (keyed by handle) so the first use of a frame
+// waits on what the previous frame did with it instead of the whole pipeline.
+// async compute passes go to the compute queue, the frame is cut into submissions wherever a pass needs
+// something the other queue touched last. the cuts are ordered with a timeline semaphore per queue and images
+// change queue family with a release/acquire pair, buffers are created shared between the two families.
+// everything is back on the graphics queue at the end of the frame.
+// images made with create_image only exist from the first to the last live pass that uses them and are
+// placed by a TransientPool, images that are never alive at the same time share memory.
+class RenderGraph
+{
+  public:
+    enum class PassType : uint8_t
+    {
+      Graphics,
+      Compute,
+      Transfer,
+    };
+
+    struct Pass
+    {
+      Pass& read(RGHandle resource, ResourceUsage usage);
+      Pass& write(RGHandle resource, ResourceUsage usage);
+      Pass& side_effects(); // never culled, for passes only the cpu sees the result of
+      Pass& async_compute(); // compute passes only, run on the compute queue when the graph has one
+      Pass& main_thread(); // recorded inline on the calling thread after the parallel passes, for passes that change what others read (imgui edits cvars)
+      Pass& record(std::function<void(VkCommandBuffer cmd)>&& fn);
+
+      struct Use
+      {
+        RGHandle resource;
+        ResourceUsage usage;
+        bool write;
+      };
+
+      std::string name;
+      glm::vec4 colour;
+      PassType type;
+      std::vector<Use> uses;
+      std::function<void(VkCommandBuffer cmd)> fn;
+      bool sideEffects{ false };
+      bool async{ false };
+      bool mainThread{ false };
+      bool culled{ false };
+      VkCommandBuffer secondary{};
+      float recordMs{ 0.0f };
+      uint32_t recordThread{ 0 };
+    };
+
+    struct RecordTiming
+    {
+      std::string name;
+      float ms; // cpu time spent in the pass function
+      uint32_t thread; // JobSystem::thread_index of the recording thread
+    };
+
+    enum class QueueType : uint8_t
+    {
+      Graphics,
+      Compute,
+    };
+
+    struct Queue
+    {
+      VkQueue queue{};
+      uint32_t family{ 0 };
+      std::mutex* mutex{ nullptr }; // held around submits when others submit to the queue too
+    };
+
+    struct SubmitInfo
+    {
+      std::span<const VkSemaphoreSubmitInfo> waits;   // on the first graphics submission
+      std::span<const VkSemaphoreSubmitInfo> signals; // on the last one
+      VkFence fence{};
+    };
+
+    // compute.queue is null when the device has no queue next to the graphics one
+    void init(VkDevice device, VmaAllocator allocator, uint32_t framesInFlight, Queue graphics, Queue compute);
+    void destroy();
+
+    // clears the passes and resources of the last frame, remembered states are kept.
+    // frameSlot has to be done on the gpu, its command buffers are reset.
+    // threadPools holds secondary pools for every job system thread, passes record serially without them
+    void begin(uint32_t frameSlot, bool asyncCompute, std::span<CommandPools> threadPools = {});
+    // layout is what the image is in now, UNDEFINED discards the contents.
+    // readyStage is where a semaphore wait makes it usable (swapchain images), the first barrier chains off it
+    RGHandle import_image(std::string_view name, VkImage image, VkImageAspectFlags aspect, VkImageLayout layout, VkPipelineStageFlags2 readyStage = VK_PIPELINE_STAGE_2_NONE);
+    RGHandle import_buffer(std::string_view name, VkBuffer buffer);
+    // transient, the first pass that uses it has to write it. cant be exported
+    RGHandle create_image(std::string_view name, const TransientImageDesc& desc);
+    // roots for culling, finalUsage is transitioned to after the last pass
+    void export_resource(RGHandle resource, ResourceUsage finalUsage);
+
+    Pass& add_pass(std::string_view name, PassType type, glm::vec4 colour);
+    // culls the passes and places the transient images, done by execute if it wasnt called
+    void compile();
+    // cmd is the recording graphics command buffer the frame starts in
+    void execute(VkCommandBuffer cmd);
+    // the graphics command buffer the frame ends in, still recording after execute
+    VkCommandBuffer graphics_cmd() const;
+    // ends every command buffer of the frame (cmd of execute too) and submits them
+    void submit(const SubmitInfo& info);
+
+    // valid after compile, transients of culled passes have no image
+    const AllocatedImage& image(RGHandle resource) const;
+
+    uint32_t culled_passes() const { return culledCount; }
+    uint32_t barrier_batches() const { return batchCount; }
+    uint32_t submissions() const { return segments.size(); }
+    bool async_compute() const { return asyncEnabled; }
+    bool parallel_recording() const { return !threadPools.empty(); }
+    // live passes of the last execute in declaration order
+    const std::vector<RecordTiming>& record_timings() const { return recordTimings; }
+    const TransientPool::Stats& transient_stats() const { return pool.stats(); }
+  private:
+    struct State
+    {
+      VkImageLayout layout{ VK_IMAGE_LAYOUT_UNDEFINED };
+      VkPipelineStageFlags2 writeStages{ VK_PIPELINE_STAGE_2_NONE }; // last write or layout transition
+      VkAccessFlags2 writeAccess{ VK_ACCESS_2_NONE };
+      VkPipelineStageFlags2 readStages{ VK_PIPELINE_STAGE_2_NONE };  // reads since, a write has to wait for them
+      VkPipelineStageFlags2 visibleStages{ VK_PIPELINE_STAGE_2_NONE }; // already synchronised with the write
+      VkAccessFlags2 visibleAccess{ VK_ACCESS_2_NONE };
+    };
+
+    struct Resource
+    {
+      std::string name;
+      VkImage image{};
+      VkBuffer buffer{};
+      VkImageAspectFlags aspect{};
+      State state{};
+      std::optional<ResourceUsage> exported;
+      std::optional<TransientImageDesc> transient;
+      uint32_t request{ UINT32_MAX }; // into the placed transients
+      QueueType queue{ QueueType::Graphics }; // where it was last used
+      bool acquire{ false }; // released by the other family, the next use acquires it
+      bool used{ false };
+    };
+
+    // commands of one queue between two cuts, one submission
+    struct Segment
+    {
+      QueueType queue;
+      VkCommandBuffer cmd;
+      std::array<uint64_t, 2> waits{}; // timeline values of each queue
+      uint64_t signal{ 0 }; // 0 while still recording
+      bool empty{ true };
+    };
+
+    struct Barriers
+    {
+      std::vector<VkImageMemoryBarrier2> images;
+      std::vector<VkBufferMemoryBarrier2> buffers;
+    };
+
+    void cull();
+    void transition(Resource& r, ResourceUsage usage, bool write, PassType type, QueueType queue, Barriers& barriers);
+    void flush(VkCommandBuffer cmd, Barriers& barriers);
+    bool needs_transfer(const Resource& r) const;
+    void release(Resource& r, VkImageLayout layout, VkPipelineStageFlags2 dstStages, VkAccessFlags2 dstAccess, Barriers& releases, Barriers& acquires);
+    uint32_t open_segment(QueueType queue);
+    void close_segment(uint32_t segment);
+    void wait_for_other(QueueType queue);
+    void record(Pass& pass, VkCommandBuffer cmd);
+    QueueType queue_of(const Pass& pass) const;
+    static uint64_t key(const Resource& r);
+
+    std::vector<Resource> resources;
+    std::deque<Pass> passes; // stable references for the builder
+    std::unordered_map<uint64_t, State> remembered;
+    TransientPool pool;
+    std::vector<RGHandle> requestResources; // transient request -> resource
+    AllocatedImage unplaced{};
+    bool compiled{ false };
+
+    VkDevice device{};
+    std::array<Queue, 2> queues{};
+    std::array<VkSemaphore, 2> timelines{};
+    std::array<uint64_t, 2> timelineValues{};
+    uint64_t lastFrameCompute{ 0 }; // the graphics queue waits on it before touching what compute left
+    std::vector<CommandPools> frames;
+    std::span<CommandPools> threadPools;
+    std::vector<RecordTiming> recordTimings;
+    uint32_t frameSlot{ 0 };
+    bool asyncEnabled{ false };
+    std::vector<Segment> segments;
+    std::array<uint32_t, 2> lastSegment{ UINT32_MAX, UINT32_MAX };
+
+    uint32_t culledCount{ 0 };
+    uint32_t batchCount{ 0 };
+};
+
+} // namespace Lucerna
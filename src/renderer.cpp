@@ -1,6 +1,9 @@
 #include "renderer.h"
 #include "engine.h"
 #include "imgui_backend.h"
+#include "gpu_profiler.h"
+#include "gfx_effects.h"
+#include "cvars.h"
 #include "input_structures.glsl"
 #include "logger.h"
 #include "vk_types.h"
@@ -9,6 +12,9 @@
 
 namespace Lucerna {
 
+AutoCVar_Int occlusionCulling("culling.occlusion", "two phase hi-z occlusion culling against the depth prepass", 1, CVarFlags::EditCheckbox);
+AutoCVar_Int cullCompaction("culling.compaction", "0 = decoupled look-back (keeps draw order), 1 = atomic append", COMPACTION_LOOKBACK, CVarFlags::None);
+
 void Renderer::draw(VkCommandBuffer cmd)
 {
 }
@@ -23,6 +29,7 @@ void Renderer::draw_editor(VkCommandBuffer cmd, VkImageView target)
   ImGui::NewFrame();
 
   static bool show_overdraw{ false }, show_ssao{ false }, show_collision{ false }, show_debug_lines{ false }, show_overlay{ true };
+  int32_t* show_pyramid = CVarSystem::get()->get_int_cvar("culling.show_pyramid");
   // debug overlay!
 
   static ImGuiDockNodeFlags dockspace_flags = ImGuiDockNodeFlags_None;
@@ -48,14 +55,24 @@ void Renderer::draw_editor(VkCommandBuffer cmd, VkImageView target)
 
 
   ImGui::Begin("Viewport", NULL);
-    ImGui::Image((ImTextureID) (uint64_t) Engine::get()->m_DrawImage.image_idx, ImGui::GetContentRegionAvail());
+    if (upscale::enabled())
+    {
+      // only the output extent of the output image was written this frame
+      const AllocatedImage& output = engine->m_OutputImage;
+      ImVec2 uv = {(float) engine->m_OutputExtent.width / output.imageExtent.width, (float) engine->m_OutputExtent.height / output.imageExtent.height};
+      ImGui::Image((ImTextureID) (uint64_t) output.texture_idx, ImGui::GetContentRegionAvail(), ImVec2{0, 0}, uv);
+    }
+    else
+    {
+      ImGui::Image((ImTextureID) (uint64_t) Engine::get()->m_DrawImage.image_idx, ImGui::GetContentRegionAvail());
+    }
 
     if (show_overlay)
     {
       const uint32_t lwidth = 15;
       ImVec2 origin = ImGui::GetWindowPos();
       origin.y += ImGui::GetWindowHeight();
-      origin.y -= lwidth*7;
+      origin.y -= lwidth*12;
 
       origin.x += 5;
       origin.y -= 5;
@@ -63,14 +80,23 @@ void Renderer::draw_editor(VkCommandBuffer cmd, VkImageView target)
       ImDrawList* list = ImGui::GetForegroundDrawList();
       ImVec2 extent = ImGui::GetWindowSize();
 
-      list->AddRectFilled({origin.x -5, origin.y -5}, {origin.x + 5 + lwidth*19, origin.y + lwidth*7 + 5}, IM_COL32(5, 45, 5, 135));
+      list->AddRectFilled({origin.x -5, origin.y -5}, {origin.x + 5 + lwidth*19, origin.y + lwidth*12 + 5}, IM_COL32(5, 45, 5, 135));
       list->AddText(origin, IM_COL32(255, 255, 255, 255), "lucerna-dev (pre-alpha)");
       list->AddText({origin.x, origin.y + lwidth*1}, IM_COL32(255, 255, 255, 255), std::format("[instance ver. {}]", engine->stats.instanceVersion).c_str());
       list->AddText({origin.x, origin.y + lwidth*2}, IM_COL32(255, 255, 255, 255), std::format("gpu: {}", engine->stats.gpuName).c_str());
-      list->AddText({origin.x, origin.y + lwidth*3}, IM_COL32(255, 255, 255, 255), std::format("resolution: {}x{}", extent.x, extent.y).c_str());
+      list->AddText({origin.x, origin.y + lwidth*3}, IM_COL32(255, 255, 255, 255), std::format("resolution: {}x{} | internal {}x{} ({:.0f}%)", extent.x, extent.y, engine->m_DrawExtent.width, engine->m_DrawExtent.height, engine->m_RenderScale * 100.0f).c_str());
       list->AddText({origin.x, origin.y + lwidth*4}, IM_COL32(255, 255, 255, 255), std::format("present mode: {}", vkutil::stringify_present_mode(engine->m_Swapchain.presentMode)).c_str());
       list->AddText({origin.x, origin.y + lwidth*5}, IM_COL32(255, 255, 255, 255), std::format("frame: {}", engine->frameNumber).c_str());
       list->AddText({origin.x, origin.y + lwidth*6}, IM_COL32(255, 255, 255, 255), std::format("opaque {} | transparent {}", engine->opaque_set.draw_datas.size(), engine->transparent_set.draw_datas.size()).c_str());
+      for (uint32_t i = 0; const DrawSet* set : {&engine->opaque_set, &engine->transparent_set})
+      {
+        const CullCounters& c = set->stats;
+        list->AddText({origin.x, origin.y + lwidth*(7 + i++)}, IM_COL32(255, 255, 255, 255), std::format("{}: occluded {} | frustum {} | late {}", set->name, c.occlusion_culled, c.frustum_culled, c.late_draws).c_str());
+      }
+      list->AddText({origin.x, origin.y + lwidth*9}, IM_COL32(255, 255, 255, 255), std::format("graph: {} barriers | {} passes culled | {} submissions{}", engine->renderGraph.barrier_batches(), engine->renderGraph.culled_passes(), engine->renderGraph.submissions(), engine->renderGraph.async_compute() ? " (async)" : "").c_str());
+      const TransientPool::Stats& transients = engine->renderGraph.transient_stats();
+      list->AddText({origin.x, origin.y + lwidth*10}, IM_COL32(255, 255, 255, 255), std::format("transient: {:.1f} MB | aliasing saved {:.1f} MB", transients.allocated / (1024.0 * 1024.0), (transients.requested - transients.allocated) / (1024.0 * 1024.0)).c_str());
+      list->AddText({origin.x, origin.y + lwidth*11}, IM_COL32(255, 255, 255, 255), std::format("shadow: {} cascades rendered | cache reused {} frames", engine->stats.shadow_cascades_rendered, engine->stats.shadow_cache_hits).c_str());
     }
   ImGui::End();
   
@@ -100,6 +126,9 @@ void Renderer::draw_editor(VkCommandBuffer cmd, VkImageView target)
       ImGui::MenuItem("Show Overlay", NULL, &show_overlay);
       ImGui::MenuItem("Show Debug Lines", NULL, &show_debug_lines);
       ImGui::MenuItem("Show Collision Shapes", NULL, &show_collision);
+      bool pyramid = *show_pyramid;
+      if (ImGui::MenuItem("Show Depth Pyramid", NULL, &pyramid))
+        *show_pyramid = pyramid;
       ImGui::EndMenu();
     }
     
@@ -135,8 +164,29 @@ void Renderer::draw_editor(VkCommandBuffer cmd, VkImageView target)
 
   
   FrameGraph::render_graph();
+  GpuProfiler::render_panel();
   CVarSystem::get()->draw_editor();
 
+  if (*show_pyramid)
+  {
+    ImGui::Begin("Depth Pyramid");
+      ImGui::SliderInt("level", CVarSystem::get()->get_int_cvar("culling.pyramid_level"), 0, depth_pyramid::levels - 1);
+      ImGui::Text("occlusion culling %s", occlusion_active() ? "active" : "off");
+      for (const DrawSet* set : {&engine->opaque_set, &engine->transparent_set})
+      {
+        const CullCounters& c = set->stats;
+        ImGui::Text("%s: early %u | late %u | occluded %u | outside frustum %u", set->name.c_str(), c.early_draws, c.late_draws, c.occlusion_culled, c.frustum_culled);
+      }
+
+      // the debug texture is base level sized, only the drawn part of it is written
+      VkExtent2D base = depth_pyramid::baseExtent;
+      ImVec2 avail = ImGui::GetContentRegionAvail();
+      float scale = glm::min(avail.x / base.width, avail.y / base.height);
+      ImVec2 uv = {(float) base.width / depth_pyramid::debugImage.imageExtent.width, (float) base.height / depth_pyramid::debugImage.imageExtent.height};
+      ImGui::Image((ImTextureID) (uint64_t) depth_pyramid::debugImage.texture_idx, ImVec2{base.width * scale, base.height * scale}, ImVec2{0, 0}, uv);
+    ImGui::End();
+  }
+
   ImGui::Begin("Texture Picker");
     static int32_t texture_idx = 0;
     ImGui::Text("Bindless Texture Picker");
@@ -155,132 +205,172 @@ void Renderer::draw_editor(VkCommandBuffer cmd, VkImageView target)
 
 
 
-void Renderer::cull_draw_set(VkCommandBuffer cmd, DrawSet& draw_set)
+// gribb & hartmann, planes of the clip volume -w <= x,y <= w, 0 <= z <= w pulled back to world space
+static void frustum_planes(const glm::mat4& viewproj, CullView& view)
+{
+  glm::mat4 m = glm::transpose(viewproj); // rows of viewproj
+  std::array<glm::vec4, 6> planes = {m[3] + m[0], m[3] - m[0], m[3] + m[1], m[3] - m[1], m[2], m[3] - m[2]};
+  for (uint32_t i = 0; i < planes.size(); i++)
+  {
+    view.planes[i] = planes[i] / glm::length(glm::vec3(planes[i]));
+  }
+}
+
+bool Renderer::occlusion_active()
+{
+  return occlusionCulling.get() && Engine::get()->sceneData.proj[2][3] != 0.0f;
+}
+
+void Renderer::cull_draw_set(VkCommandBuffer cmd, DrawSet& draw_set, uint32_t phase, std::span<const glm::mat4> views)
 {
   if (draw_set.draw_datas.size() == 0)
     return;
 
-  vklog::start_debug_label(cmd, draw_set.name.c_str(), MARKER_GREEN);
+  LA_LOG_ASSERT(views.size() <= draw_set.buffers.view_indirect.size(), "{} was given {} cull views but has lists for {}", draw_set.name, views.size(), draw_set.buffers.view_indirect.size());
+  LA_LOG_ASSERT(phase == CULL_PHASE_EARLY || views.empty(), "extra cull views are only culled in the early phase");
+
+  GpuProfiler::begin_scope(cmd, draw_set.name.c_str(), MARKER_GREEN);
   
   DrawContext& mainDrawContext = Engine::get()->mainDrawContext;
   VkDevice device = Engine::get()->device;
   VkDescriptorSetLayout compact_descriptor_layout = Engine::get()->compact_descriptor_layout;
   GPUSceneData sceneData = Engine::get()->sceneData;
   VkPipelineLayout cullPipelineLayout = Engine::get()->cullPipelineLayout;
-  VkPipeline compactPipeline = Engine::get()->compactPipeline;
-  VkPipeline writeIndirectPipeline = Engine::get()->writeIndirectPipeline;
-
-
-   vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, Engine::get()->cullPipeline);
-
-  // this should be part of the mainDrawContext - not allocated every frame etc... its literally only updated once and then can just bind it when u change pipeline
-
-  VkDescriptorSet cullDescriptor = Engine::get()->get_current_frame().frameDescriptors.allocate(device, compact_descriptor_layout);
-  DescriptorWriter writer;
-  writer.write_buffer(0, draw_set.buffers.draw_data.buffer, draw_set.draw_datas.size() * sizeof(DrawData), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER); // FIXME: .buffer .buffer :sob:
-  writer.write_buffer(1, mainDrawContext.sceneBuffers.transformBuffer.buffer, mainDrawContext.transforms.size() * sizeof(glm::mat4x3), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-  writer.write_buffer(2, mainDrawContext.sceneBuffers.boundsBuffer.buffer, mainDrawContext.sphere_bounds.size() * sizeof(glm::vec4) , 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
-  writer.update_set(device, cullDescriptor);
+  bool append = cullCompaction.get() == COMPACTION_APPEND;
+
+  // one per phase, the early and late cull record in parallel
+  PersistentDescriptorSet& cullSet = draw_set.cullSets[Engine::get()->frame_slot() * 2 + phase];
+  uint64_t key = descriptor_key(
+    draw_set.buffers.draw_data.buffer, draw_set.draw_datas.size(),
+    mainDrawContext.sceneBuffers.transformBuffer.buffer, mainDrawContext.transforms.size(),
+    mainDrawContext.sceneBuffers.boundsBuffer.buffer, mainDrawContext.sphere_bounds.size(),
+    depth_pyramid::pyramid.imageView
+  );
+
+  if (cullSet.stale(key))
+  {
+    if (cullSet.set == VK_NULL_HANDLE)
+      cullSet.set = Engine::get()->persistentDescriptors.allocate(device, compact_descriptor_layout);
+
+    DescriptorWriter writer;
+    writer.write_buffer(0, draw_set.buffers.draw_data.buffer, draw_set.draw_datas.size() * sizeof(DrawData), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    writer.write_buffer(1, mainDrawContext.sceneBuffers.transformBuffer.buffer, mainDrawContext.transforms.size() * sizeof(glm::mat4x3), 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    writer.write_buffer(2, mainDrawContext.sceneBuffers.boundsBuffer.buffer, mainDrawContext.sphere_bounds.size() * sizeof(glm::vec4) , 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER);
+    writer.write_image(3, depth_pyramid::pyramid.imageView, depth_pyramid::sampler, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+    writer.update_set(device, cullSet.set);
+    cullSet.key = key;
+  }
+  VkDescriptorSet cullDescriptor = cullSet.set;
   
   indirect_cull_pcs pcs;
   pcs.draw_count = draw_set.draw_datas.size();
+  pcs.view_count = 1 + views.size();
 
-	VkBufferDeviceAddressInfo deviceAdressInfo{.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = draw_set.buffers.indirect_draws.buffer };
-	pcs.ids = (VkDeviceAddress) vkGetBufferDeviceAddress(device, &deviceAdressInfo);
-
-
-  VkBufferDeviceAddressInfo indirectCountBuffer{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = draw_set.buffers.indirect_count.buffer };
-  pcs.indirect_count = (VkDeviceAddress) vkGetBufferDeviceAddress(device, &indirectCountBuffer);
-
-  VkBufferDeviceAddressInfo partialBuff{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = draw_set.buffers.partialSums.buffer };
-  pcs.partial = (VkDeviceAddress) vkGetBufferDeviceAddress(device, &partialBuff);
-
-  VkBufferDeviceAddressInfo outCull{ .sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = draw_set.buffers.outputCompact.buffer };
-  pcs.outb = (VkDeviceAddress) vkGetBufferDeviceAddress(device, &outCull);
-  
-  pcs.view = sceneData.view;
+  // the camera compacts into the list of its phase, every extra view into its own list
+  std::array<const IndirectList*, MAX_CULL_VIEWS> lists{};
+  lists[0] = phase == CULL_PHASE_LATE ? &draw_set.buffers.late_indirect : &draw_set.buffers.indirect;
+  for (uint32_t v = 0; v < views.size(); v++)
+  {
+    lists[1 + v] = &draw_set.buffers.view_indirect[v];
+  }
 
+  auto address = [device](VkBuffer buffer) {
+    VkBufferDeviceAddressInfo info{.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = buffer};
+    return (VkDeviceAddress) vkGetBufferDeviceAddress(device, &info);
+  };
 
-  // dont understand code just do it??
-  glm::mat4 projT = glm::transpose(sceneData.proj);
+  BufferSlice cullViews = Engine::get()->get_current_frame().frameUniforms.allocate(pcs.view_count * sizeof(CullView));
+  CullView* cullView = static_cast<CullView*>(cullViews.data);
+  for (uint32_t v = 0; v < pcs.view_count; v++)
+  {
+    frustum_planes(v == 0 ? sceneData.viewproj : views[v - 1], cullView[v]);
+    cullView[v].ids = address(lists[v]->draws.buffer);
+    cullView[v].indirect_count = address(lists[v]->count.buffer);
+  }
+  pcs.views = cullViews.address;
+  pcs.lookback = address(draw_set.buffers.lookback.buffer);
 
+  uint32_t frameSlot = Engine::get()->frame_slot();
+  CullCounters* counters = static_cast<CullCounters*>(draw_set.buffers.cull_counters.info.pMappedData) + frameSlot;
+  if (phase == CULL_PHASE_EARLY)
+  {
+    // the frame timeline was waited on for this slot, so the late phase that last used it is done
+    draw_set.stats = *counters;
+    *counters = CullCounters{};
+  }
 
-  auto normalise = [](glm::vec4 p){ return p / glm::length(glm::vec3(p)); };
-  
-  glm::vec4 frustumX = normalise(projT[3] + projT[0]);
-  glm::vec4 frustumY = normalise(projT[3] + projT[1]);
+  VkDeviceAddress visibility = address(draw_set.buffers.visibility.buffer);
 
-  pcs.frustum = {frustumX.x, frustumX.z, frustumY.y, frustumY.z};
-  // end
+  // history halves swap every frame, the early phase reads what the late phase of the last frame wrote
+  const VkDeviceSize half = draw_set.draw_datas.size() * sizeof(uint32_t);
+  VkExtent2D extent = Engine::get()->m_DrawExtent;
+  VkExtent2D pyramidSize = depth_pyramid::level_extent(0);
 
+  OcclusionCullData occlusion{};
+  occlusion.view = sceneData.view;
+  occlusion.proj = {sceneData.proj[0][0], glm::abs(sceneData.proj[1][1]), sceneData.proj[2][2], sceneData.proj[3][2]};
+  occlusion.extent = {extent.width, extent.height};
+  occlusion.pyramid_size = {pyramidSize.width, pyramidSize.height};
+  occlusion.znear = *CVarSystem::get()->get_float_cvar("camera.near");
+  occlusion.pyramid_levels = depth_pyramid::levels;
+  occlusion.phase = phase;
+  occlusion.enabled = occlusion_active();
+  uint64_t parity = Engine::get()->frameNumber % 2;
+  occlusion.history_read = visibility + half * (parity ^ 1);
+  occlusion.history_write = visibility + half * parity;
+  occlusion.counters = address(draw_set.buffers.cull_counters.buffer) + frameSlot * sizeof(CullCounters);
 
-  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 1, &cullDescriptor, 0, nullptr);
-	
-  vkCmdPushConstants(cmd, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pcs), &pcs);
-  vkCmdDispatch(cmd, std::ceil(draw_set.draw_datas.size() / 1024.0), 1, 1);
+  pcs.occlusion = Engine::get()->get_current_frame().frameUniforms.push(occlusion).address;
 
 
-  VkBufferMemoryBarrier2 mbar{.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2, .pNext = nullptr};
-  mbar.buffer = draw_set.buffers.partialSums.buffer;
-  mbar.srcAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT;
-  mbar.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
-  mbar.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT;
-  mbar.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
-  mbar.size = VK_WHOLE_SIZE;
-  
-  VkDependencyInfo info{.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO, .pNext = nullptr};
-  info.bufferMemoryBarrierCount = 1;
-  info.pBufferMemoryBarriers = &mbar;
+  // the compaction state is shared by both phases and the indirect buffers may still be read by the last draw
+  {
+    VkMemoryBarrier2 mbar{.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2, .pNext = nullptr};
+    mbar.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+    mbar.srcAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT;
+    mbar.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+    mbar.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT;
 
-  vkCmdPipelineBarrier2(cmd, &info);
+    VkDependencyInfo info{.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO, .pNext = nullptr};
+    info.memoryBarrierCount = 1;
+    info.pMemoryBarriers = &mbar;
+    vkCmdPipelineBarrier2(cmd, &info);
+  }
 
-  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, compactPipeline);
-  
-  vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 1, &cullDescriptor, 0, nullptr);
-  vkCmdPushConstants(cmd, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pcs), &pcs);
-  vkCmdDispatch(cmd, std::ceil(draw_set.draw_datas.size() / 1024.0), 1, 1);
+  // append counts up from 0, look-back needs the group counter and every group state cleared
+  if (append)
+  {
+    for (uint32_t v = 0; v < pcs.view_count; v++)
+    {
+      vkCmdFillBuffer(cmd, lists[v]->count.buffer, 0, VK_WHOLE_SIZE, 0);
+    }
+  }
+  else
+    vkCmdFillBuffer(cmd, draw_set.buffers.lookback.buffer, 0, VK_WHOLE_SIZE, 0);
 
   {
-    VkBufferMemoryBarrier2 mbar{.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2, .pNext = nullptr};
-    mbar.buffer = draw_set.buffers.outputCompact.buffer;
-    mbar.srcAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT;
-    mbar.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
-    mbar.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT;
+    VkMemoryBarrier2 mbar{.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2, .pNext = nullptr};
+    mbar.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+    mbar.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
     mbar.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
-    mbar.size = VK_WHOLE_SIZE;
-  
-    VkDependencyInfo info{.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO, .pNext = nullptr};
-    info.bufferMemoryBarrierCount = 1;
-    info.pBufferMemoryBarriers = &mbar;
+    mbar.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_WRITE_BIT;
 
+    VkDependencyInfo info{.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO, .pNext = nullptr};
+    info.memoryBarrierCount = 1;
+    info.pMemoryBarriers = &mbar;
     vkCmdPipelineBarrier2(cmd, &info);
   }
 
-  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, writeIndirectPipeline);
-
+  // cull and compaction in one dispatch, any number of groups
+  vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, append ? Engine::get()->cullAppendPipeline : Engine::get()->cullPipeline);
   vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 1, &cullDescriptor, 0, nullptr);
   vkCmdPushConstants(cmd, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pcs), &pcs);
-  vkCmdDispatch(cmd, std::ceil(draw_set.draw_datas.size() / 1024.0), 1, 1);
+  vkCmdDispatch(cmd, (draw_set.draw_datas.size() + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
 
-  
-  {
-    VkBufferMemoryBarrier2 mbar{.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2, .pNext = nullptr};
-    mbar.buffer = draw_set.buffers.indirect_draws.buffer;
-    mbar.srcAccessMask = VK_ACCESS_2_SHADER_WRITE_BIT;
-    mbar.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
-    mbar.dstAccessMask = VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT;
-    mbar.dstStageMask = VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT;
-    mbar.size = VK_WHOLE_SIZE;
-  
-    VkDependencyInfo info{.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO, .pNext = nullptr};
-    info.bufferMemoryBarrierCount = 1;
-    info.pBufferMemoryBarriers = &mbar;
-
-    vkCmdPipelineBarrier2(cmd, &info);
-  }
+  // the lists are handed to the indirect draws by the render graph
 
 
-  vklog::end_debug_label(cmd);
+  GpuProfiler::end_scope(cmd);
 
 }
   
@@ -1,5 +1,6 @@
 #pragma once
 #include "vk_types.h"
+#include <span>
 
 namespace Lucerna::Renderer {
     void init();
@@ -14,5 +15,9 @@ namespace Lucerna::Renderer {
     void draw_geometry(VkCommandBuffer cmd);
     void draw_shadow_pass(VkCommandBuffer cmd);
 
-    void cull_draw_set(VkCommandBuffer cmd, DrawSet& draw_set);
+    // phase is CULL_PHASE_EARLY or CULL_PHASE_LATE, the late phase needs the depth pyramid of this frame.
+    // views are extra viewprojs frustum culled in the same early dispatch into buffers.view_indirect[i]
+    void cull_draw_set(VkCommandBuffer cmd, DrawSet& draw_set, uint32_t phase, std::span<const glm::mat4> views = {});
+    // hi-z needs a perspective projection, orthographic views (light view debug) only frustum cull
+    bool occlusion_active();
 } // namespace Lucerna::Renderer
@@ -0,0 +1,236 @@
+#include "scene_cache.h"
+#include "logger.h"
+
+#include <fstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Lucerna {
+
+MappedFile::~MappedFile()
+{
+  close();
+}
+
+bool MappedFile::open(const std::filesystem::path& path)
+{
+  close();
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st{};
+  if (fstat(fd, &st) != 0 || st.st_size == 0)
+  {
+    ::close(fd);
+    return false;
+  }
+
+  void* mapped = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd); // the mapping keeps the file alive
+
+  if (mapped == MAP_FAILED)
+    return false;
+
+  madvise(mapped, st.st_size, MADV_SEQUENTIAL);
+  m_Data = static_cast<const uint8_t*>(mapped);
+  m_Size = st.st_size;
+  return true;
+}
+
+void MappedFile::close()
+{
+  if (m_Data != nullptr)
+  {
+    munmap(const_cast<uint8_t*>(m_Data), m_Size);
+  }
+  m_Data = nullptr;
+  m_Size = 0;
+}
+
+namespace scene_cache {
+
+StringRef Contents::add_string(std::string_view s)
+{
+  StringRef ref{.offset = (uint32_t) strings.size(), .length = (uint32_t) s.size()};
+  strings.append(s);
+  return ref;
+}
+
+std::filesystem::path path_for(const std::filesystem::path& source)
+{
+  std::filesystem::path p = source;
+  p += ".lcache";
+  return p;
+}
+
+std::optional<std::pair<uint64_t, uint64_t>> hash_source(const std::filesystem::path& source)
+{
+  MappedFile file;
+  if (!file.open(source))
+    return {};
+
+  // fnv-1a over 8 byte words, the tail is folded in byte by byte
+  uint64_t hash = 14695981039346656037ull;
+  const size_t words = file.size() / sizeof(uint64_t);
+  for (size_t i = 0; i < words; i++)
+  {
+    uint64_t w;
+    memcpy(&w, file.data() + i * sizeof(uint64_t), sizeof(uint64_t));
+    hash = (hash ^ w) * 1099511628211ull;
+  }
+  for (size_t i = words * sizeof(uint64_t); i < file.size(); i++)
+  {
+    hash = (hash ^ file.data()[i]) * 1099511628211ull;
+  }
+
+  return std::pair{hash, (uint64_t) file.size()};
+}
+
+bool write(const std::filesystem::path& path, uint64_t sourceHash, uint64_t sourceSize, const Contents& contents)
+{
+  Header header{};
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.sourceHash = sourceHash;
+  header.sourceSize = sourceSize;
+
+  uint64_t imageDataSize = 0;
+  for (const std::vector<uint8_t>& pixels : contents.imageData)
+  {
+    imageDataSize += pixels.size();
+  }
+
+  const std::array<uint64_t, SECTION_COUNT> sizes = {
+    contents.positions.size_bytes(),
+    contents.vertices.size_bytes(),
+    contents.indices.size() * sizeof(uint32_t),
+    contents.materials.size_bytes(),
+    contents.materialTextures.size() * sizeof(CachedMaterialTexture),
+    contents.meshes.size() * sizeof(CachedMesh),
+    contents.surfaces.size() * sizeof(GeoSurface),
+    contents.nodes.size() * sizeof(CachedNode),
+    contents.nodeChildren.size() * sizeof(uint32_t),
+    contents.samplers.size() * sizeof(CachedSampler),
+    contents.images.size() * sizeof(CachedImage),
+    imageDataSize,
+    contents.strings.size(),
+  };
+
+  // 16 byte aligned sections so the mapped arrays can be read in place
+  uint64_t offset = (sizeof(Header) + 15) & ~15ull;
+  for (uint32_t s = 0; s < SECTION_COUNT; s++)
+  {
+    header.sections[s] = {.offset = offset, .size = sizes[s]};
+    offset = (offset + sizes[s] + 15) & ~15ull;
+  }
+
+  // written to a temporary first so a crash never leaves a truncated cache that passes the header check
+  std::filesystem::path tmp = path;
+  tmp += ".tmp";
+
+  std::ofstream file{tmp, std::ios::binary | std::ios::trunc};
+  if (!file.is_open())
+  {
+    LA_LOG_WARN("Could not write scene cache {}", path.c_str());
+    return false;
+  }
+
+  const std::array<const void*, SECTION_COUNT> data = {
+    contents.positions.data(),
+    contents.vertices.data(),
+    contents.indices.data(),
+    contents.materials.data(),
+    contents.materialTextures.data(),
+    contents.meshes.data(),
+    contents.surfaces.data(),
+    contents.nodes.data(),
+    contents.nodeChildren.data(),
+    contents.samplers.data(),
+    contents.images.data(),
+    nullptr, // image payloads are written one by one
+    contents.strings.data(),
+  };
+
+  file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+
+  static constexpr std::array<char, 16> zeros{};
+  uint64_t pos = sizeof(Header);
+  for (uint32_t s = 0; s < SECTION_COUNT; s++)
+  {
+    file.write(zeros.data(), header.sections[s].offset - pos);
+
+    if (s == ImageData)
+    {
+      for (const std::vector<uint8_t>& pixels : contents.imageData)
+      {
+        file.write(reinterpret_cast<const char*>(pixels.data()), pixels.size());
+      }
+    }
+    else
+    {
+      file.write(static_cast<const char*>(data[s]), sizes[s]);
+    }
+
+    pos = header.sections[s].offset + sizes[s];
+  }
+
+  file.close();
+  if (file.fail())
+  {
+    LA_LOG_WARN("Failed writing scene cache {}", path.c_str());
+    std::filesystem::remove(tmp);
+    return false;
+  }
+
+  std::error_code ec;
+  std::filesystem::rename(tmp, path, ec);
+  if (ec)
+  {
+    LA_LOG_WARN("Could not move scene cache into place {}", ec.message());
+    return false;
+  }
+
+  LA_LOG_INFO("Wrote scene cache {} ({:.2f} MiB)", path.c_str(), offset / (1024.0f * 1024.0f));
+  return true;
+}
+
+const Header* open(MappedFile& file, const std::filesystem::path& path, uint64_t sourceHash, uint64_t sourceSize)
+{
+  if (!file.open(path))
+    return nullptr;
+
+  if (file.size() < sizeof(Header))
+    return nullptr;
+
+  const Header* header = reinterpret_cast<const Header*>(file.data());
+  if (memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 || header->version != VERSION)
+  {
+    LA_LOG_INFO("Scene cache {} is from an older version, rebuilding", path.c_str());
+    return nullptr;
+  }
+
+  if (header->sourceHash != sourceHash || header->sourceSize != sourceSize)
+  {
+    LA_LOG_INFO("Scene cache {} is stale, rebuilding", path.c_str());
+    return nullptr;
+  }
+
+  for (const SectionRange& r : header->sections)
+  {
+    if (r.offset + r.size > file.size())
+    {
+      LA_LOG_WARN("Scene cache {} is truncated, rebuilding", path.c_str());
+      return nullptr;
+    }
+  }
+
+  return header;
+}
+
+} // namespace scene_cache
+
+} // namespace Lucerna
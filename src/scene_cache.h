@@ -0,0 +1,149 @@
+#pragma once
+#include "lucerna_pch.h"
+#include "vk_types.h"
+
+namespace Lucerna {
+
+// read only memory mapping of a whole file, unmapped on destruction
+class MappedFile
+{
+  public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::filesystem::path& path);
+    void close();
+
+    const uint8_t* data() const { return m_Data; }
+    size_t size() const { return m_Size; }
+  private:
+    const uint8_t* m_Data{ nullptr };
+    size_t m_Size{ 0 };
+};
+
+// binary cache written next to a gltf (scene.glb -> scene.glb.lcache) holding the already converted scene.
+// every section is a flat array of the structs below so loading is a memcpy per section, indices,
+// surfaces and children are relative to the asset and rebased onto the draw context on load
+namespace scene_cache {
+
+  constexpr char MAGIC[4] = {'L', 'S', 'C', 'N'};
+  // bump whenever a cached struct, the section list or the loader conversion changes
+  constexpr uint32_t VERSION = 2; // 2: mesh surface ranges were all written from 0
+
+  enum Section : uint32_t
+  {
+    Positions,        // glm::vec3
+    Vertices,         // Vertex
+    Indices,          // uint32_t, relative to the first vertex of the asset
+    Materials,        // StandardMaterial, albedo is rebuilt from MaterialTextures
+    MaterialTextures, // CachedMaterialTexture
+    Meshes,           // CachedMesh
+    Surfaces,         // GeoSurface, startIndex and mat_idx relative to the asset
+    Nodes,            // CachedNode
+    NodeChildren,     // uint32_t node indices
+    Samplers,         // CachedSampler
+    Images,           // CachedImage
+    ImageData,        // rgba8 payloads
+    Strings,          // names, not null terminated
+    SECTION_COUNT
+  };
+
+  struct SectionRange
+  {
+    uint64_t offset;
+    uint64_t size;
+  };
+
+  struct Header
+  {
+    char magic[4];
+    uint32_t version;
+    uint64_t sourceHash;
+    uint64_t sourceSize;
+    SectionRange sections[SECTION_COUNT];
+  };
+
+  struct StringRef
+  {
+    uint32_t offset;
+    uint32_t length;
+  };
+
+  struct CachedMaterialTexture
+  {
+    int32_t image; // -1 when the material has no base colour texture
+    uint32_t sampler;
+  };
+
+  struct CachedMesh
+  {
+    StringRef name;
+    uint32_t firstSurface;
+    uint32_t surfaceCount;
+  };
+
+  struct CachedNode
+  {
+    glm::mat4 localTransform;
+    StringRef name;
+    int32_t mesh; // -1 for plain nodes
+    uint32_t firstChild;
+    uint32_t childCount;
+  };
+
+  struct CachedSampler
+  {
+    VkFilter magFilter;
+    VkFilter minFilter;
+    VkSamplerMipmapMode mipmapMode;
+  };
+
+  struct CachedImage
+  {
+    StringRef name;
+    uint32_t width;
+    uint32_t height;
+    uint64_t offset; // into ImageData
+    uint64_t size;   // 0 if decoding failed, the placeholder is used instead
+  };
+
+  // everything load_gltf produced for one asset, filled while loading and written on a cache miss
+  struct Contents
+  {
+    std::span<const glm::vec3> positions;
+    std::span<const Vertex> vertices;
+    std::vector<uint32_t> indices;
+    std::span<const StandardMaterial> materials;
+    std::vector<CachedMaterialTexture> materialTextures;
+    std::vector<CachedMesh> meshes;
+    std::vector<GeoSurface> surfaces;
+    std::vector<CachedNode> nodes;
+    std::vector<uint32_t> nodeChildren;
+    std::vector<CachedSampler> samplers;
+    std::vector<CachedImage> images;
+    std::vector<std::vector<uint8_t>> imageData;
+    std::string strings;
+
+    StringRef add_string(std::string_view s);
+  };
+
+  std::filesystem::path path_for(const std::filesystem::path& source);
+  // content hash of the source file, mapped so big glbs dont need a copy
+  std::optional<std::pair<uint64_t, uint64_t>> hash_source(const std::filesystem::path& source);
+
+  bool write(const std::filesystem::path& path, uint64_t sourceHash, uint64_t sourceSize, const Contents& contents);
+  // maps the cache and validates magic, version and source hash. nullptr header when stale or missing
+  const Header* open(MappedFile& file, const std::filesystem::path& path, uint64_t sourceHash, uint64_t sourceSize);
+
+  template<typename T>
+  std::span<const T> section(const MappedFile& file, const Header* header, Section s)
+  {
+    const SectionRange& r = header->sections[s];
+    return {reinterpret_cast<const T*>(file.data() + r.offset), r.size / sizeof(T)};
+  }
+
+} // namespace scene_cache
+
+} // namespace Lucerna
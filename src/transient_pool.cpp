@@ -0,0 +1,180 @@
+#include "transient_pool.h"
+#include "engine.h"
+#include "vk_initialisers.h"
+#include "la_asserts.h"
+#include "logger.h"
+
+#include <numeric>
+
+namespace Lucerna {
+
+void TransientPool::init(VkDevice device, VmaAllocator allocator)
+{
+  this->device = device;
+  this->allocator = allocator;
+}
+
+void TransientPool::destroy()
+{
+  for (Placed& p : placed)
+  {
+    vkDestroyImageView(device, p.image.imageView, nullptr);
+    vkDestroyImage(device, p.image.image, nullptr);
+  }
+  for (VmaAllocation block : blocks)
+  {
+    vmaFreeMemory(allocator, block);
+  }
+
+  placed.clear();
+  blocks.clear();
+  current.clear();
+  currentStats = {};
+}
+
+void TransientPool::release()
+{
+  if (placed.empty())
+    return;
+
+  // the frames in flight may still use them, the current frame is the last one that can
+  std::vector<Placed> images = std::move(placed);
+  std::vector<VmaAllocation> memory = std::move(blocks);
+  VkDevice device = this->device;
+  VmaAllocator allocator = this->allocator;
+
+  Engine::get()->defer_delete([device, allocator, images, memory]() {
+    for (const Placed& p : images)
+    {
+      vkDestroyImageView(device, p.image.imageView, nullptr);
+      vkDestroyImage(device, p.image.image, nullptr);
+    }
+    for (VmaAllocation block : memory)
+    {
+      vmaFreeMemory(allocator, block);
+    }
+  });
+
+  placed.clear();
+  blocks.clear();
+}
+
+bool TransientPool::place(const std::vector<Request>& requests)
+{
+  if (requests == current)
+    return false;
+
+  release();
+  current = requests;
+  currentStats = {};
+  placed.resize(requests.size());
+
+  for (uint32_t i = 0; i < requests.size(); i++)
+  {
+    const Request& r = requests[i];
+    Placed& p = placed[i];
+
+    VkImageCreateInfo imgInfo = vkinit::image_create_info(r.desc.format, r.desc.usage, r.desc.extent);
+    VK_CHECK_RESULT(vkCreateImage(device, &imgInfo, nullptr, &p.image.image));
+    vkGetImageMemoryRequirements(device, p.image.image, &p.requirements);
+    vklog::label_image(device, p.image.image, r.name.c_str());
+
+    p.image.imageExtent = r.desc.extent;
+    p.image.imageFormat = r.desc.format;
+    p.image.allocation = VK_NULL_HANDLE; // shared, owned by the pool
+
+    currentStats.requested += p.requirements.size;
+  }
+
+  // images that can share memory have to agree on the memory type, each set of types gets its own block
+  std::vector<uint32_t> order(requests.size());
+  std::iota(order.begin(), order.end(), 0);
+  // largest first, the small ones fill the gaps
+  std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+    if (placed[a].requirements.memoryTypeBits != placed[b].requirements.memoryTypeBits)
+      return placed[a].requirements.memoryTypeBits < placed[b].requirements.memoryTypeBits;
+    return placed[a].requirements.size > placed[b].requirements.size;
+  });
+
+  std::vector<VkMemoryRequirements> blockRequirements;
+  for (uint32_t n = 0; n < order.size(); n++)
+  {
+    uint32_t i = order[n];
+    Placed& p = placed[i];
+
+    if (blockRequirements.empty() || blockRequirements.back().memoryTypeBits != p.requirements.memoryTypeBits)
+    {
+      blockRequirements.push_back({.size = 0, .alignment = 1, .memoryTypeBits = p.requirements.memoryTypeBits});
+    }
+    p.block = blockRequirements.size() - 1;
+
+    // ranges of the already placed images that are alive at the same time, sorted by offset
+    std::vector<std::pair<VkDeviceSize, VkDeviceSize>> taken;
+    for (uint32_t m = 0; m < n; m++)
+    {
+      const Placed& other = placed[order[m]];
+      bool overlaps = requests[i].first <= requests[order[m]].last && requests[order[m]].first <= requests[i].last;
+      if (other.block == p.block && overlaps)
+        taken.push_back({other.offset, other.offset + other.requirements.size});
+    }
+    std::sort(taken.begin(), taken.end());
+
+    // lowest offset that fits between them
+    VkDeviceSize offset = 0;
+    for (auto [begin, end] : taken)
+    {
+      if (offset + p.requirements.size <= begin)
+        break;
+      if (end > offset)
+        offset = (end + p.requirements.alignment - 1) / p.requirements.alignment * p.requirements.alignment;
+    }
+    p.offset = offset;
+
+    VkMemoryRequirements& block = blockRequirements.back();
+    block.size = std::max(block.size, offset + p.requirements.size);
+    block.alignment = std::max(block.alignment, p.requirements.alignment);
+  }
+
+  for (uint32_t i = 0; i < placed.size(); i++)
+  {
+    for (uint32_t j = 0; j < placed.size(); j++)
+    {
+      const Placed& a = placed[i];
+      const Placed& b = placed[j];
+      bool shared = a.offset < b.offset + b.requirements.size && b.offset < a.offset + a.requirements.size;
+      if (i != j && a.block == b.block && shared)
+        placed[i].aliases.push_back(j);
+    }
+  }
+
+  VmaAllocationCreateInfo allocInfo{};
+  allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+  allocInfo.requiredFlags = VkMemoryPropertyFlags{VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT};
+  allocInfo.flags = VMA_ALLOCATION_CREATE_DEDICATED_MEMORY_BIT;
+
+  blocks.resize(blockRequirements.size());
+  for (uint32_t b = 0; b < blocks.size(); b++)
+  {
+    VK_CHECK_RESULT(vmaAllocateMemory(allocator, &blockRequirements[b], &allocInfo, &blocks[b], nullptr));
+    currentStats.allocated += blockRequirements[b].size;
+  }
+
+  for (uint32_t i = 0; i < placed.size(); i++)
+  {
+    Placed& p = placed[i];
+    VK_CHECK_RESULT(vmaBindImageMemory2(allocator, blocks[p.block], p.offset, p.image.image, nullptr));
+
+    VkImageAspectFlags aspect = p.image.imageFormat == VK_FORMAT_D32_SFLOAT ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+    VkImageViewCreateInfo viewInfo = vkinit::imageview_create_info(p.image.imageFormat, p.image.image, aspect);
+    VK_CHECK_RESULT(vkCreateImageView(device, &viewInfo, nullptr, &p.image.imageView));
+  }
+
+  currentStats.images = placed.size();
+  currentStats.blocks = blocks.size();
+
+  LA_LOG_INFO("Transient pool: {} images, {:.1f} MB placed in {:.1f} MB",
+    currentStats.images, currentStats.requested / (1024.0 * 1024.0), currentStats.allocated / (1024.0 * 1024.0));
+  return true;
+}
+
+} // namespace Lucerna
@@ -0,0 +1,77 @@
+#pragma once
+#include <volk.h>
+#include "lucerna_pch.h"
+#include "vk_types.h"
+
+namespace Lucerna {
+
+struct TransientImageDesc
+{
+  VkExtent3D extent;
+  VkFormat format;
+  VkImageUsageFlags usage;
+
+  bool operator==(const TransientImageDesc& other) const
+  {
+    return extent.width == other.extent.width && extent.height == other.extent.height && extent.depth == other.extent.depth &&
+      format == other.format && usage == other.usage;
+  }
+};
+
+// images that only live between two passes of a frame. every image gets its own VkImage but images whose
+// lifetimes dont overlap are bound to the same range of one large allocation. the placement only changes
+// when the requests do (resolution, passes turned on or off), the old images are freed once the frame is done with them.
+// contents dont survive a frame, whoever uses an image first has to write it.
+class TransientPool
+{
+  public:
+    struct Request
+    {
+      std::string name;
+      TransientImageDesc desc;
+      uint32_t first; // first and last pass that uses it
+      uint32_t last;
+
+      bool operator==(const Request& other) const = default;
+    };
+
+    struct Stats
+    {
+      VkDeviceSize requested{ 0 }; // what the images would take on their own
+      VkDeviceSize allocated{ 0 };
+      uint32_t images{ 0 };
+      uint32_t blocks{ 0 };
+    };
+
+    void init(VkDevice device, VmaAllocator allocator);
+    void destroy();
+
+    // true when the images had to be recreated
+    bool place(const std::vector<Request>& requests);
+
+    const AllocatedImage& image(uint32_t request) const { return placed[request].image; }
+    // requests that share memory with this one, their last use has to finish before this one starts
+    const std::vector<uint32_t>& aliases(uint32_t request) const { return placed[request].aliases; }
+    const Stats& stats() const { return currentStats; }
+  private:
+    struct Placed
+    {
+      AllocatedImage image{};
+      VkMemoryRequirements requirements{};
+      uint32_t block{ 0 };
+      VkDeviceSize offset{ 0 };
+      std::vector<uint32_t> aliases;
+    };
+
+    void release();
+
+    VkDevice device{};
+    VmaAllocator allocator{};
+
+    std::vector<Request> current;
+    std::vector<Placed> placed;
+    std::vector<VmaAllocation> blocks;
+    Stats currentStats{};
+};
+
+} // namespace Lucerna
@@ -0,0 +1,93 @@
+#include "vk_buffers.h"
+#include "logger.h"
+#include "la_asserts.h"
+#include <vulkan/vulkan_core.h>
+
+namespace Lucerna {
+
+void LinearBufferAllocator::init(VkDevice device, VmaAllocator allocator, VkDeviceSize capacity, VkDeviceSize alignment, const char* name, std::vector<uint32_t> queueFamilies)
+{
+  LA_LOG_ASSERT((alignment & (alignment - 1)) == 0, "LinearBufferAllocator alignment must be a power of two");
+
+  this->device = device;
+  this->allocator = allocator;
+  this->alignment = alignment;
+  this->name = name;
+  this->queueFamilies = std::move(queueFamilies);
+  std::sort(this->queueFamilies.begin(), this->queueFamilies.end());
+  this->queueFamilies.erase(std::unique(this->queueFamilies.begin(), this->queueFamilies.end()), this->queueFamilies.end());
+  head = 0;
+  create_buffer(capacity);
+}
+
+void LinearBufferAllocator::create_buffer(VkDeviceSize size)
+{
+  VkBufferCreateInfo bufferInfo{.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO, .pNext = nullptr};
+  bufferInfo.size = size;
+  bufferInfo.usage =
+    VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+    VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+    VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+  if (queueFamilies.size() > 1)
+  {
+    bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+    bufferInfo.queueFamilyIndexCount = queueFamilies.size();
+    bufferInfo.pQueueFamilyIndices = queueFamilies.data();
+  }
+
+  VmaAllocationCreateInfo allocInfo{};
+  allocInfo.usage = VMA_MEMORY_USAGE_CPU_TO_GPU;
+  allocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+  VK_CHECK_RESULT(vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &current.buffer, &current.allocation, &current.info));
+  vklog::label_buffer(device, current.buffer, name.c_str());
+
+  VkBufferDeviceAddressInfo addressInfo{.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, .buffer = current.buffer};
+  baseAddress = vkGetBufferDeviceAddress(device, &addressInfo);
+  capacity = size;
+}
+
+void LinearBufferAllocator::reset()
+{
+  for (auto& b : retired)
+  {
+    vmaDestroyBuffer(allocator, b.buffer, b.allocation);
+  }
+  retired.clear();
+  head = 0;
+}
+
+void LinearBufferAllocator::destroy()
+{
+  reset();
+  vmaDestroyBuffer(allocator, current.buffer, current.allocation);
+  current = {};
+}
+
+BufferSlice LinearBufferAllocator::allocate(VkDeviceSize size)
+{
+  // passes record on several threads
+  std::lock_guard<std::mutex> lock(mutex);
+  VkDeviceSize offset = (head + alignment - 1) & ~(alignment - 1);
+
+  if (offset + size > capacity)
+  {
+    // slices already handed out still point into the old buffer, keep it alive until the frame is reset
+    LA_LOG_WARN("{} out of space ({} bytes), growing", name, capacity);
+    retired.push_back(current);
+    create_buffer(glm::max(capacity * 2, size + alignment));
+    offset = 0;
+  }
+
+  head = offset + size;
+
+  return BufferSlice{
+    .buffer = current.buffer,
+    .offset = offset,
+    .size = size,
+    .data = (uint8_t*) current.info.pMappedData + offset,
+    .address = baseAddress + offset,
+  };
+}
+
+} // namespace Lucerna
@@ -0,0 +1,58 @@
+#pragma once
+#include <volk.h>
+#include "lucerna_pch.h"
+#include "vk_types.h"
+
+#include <mutex>
+
+namespace Lucerna {
+
+// sub range handed out by LinearBufferAllocator, valid until the owning frame is reset
+struct BufferSlice
+{
+  VkBuffer buffer{};
+  VkDeviceSize offset{ 0 };
+  VkDeviceSize size{ 0 };
+  void* data{ nullptr };
+  VkDeviceAddress address{ 0 };
+};
+
+// persistently mapped bump allocator for per frame constants, one per frame in flight.
+// reset once the frame timeline has passed the frame that used it, grows by retiring the old buffer until the next reset.
+// allocate can be called from any thread
+struct LinearBufferAllocator
+{
+  public:
+    // the buffers are shared between the given queue families when there is more than one
+    void init(VkDevice device, VmaAllocator allocator, VkDeviceSize capacity, VkDeviceSize alignment, const char* name, std::vector<uint32_t> queueFamilies = {});
+    void reset();
+    void destroy();
+
+    BufferSlice allocate(VkDeviceSize size);
+
+    template<typename T>
+    BufferSlice push(const T& value)
+    {
+      BufferSlice slice = allocate(sizeof(T));
+      memcpy(slice.data, &value, sizeof(T));
+      return slice;
+    }
+
+    VkDeviceSize used() const { return head; }
+  private:
+    void create_buffer(VkDeviceSize size);
+
+    VkDevice device{};
+    VmaAllocator allocator{};
+    AllocatedBuffer current{};
+    VkDeviceAddress baseAddress{ 0 };
+    VkDeviceSize capacity{ 0 };
+    VkDeviceSize alignment{ 16 };
+    VkDeviceSize head{ 0 };
+    std::string name;
+    std::vector<uint32_t> queueFamilies;
+    std::vector<AllocatedBuffer> retired;
+    std::mutex mutex;
+};
+
+} // namespace Lucerna
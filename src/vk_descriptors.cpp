@@ -132,6 +132,7 @@ void DescriptorAllocatorGrowable::destroy_pools(VkDevice device)
 
 VkDescriptorSet DescriptorAllocatorGrowable::allocate(VkDevice device, VkDescriptorSetLayout layout, void* pNext)
 {
+  std::lock_guard<std::mutex> lock(mutex);
   VkDescriptorPool poolToUse = get_pool(device);
 
   VkDescriptorSetAllocateInfo allocInfo{};
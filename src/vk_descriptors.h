@@ -2,6 +2,8 @@
 #include <volk.h>
 #include "lucerna_pch.h"
 
+#include <mutex>
+
 namespace Lucerna {
 
 struct DescriptorLayoutBuilder
@@ -40,6 +42,7 @@ struct DescriptorAllocatorGrowable
     void init(VkDevice device, uint32_t initialSets, std::span<PoolSizeRatio> poolRatios);
     void clear_pools(VkDevice device);
     void destroy_pools(VkDevice device);
+    // thread safe, passes allocate while recording in parallel
     VkDescriptorSet allocate(VkDevice device, VkDescriptorSetLayout layout, void* pNext = nullptr);
   private:
     VkDescriptorPool get_pool(VkDevice device);
@@ -49,6 +52,7 @@ struct DescriptorAllocatorGrowable
     std::vector<VkDescriptorPool> fullPools;
     std::vector<VkDescriptorPool> readyPools;
     uint32_t setsPerPool;
+    std::mutex mutex;
 };
 
 struct DescriptorWriter
@@ -64,4 +68,23 @@ struct DescriptorWriter
   void update_set(VkDevice device, VkDescriptorSet set);
 };
 
+// set that is written once and only rewritten when a handle it references changes.
+// per frame data goes through dynamic uniform offsets so reusing it is just a bind
+struct PersistentDescriptorSet
+{
+  VkDescriptorSet set{};
+  uint64_t key{ 0 };
+
+  // key should come from descriptor_key() over every handle and range the set is written with
+  bool stale(uint64_t newKey) const { return set == VK_NULL_HANDLE || key != newKey; }
+};
+
+template<typename... Ts>
+uint64_t descriptor_key(Ts... values)
+{
+  uint64_t key = 14695981039346656037ull;
+  ((key = (key ^ (uint64_t) values) * 1099511628211ull), ...);
+  return key;
+}
+
 } // namespace Lucerna
@@ -24,6 +24,7 @@ DeviceContextBuilder::DeviceContextBuilder(VkInstance instance, VkSurfaceKHR sur
   features.f12.runtimeDescriptorArray = VK_TRUE;
   features.f12.bufferDeviceAddress = VK_TRUE;
   features.f12.scalarBlockLayout = VK_TRUE;
+  features.f12.timelineSemaphore = VK_TRUE;
   features.f13.dynamicRendering = VK_TRUE;
   features.f13.synchronization2 = VK_TRUE;
 
@@ -40,6 +41,7 @@ DeviceContextBuilder::DeviceContextBuilder(VkInstance instance, VkSurfaceKHR sur
   LA_LOG_INFO("\truntimeDescriptorArray");
   LA_LOG_INFO("\tbufferDeviceAddress");
   LA_LOG_INFO("\tscalarBlockLayout");
+  LA_LOG_INFO("\ttimelineSemaphore");
   LA_LOG_INFO("\tdynamicRendering");
   LA_LOG_INFO("\tsynchronization2");
 
@@ -69,6 +71,7 @@ bool DeviceContextBuilder::check_feature_support(VkPhysicalDevice device)
     query.f12.runtimeDescriptorArray &&
     query.f12.bufferDeviceAddress &&
     query.f12.scalarBlockLayout &&
+    query.f12.timelineSemaphore &&
     query.f12.drawIndirectCount &&
     query.f13.dynamicRendering &&
     query.f13.synchronization2;
@@ -212,10 +215,18 @@ QueueFamilyIndices DeviceContextBuilder::find_queue_indices(VkPhysicalDevice dev
       indices.graphics = i;
     }
     // NOTE: should this find combined graphics&present,  distinct present, async compute?
-    VkBool32 presentSupport = false;
-    vkGetPhysicalDeviceSurfaceSupportKHR(device, i, m_Surface, &presentSupport);
-    if (presentSupport) {
-      indices.present = i;
+    if (m_Surface == VK_NULL_HANDLE)
+    {
+      // headless has no surface, the graphics queue stands in for present
+      indices.present = indices.graphics;
+    }
+    else
+    {
+      VkBool32 presentSupport = false;
+      vkGetPhysicalDeviceSurfaceSupportKHR(device, i, m_Surface, &presentSupport);
+      if (presentSupport) {
+        indices.present = i;
+      }
     }
 
     if(indices.is_complete())
@@ -223,13 +234,30 @@ QueueFamilyIndices DeviceContextBuilder::find_queue_indices(VkPhysicalDevice dev
   }
   
   LA_ASSERT(indices.is_complete());
+
+  // prefer a family without graphics, those map to the dedicated compute engines. the profiler times every pass so it needs timestamps
+  for (uint32_t i = 0; i < queueFamilyCount; i++)
+  {
+    const VkQueueFamilyProperties& family = queueFamilies[i];
+    if ((family.queueFlags & VK_QUEUE_COMPUTE_BIT) && !(family.queueFlags & VK_QUEUE_GRAPHICS_BIT) && family.timestampValidBits != 0)
+    {
+      indices.compute = i;
+      indices.computeQueue = 0;
+      break;
+    }
+  }
+  if (!indices.compute.has_value() && queueFamilies[indices.graphics.value()].queueCount > 1)
+  {
+    indices.compute = indices.graphics;
+    indices.computeQueue = 1;
+  }
+
   return indices;
 }
 
 DeviceContext DeviceContextBuilder::build()
 {
   LA_ASSERT(m_Instance != VK_NULL_HANDLE);
-  LA_ASSERT(m_Surface != VK_NULL_HANDLE);
   LA_ASSERT(m_RequiredExtensions.size() > 0);
  
   LA_LOG_WARN("Required Device Extensions: ");
@@ -248,17 +276,21 @@ DeviceContext DeviceContextBuilder::build()
   {
     familyIndices.graphics.value(), familyIndices.present.value()
   };
+  if (familyIndices.compute.has_value())
+  {
+    uniqueQueueFamilies.insert(familyIndices.compute.value());
+  }
   std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
   queueCreateInfos.reserve(uniqueQueueFamilies.size());
 
-  float queuePriority = 1.0f;
+  std::array<float, 2> queuePriorities = {1.0f, 1.0f};
   for (uint32_t queueFamily : uniqueQueueFamilies)
   {
     VkDeviceQueueCreateInfo info{};
     info.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
     info.queueFamilyIndex = queueFamily;
-    info.queueCount = 1;
-    info.pQueuePriorities = &queuePriority;
+    info.queueCount = familyIndices.compute == queueFamily ? familyIndices.computeQueue + 1 : 1;
+    info.pQueuePriorities = queuePriorities.data();
     queueCreateInfos.push_back(info);
   }
   
@@ -279,6 +311,17 @@ DeviceContext DeviceContextBuilder::build()
   VK_CHECK_RESULT(vkCreateDevice(physicalDevice, &info, nullptr, &logicalDevice));
   vkGetDeviceQueue(logicalDevice, familyIndices.graphics.value(), 0, &graphicsQueue);
   vkGetDeviceQueue(logicalDevice, familyIndices.present.value(), 0, &presentQueue);
+
+  VkQueue computeQueue{};
+  if (familyIndices.compute.has_value())
+  {
+    vkGetDeviceQueue(logicalDevice, familyIndices.compute.value(), familyIndices.computeQueue, &computeQueue);
+    LA_LOG_INFO("Async compute on queue family {} (queue {})", familyIndices.compute.value(), familyIndices.computeQueue);
+  }
+  else
+  {
+    LA_LOG_WARN("No queue for async compute, everything runs on the graphics queue");
+  }
    
   volkLoadDevice(logicalDevice);
 
@@ -289,8 +332,10 @@ DeviceContext DeviceContextBuilder::build()
     .indices = familyIndices,
     .graphics = graphicsQueue,
     .present = presentQueue,
+    .compute = computeQueue,
     .graphicsIndex = familyIndices.graphics.value(),
     .presentIndex = familyIndices.present.value(),
+    .computeIndex = familyIndices.compute.value_or(familyIndices.graphics.value()),
   };
 }
 
@@ -8,6 +8,8 @@ namespace Lucerna {
   {
     std::optional<uint32_t> graphics;
     std::optional<uint32_t> present;
+    std::optional<uint32_t> compute; // async compute, a compute only family or a second queue of the graphics one
+    uint32_t computeQueue{ 0 };      // index of the queue inside the compute family
     bool is_complete() {
       return graphics.has_value() && present.has_value();
     }
@@ -47,8 +49,10 @@ namespace Lucerna {
       QueueFamilyIndices indices{};
       VkQueue graphics{};
       VkQueue present{};
+      VkQueue compute{}; // null when the device has no queue to run compute next to graphics
       uint32_t graphicsIndex{};
       uint32_t presentIndex{};
+      uint32_t computeIndex{};
   };
   
   class DeviceContextBuilder 
@@ -23,6 +23,8 @@
 
 #include <volk.h>
 #include "vk_pipelines.h"
+#include "job_system.h"
+#include "scene_cache.h"
 
 namespace Lucerna
 
@@ -43,15 +45,11 @@ glm::vec2 enconde_normal(glm::vec3 n) {
 	return glm::vec2(n.x, n.y);
 }
 
-// FIXME: repeated vertex info buffers if meshes r repeated...
-std::optional<std::shared_ptr<LoadedGLTF>> load_gltf(Engine* engine, std::filesystem::path filepath)
-{
-  LA_LOG_INFO("Started loading GLTF Scene at {}", filepath.c_str());
+AutoCVar_Int loaderThreads("loader.threads", "threads used to decode gltf primitives, 0 uses every worker", 0);
+AutoCVar_Int loaderSceneCache("loader.scene_cache", "load scenes from a binary cache next to the gltf, written on the first load", 1, CVarFlags::EditCheckbox);
 
-  std::shared_ptr<LoadedGLTF> scene = std::make_shared<LoadedGLTF>();
-  scene->creator = engine;
-  LoadedGLTF& file = *scene.get();
-      
+static std::optional<fastgltf::Asset> parse_gltf(const std::filesystem::path& filepath)
+{
   constexpr auto gltfOptions = fastgltf::Options::DontRequireValidAssetMember | fastgltf::Options::AllowDouble | fastgltf::Options::LoadExternalBuffers;
   fastgltf::Parser parser(fastgltf::Extensions::KHR_materials_emissive_strength | fastgltf::Extensions::KHR_texture_transform);
   auto data = fastgltf::GltfDataBuffer::FromPath(filepath);
@@ -70,66 +68,446 @@ std::optional<std::shared_ptr<LoadedGLTF>> load_gltf(Engine* engine, std::filesy
     return {};
   }
 
-  fastgltf::Asset& asset = asset_exp.get();
-  
+  return std::move(asset_exp.get());
+}
 
-  // storage and sampled images are uploaded in bulk but samplers are done one by one? then uint32_t where 8 bytes indexes into the bindless sampler descriptor array
-  // and the other bits sampler into the textures
-  for (fastgltf::Sampler& sampler : asset.samplers)
+// where a primitive lands in the global index/vertex arrays, filled in before any decoding happens
+struct PrimitiveRange
+{
+  fastgltf::Primitive* primitive;
+  uint32_t firstIndex, indexCount;
+  uint32_t firstVertex, vertexCount;
+  Bounds bounds;
+};
+
+static std::vector<PrimitiveRange> plan_primitives(fastgltf::Asset& asset, size_t& indexCount, size_t& vertexCount)
+{
+  std::vector<PrimitiveRange> ranges;
+  for (fastgltf::Mesh& mesh : asset.meshes)
+  {
+    for (fastgltf::Primitive& p : mesh.primitives)
+    {
+      PrimitiveRange range{.primitive = &p};
+      range.firstIndex = static_cast<uint32_t>(indexCount);
+      range.indexCount = static_cast<uint32_t>(asset.accessors[p.indicesAccessor.value()].count);
+      range.firstVertex = static_cast<uint32_t>(vertexCount);
+      range.vertexCount = static_cast<uint32_t>(asset.accessors[p.findAttribute("POSITION")->accessorIndex].count);
+
+      indexCount += range.indexCount;
+      vertexCount += range.vertexCount;
+      ranges.push_back(range);
+    }
+  }
+  return ranges;
+}
+
+static void decode_primitive(fastgltf::Asset& asset, PrimitiveRange& range, uint32_t* indices, Vertex* vertices, glm::vec3* positions)
+{
+  fastgltf::Primitive& p = *range.primitive;
+  const size_t initial_vtx = range.firstVertex;
+
+  {
+    fastgltf::Accessor& indexaccessor = asset.accessors[p.indicesAccessor.value()];
+    fastgltf::iterateAccessorWithIndex<std::uint32_t>(asset, indexaccessor,
+      [&](std::uint32_t idx, size_t index) {
+          indices[range.firstIndex + index] = idx + initial_vtx;
+      });
+  }
+
+  {
+    fastgltf::Accessor& posAccessor = asset.accessors[p.findAttribute("POSITION")->accessorIndex];
+    auto lambda = [&](glm::vec3 v, size_t index) {
+      Vertex newvtx;
+      newvtx.normal_uv = {1, 0, 0, 0};
+      newvtx.color = glm::vec4{1.0f};
+      vertices[initial_vtx + index] = newvtx;
+      positions[initial_vtx + index] = v;
+    };
+
+    fastgltf::iterateAccessorWithIndex<glm::vec3>(asset, posAccessor, lambda);
+  }
+
+  auto normals = p.findAttribute("NORMAL");
+  if (normals != p.attributes.end())
+  {
+    auto lambda = [&](glm::vec3 v, size_t index) {
+      glm::vec2 normal = enconde_normal(v);
+      vertices[initial_vtx + index].normal_uv = {normal.x, normal.y, 0, 0};
+    };
+
+     fastgltf::iterateAccessorWithIndex<glm::vec3>(asset, asset.accessors[(*normals).accessorIndex], lambda);
+  }
+
+  auto uv = p.findAttribute("TEXCOORD_0");
+  if (uv != p.attributes.end())
+  {
+    auto lambda = [&](glm::vec2 v, size_t index) {
+      vertices[initial_vtx + index].normal_uv.z = v.x;
+      vertices[initial_vtx + index].normal_uv.w = v.y;
+    };
+
+     fastgltf::iterateAccessorWithIndex<glm::vec2>(asset, asset.accessors[(*uv).accessorIndex], lambda);
+  }
+
+  auto colors = p.findAttribute("COLOR_O");
+  if (colors != p.attributes.end())
+  {
+    auto lambda = [&](glm::vec4 v, size_t index) {
+      vertices[initial_vtx + index].color = v;
+    };
+
+     fastgltf::iterateAccessorWithIndex<glm::vec4>(asset, asset.accessors[(*colors).accessorIndex], lambda);
+  }
+
+  if (range.vertexCount == 0)
+    return;
+
+  // calculate origin and extents from the min/max, use extent lenght for radius
+  glm::vec3  minpos = positions[initial_vtx];
+  glm::vec3  maxpos = positions[initial_vtx];
+  for (size_t i = initial_vtx; i < initial_vtx + range.vertexCount; i++) {
+      minpos = glm::min(minpos, positions[i]);
+      maxpos = glm::max(maxpos, positions[i]);
+  }
+
+  range.bounds.origin = (maxpos + minpos) / 2.f;
+  range.bounds.extents = (maxpos - minpos) / 2.f;
+  range.bounds.sphereRadius = glm::length(range.bounds.extents);
+}
+
+// threads = 0 uses every job system thread
+static void decode_primitives(fastgltf::Asset& asset, std::vector<PrimitiveRange>& ranges, uint32_t* indices, Vertex* vertices, glm::vec3* positions, uint32_t threads)
+{
+  JobSystem::parallel_for(
+    ranges.size(),
+    [&](uint32_t i) { decode_primitive(asset, ranges[i], indices, vertices, positions); },
+    threads == 0 ? UINT32_MAX : threads
+  );
+}
+
+static VkSampler create_sampler(Engine* engine, const scene_cache::CachedSampler& desc)
+{
+  VkSamplerCreateInfo sampl{};
+  sampl.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+  sampl.pNext = nullptr;
+  sampl.maxLod = VK_LOD_CLAMP_NONE;
+  sampl.minLod = 0;
+  sampl.magFilter = desc.magFilter;
+  sampl.minFilter = desc.minFilter;
+
+  sampl.mipmapMode = desc.mipmapMode;
+  VkSampler newSampler;
+  vkCreateSampler(engine->device, &sampl, nullptr, &newSampler);
+
+
+  VkWriteDescriptorSet w{.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, .pNext = nullptr};
+  w.dstSet = engine->bindless_descriptor_set;
+  w.descriptorCount = 1;
+  w.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+  w.dstArrayElement = engine->samplerCounter;
+  w.dstBinding = engine->SAMPLER_BINDING;
+
+  VkDescriptorImageInfo info{};
+  info.sampler = newSampler;
+  w.pImageInfo = &info;
+  vkUpdateDescriptorSets(engine->device, 1, &w, 0, nullptr);
+
+  engine->samplerCounter++;
+  return newSampler;
+}
+
+// every index the cache stores has to land inside the sections it points into, open only checks the sections
+// fit the file. ranges are summed in 64 bits so a corrupt count cant wrap around
+static bool validate_cached_scene(const MappedFile& mapped, const scene_cache::Header* header)
+{
+  using namespace scene_cache;
+
+  const uint64_t stringBytes = header->sections[Strings].size;
+  auto string_ok = [&](StringRef ref) { return (uint64_t) ref.offset + ref.length <= stringBytes; };
+
+  std::span<const CachedImage> images = section<CachedImage>(mapped, header, Images);
+  for (const CachedImage& img : images)
+  {
+    if (!string_ok(img.name) || img.offset + img.size > header->sections[ImageData].size ||
+        (img.size != 0 && img.size != (uint64_t) img.width * img.height * 4))
+      return false;
+  }
+
+  std::span<const StandardMaterial> materials = section<StandardMaterial>(mapped, header, Materials);
+  std::span<const CachedMaterialTexture> textures = section<CachedMaterialTexture>(mapped, header, MaterialTextures);
+  if (textures.size() > materials.size())
+    return false;
+  for (const CachedMaterialTexture& texture : textures)
+  {
+    if (texture.image >= (int64_t) images.size())
+      return false;
+  }
+
+  const uint64_t vertexCount = section<Vertex>(mapped, header, Vertices).size();
+  if (section<glm::vec3>(mapped, header, Positions).size() != vertexCount)
+    return false;
+  std::span<const uint32_t> indices = section<uint32_t>(mapped, header, Indices);
+  for (uint32_t index : indices)
+  {
+    if (index >= vertexCount)
+      return false;
+  }
+
+  std::span<const GeoSurface> surfaces = section<GeoSurface>(mapped, header, Surfaces);
+  for (const GeoSurface& surface : surfaces)
+  {
+    if ((uint64_t) surface.startIndex + surface.count > indices.size() || surface.mat_idx >= materials.size())
+      return false;
+  }
+
+  std::span<const CachedMesh> meshes = section<CachedMesh>(mapped, header, Meshes);
+  for (const CachedMesh& mesh : meshes)
+  {
+    if (!string_ok(mesh.name) || (uint64_t) mesh.firstSurface + mesh.surfaceCount > surfaces.size())
+      return false;
+  }
+
+  std::span<const CachedNode> nodes = section<CachedNode>(mapped, header, Nodes);
+  std::span<const uint32_t> children = section<uint32_t>(mapped, header, NodeChildren);
+  for (const CachedNode& node : nodes)
+  {
+    if (!string_ok(node.name) || node.mesh >= (int64_t) meshes.size() ||
+        (uint64_t) node.firstChild + node.childCount > children.size())
+      return false;
+  }
+  for (uint32_t c : children)
+  {
+    if (c >= nodes.size())
+      return false;
+  }
+
+  return true;
+}
+
+// rebuilds what load_gltf would produce straight from a mapped scene cache, geometry is appended to the
+// draw context with one copy per section and image payloads go from the mapping into the upload batch.
+// false before anything is created when the cache does not hold together, the caller parses the gltf instead
+static bool load_cached_scene(Engine* engine, LoadedGLTF& file, const MappedFile& mapped, const scene_cache::Header* header)
+{
+  using namespace scene_cache;
+
+  if (!validate_cached_scene(mapped, header))
+    return false;
+
+  DrawContext& ctx = engine->mainDrawContext;
+  std::span<const char> strings = section<char>(mapped, header, Strings);
+  auto name = [&](StringRef ref) { return std::string(strings.data() + ref.offset, ref.length); };
+
+  for (const CachedSampler& desc : section<CachedSampler>(mapped, header, Samplers))
+  {
+    file.samplers.push_back(create_sampler(engine, desc));
+  }
+
+  std::span<const CachedImage> cachedImages = section<CachedImage>(mapped, header, Images);
+  const uint8_t* imageData = mapped.data() + header->sections[ImageData].offset;
+  std::vector<AllocatedImage> images(cachedImages.size());
+
+  JobSystem::parallel_for(cachedImages.size(), [&](uint32_t i) {
+    const CachedImage& img = cachedImages[i];
+    if (img.size == 0)
+    {
+      images[i] = engine->m_ErrorCheckerboardImage;
+      return;
+    }
+
+    // mips are not cached, they are regenerated by the upload batch same as a fresh load
+    images[i] = engine->create_image(
+      const_cast<uint8_t*>(imageData + img.offset), VkExtent3D{img.width, img.height, 1},
+      VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_SAMPLED_BIT, true
+    );
+  });
+
+  for (size_t i = 0; i < cachedImages.size(); i++)
+  {
+    if (cachedImages[i].size != 0)
+    {
+      file.images[name(cachedImages[i].name)] = images[i];
+    }
+    else
+    {
+      LA_LOG_WARN("Failed to load a texture from GLTF, (using placeholder)");
+    }
+  }
+
+  // texture indices are only known now, patch them into the cached materials
+  std::span<const StandardMaterial> materials = section<StandardMaterial>(mapped, header, Materials);
+  std::span<const CachedMaterialTexture> textures = section<CachedMaterialTexture>(mapped, header, MaterialTextures);
+  const uint32_t matBase = ctx.standard_materials.size();
+  ctx.standard_materials.insert(ctx.standard_materials.end(), materials.begin(), materials.end());
+  for (size_t m = 0; m < textures.size(); m++)
+  {
+    if (textures[m].image >= 0)
+    {
+      ctx.standard_materials[matBase + m].albedo = images[textures[m].image].texture_idx + (textures[m].sampler << 24);
+    }
+  }
+
+  std::span<const glm::vec3> positions = section<glm::vec3>(mapped, header, Positions);
+  std::span<const Vertex> vertices = section<Vertex>(mapped, header, Vertices);
+  std::span<const uint32_t> indices = section<uint32_t>(mapped, header, Indices);
+
+  const uint32_t vertexBase = ctx.vertices.size(), indexBase = ctx.indices.size();
+  ctx.positions.insert(ctx.positions.end(), positions.begin(), positions.end());
+  ctx.vertices.insert(ctx.vertices.end(), vertices.begin(), vertices.end());
+  ctx.indices.resize(indexBase + indices.size());
+  for (size_t i = 0; i < indices.size(); i++)
+  {
+    ctx.indices[indexBase + i] = indices[i] + vertexBase;
+  }
+
+  std::span<const GeoSurface> surfaces = section<GeoSurface>(mapped, header, Surfaces);
+  std::vector<std::shared_ptr<MeshAsset>> meshes;
+  for (const CachedMesh& mesh : section<CachedMesh>(mapped, header, Meshes))
+  {
+    std::shared_ptr<MeshAsset> newmesh = std::make_shared<MeshAsset>();
+    meshes.push_back(newmesh);
+    newmesh->name = name(mesh.name);
+    file.meshes[newmesh->name] = newmesh;
+
+    for (GeoSurface surface : surfaces.subspan(mesh.firstSurface, mesh.surfaceCount))
+    {
+      surface.startIndex += indexBase;
+      surface.mat_idx += matBase;
+      newmesh->surfaces.push_back(surface);
+    }
+  }
+
+  std::span<const CachedNode> cachedNodes = section<CachedNode>(mapped, header, Nodes);
+  std::span<const uint32_t> children = section<uint32_t>(mapped, header, NodeChildren);
+  std::vector<std::shared_ptr<Node>> nodes;
+  for (const CachedNode& node : cachedNodes)
+  {
+    std::shared_ptr<Node> newNode;
+    if (node.mesh >= 0)
+    {
+      newNode = std::make_shared<MeshNode>();
+      static_cast<MeshNode*>(newNode.get())->mesh = meshes[node.mesh];
+    }
+    else
+    {
+      newNode = std::make_shared<Node>();
+    }
+
+    newNode->localTransform = node.localTransform;
+    nodes.push_back(newNode);
+    file.nodes[name(node.name)];
+  }
+
+  for (size_t i = 0; i < cachedNodes.size(); i++)
+  {
+    for (uint32_t c : children.subspan(cachedNodes[i].firstChild, cachedNodes[i].childCount))
+    {
+      nodes[i]->children.push_back(nodes[c]);
+      nodes[c]->parent = nodes[i];
+    }
+  }
+
+  for (auto& node : nodes)
   {
-    VkSamplerCreateInfo sampl{};
-    sampl.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
-    sampl.pNext = nullptr;
-    sampl.maxLod = VK_LOD_CLAMP_NONE;
-    sampl.minLod = 0;
-    sampl.magFilter = extract_filter(sampler.magFilter.value_or(fastgltf::Filter::Nearest));
-    sampl.minFilter = extract_filter(sampler.minFilter.value_or(fastgltf::Filter::Nearest));
+    if (node->parent.lock() == nullptr)
+    {
+      file.topNodes.push_back(node);
+      node->refresh_transform(glm::mat4{1.0f});
+    }
+  }
+  return true;
+}
+
+// FIXME: repeated vertex info buffers if meshes r repeated...
+std::optional<std::shared_ptr<LoadedGLTF>> load_gltf(Engine* engine, std::filesystem::path filepath)
+{
+  LA_LOG_INFO("Started loading GLTF Scene at {}", filepath.c_str());
+
+  std::shared_ptr<LoadedGLTF> scene = std::make_shared<LoadedGLTF>();
+  scene->creator = engine;
+  LoadedGLTF& file = *scene.get();
 
-    sampl.mipmapMode = extract_mipmap_mode(sampler.minFilter.value_or(fastgltf::Filter::Nearest));
-    VkSampler newSampler;
-    vkCreateSampler(engine->device, &sampl, nullptr, &newSampler);
+  // hashing the source is far cheaper than parsing it, a matching cache skips fastgltf entirely
+  std::optional<std::pair<uint64_t, uint64_t>> source;
+  const std::filesystem::path cachePath = scene_cache::path_for(filepath);
+  if (loaderSceneCache.get())
+  {
+    source = scene_cache::hash_source(filepath);
 
+    MappedFile mapped;
+    const scene_cache::Header* header = source.has_value() ? scene_cache::open(mapped, cachePath, source->first, source->second) : nullptr;
+    if (header != nullptr)
+    {
+      auto start = std::chrono::high_resolution_clock::now();
+      if (load_cached_scene(engine, file, mapped, header))
+      {
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start);
+        LA_LOG_INFO("Finished loading {} from scene cache in {:.2f}ms", filepath.c_str(), elapsed.count() / 1000.0f);
+        return scene;
+      }
+      LA_LOG_WARN("Scene cache {} has out of range indices, rebuilding", cachePath.c_str());
+    }
+  }
 
-    VkWriteDescriptorSet w{.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET, .pNext = nullptr};
-    w.dstSet = engine->bindless_descriptor_set;
-    w.descriptorCount = 1;
-    w.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
-    w.dstArrayElement = engine->samplerCounter;
-    w.dstBinding = engine->SAMPLER_BINDING;
+  scene_cache::Contents cache;
+      
+  std::optional<fastgltf::Asset> parsed = parse_gltf(filepath);
+  if (!parsed.has_value())
+  {
+    return {};
+  }
 
-    VkDescriptorImageInfo info{};
-    info.sampler = newSampler;
-    w.pImageInfo = &info;
-    vkUpdateDescriptorSets(engine->device, 1, &w, 0, nullptr);
+  fastgltf::Asset& asset = *parsed;
+  
 
-    engine->samplerCounter++;
-    file.samplers.push_back(newSampler);
+  // storage and sampled images are uploaded in bulk but samplers are done one by one? then uint32_t where 8 bytes indexes into the bindless sampler descriptor array
+  // and the other bits sampler into the textures
+  for (fastgltf::Sampler& sampler : asset.samplers)
+  {
+    scene_cache::CachedSampler desc{
+      .magFilter = extract_filter(sampler.magFilter.value_or(fastgltf::Filter::Nearest)),
+      .minFilter = extract_filter(sampler.minFilter.value_or(fastgltf::Filter::Nearest)),
+      .mipmapMode = extract_mipmap_mode(sampler.minFilter.value_or(fastgltf::Filter::Nearest)),
+    };
+    file.samplers.push_back(create_sampler(engine, desc));
+    cache.samplers.push_back(desc);
   }
 
   std::vector<std::shared_ptr<MeshAsset>> meshes;
   std::vector<std::shared_ptr<Node>> nodes;
-  std::vector<AllocatedImage> images;
+  std::vector<AllocatedImage> images(asset.images.size());
+  std::vector<uint8_t> loaded(asset.images.size()); // not vector<bool>, the workers write neighbouring elements
+  std::vector<DecodedImage> decoded(source.has_value() ? asset.images.size() : 0);
   
-  for (fastgltf::Image& image : asset.images)
+  // decode on the workers, each image reserves its bindless slot and goes into the upload batch as soon as its done
+  auto imageStart = std::chrono::high_resolution_clock::now();
+  JobSystem::parallel_for(asset.images.size(), [&](uint32_t i) {
+    std::optional<AllocatedImage> img = load_image(engine, asset, asset.images[i], filepath, decoded.empty() ? nullptr : &decoded[i]);
+    loaded[i] = img.has_value();
+    images[i] = img.value_or(engine->m_ErrorCheckerboardImage);
+  });
+  auto imageElapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - imageStart);
+  LA_LOG_INFO("Decoded {} images in {:.2f}ms", asset.images.size(), imageElapsed.count() / 1000.0f);
+
+  for (size_t i = 0; i < asset.images.size(); i++)
   {
-    std::optional<AllocatedImage> img = load_image(engine, asset, image, filepath);
-    if (img.has_value())
+    if (loaded[i])
     {
-      images.push_back(*img);
-      file.images[image.name.c_str()] = *img;
+      file.images[asset.images[i].name.c_str()] = images[i];
     }
     else
     {
-      images.push_back(engine->m_ErrorCheckerboardImage);
       LA_LOG_WARN("Failed to load a texture from GLTF, (using placeholder)");
     }
   }
 
   std::vector<uint32_t> mat_idxs;
+  const uint32_t matBase = engine->mainDrawContext.standard_materials.size();
   
   for (fastgltf::Material& mat : asset.materials)
   {
-    StandardMaterial m;
+    StandardMaterial m{};
+    scene_cache::CachedMaterialTexture texture{.image = -1};
     if (mat.pbrData.baseColorTexture.has_value())
     {
       
@@ -139,8 +517,10 @@ std::optional<std::shared_ptr<LoadedGLTF>> load_gltf(Engine* engine, std::filesy
       AllocatedImage i  = images[img];
 
       m.albedo = i.texture_idx + (sampler << 24);
+      texture = {.image = (int32_t) img, .sampler = (uint32_t) sampler};
      
     }
+    cache.materialTextures.push_back(texture);
     m.modulate = {mat.pbrData.baseColorFactor.x(), mat.pbrData.baseColorFactor.y(), mat.pbrData.baseColorFactor.z()};
 
     m.emissions = {glm::vec3(mat.emissiveFactor.x(), mat.emissiveFactor.y(), mat.emissiveFactor.z())};
@@ -165,7 +545,22 @@ std::optional<std::shared_ptr<LoadedGLTF>> load_gltf(Engine* engine, std::filesy
   std::vector<uint32_t>& indices = engine->mainDrawContext.indices;
   std::vector<Vertex>& vertices = engine->mainDrawContext.vertices;
   std::vector<glm::vec3>& positions = engine->mainDrawContext.positions;
-  
+
+  // phase 1: every primitive gets its final range in the global arrays up front
+  const uint32_t indexBase = indices.size(), vertexBase = vertices.size();
+  size_t indexCount = indexBase, vertexCount = vertexBase;
+  std::vector<PrimitiveRange> ranges = plan_primitives(asset, indexCount, vertexCount);
+  indices.resize(indexCount);
+  vertices.resize(vertexCount);
+  positions.resize(vertexCount);
+
+  // phase 2: primitives only touch their own ranges so they decode in parallel
+  auto start = std::chrono::high_resolution_clock::now();
+  decode_primitives(asset, ranges, indices.data(), vertices.data(), positions.data(), loaderThreads.get());
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start);
+  LA_LOG_INFO("Decoded {} primitives in {:.2f}ms", ranges.size(), elapsed.count() / 1000.0f);
+
+  size_t r = 0;
   for(fastgltf::Mesh& mesh : asset.meshes)
   {
     std::shared_ptr<MeshAsset> newmesh = std::make_shared<MeshAsset>();
@@ -176,6 +571,7 @@ std::optional<std::shared_ptr<LoadedGLTF>> load_gltf(Engine* engine, std::filesy
     
     for (auto&& p : mesh.primitives)
     {
+      const PrimitiveRange& range = ranges[r++];
       GeoSurface newSurface{};
 
       if (p.materialIndex.has_value())
@@ -188,84 +584,10 @@ std::optional<std::shared_ptr<LoadedGLTF>> load_gltf(Engine* engine, std::filesy
         newSurface.mat_idx = mat_idxs[0];
       }
      
-      newSurface.startIndex = static_cast<uint32_t>(indices.size());
-      newSurface.count = static_cast<uint32_t>(asset.accessors[p.indicesAccessor.value()].count);
-
-      size_t initial_vtx = vertices.size();
-      
-      {
-        fastgltf::Accessor& indexaccessor = asset.accessors[p.indicesAccessor.value()];
-        indices.reserve(indices.size() + indexaccessor.count);
-
-        fastgltf::iterateAccessor<std::uint32_t>(asset, indexaccessor,
-          [&](std::uint32_t idx) {
-              indices.push_back(idx + initial_vtx);
-          });
-      }
-
-
-      {
-        fastgltf::Accessor& posAccessor = asset.accessors[p.findAttribute("POSITION")->accessorIndex];
-        vertices.resize(vertices.size() + posAccessor.count);
-        positions.resize(positions.size() + posAccessor.count);
-        
-        auto lambda = [&](glm::vec3 v, size_t index) {
-          Vertex newvtx;
-          newvtx.normal_uv = {1, 0, 0, 0};
-          newvtx.color = glm::vec4{1.0f};
-          vertices[initial_vtx + index] = newvtx;
-          positions[initial_vtx + index] = v;
-        };
-
-        fastgltf::iterateAccessorWithIndex<glm::vec3>(asset, posAccessor, lambda);
-      }
-
-      auto normals = p.findAttribute("NORMAL");
-      if (normals != p.attributes.end())
-      {
-        auto lambda = [&](glm::vec3 v, size_t index) {
-          glm::vec2 normal = enconde_normal(v);
-          vertices[initial_vtx + index].normal_uv = {normal.x, normal.y, 0, 0};
-        };
-
-         fastgltf::iterateAccessorWithIndex<glm::vec3>(asset, asset.accessors[(*normals).accessorIndex], lambda);
-      }
-
-      auto uv = p.findAttribute("TEXCOORD_0");
-      if (uv != p.attributes.end())
-      {
-        auto lambda = [&](glm::vec2 v, size_t index) {
-          vertices[initial_vtx + index].normal_uv.z = v.x;
-          vertices[initial_vtx + index].normal_uv.w = v.y;
-        };
-
-         fastgltf::iterateAccessorWithIndex<glm::vec2>(asset, asset.accessors[(*uv).accessorIndex], lambda);
-      }
-
-      auto colors = p.findAttribute("COLOR_O");
-      if (colors != p.attributes.end())
-      {
-        auto lambda = [&](glm::vec4 v, size_t index) {
-          vertices[initial_vtx + index].color = v;
-        };
-
-         fastgltf::iterateAccessorWithIndex<glm::vec4>(asset, asset.accessors[(*colors).accessorIndex], lambda);
-      }
-
-
-      glm::vec3  minpos = positions[initial_vtx];
-      glm::vec3  maxpos = positions[initial_vtx];
-      for (int i = initial_vtx; i < positions.size(); i++) {
-          minpos = glm::min(minpos, positions[i]);
-          maxpos = glm::max(maxpos, positions[i]);
-      }
-
-      newSurface.bounds.origin = (maxpos + minpos) / 2.f;
-      newSurface.bounds.extents = (maxpos - minpos) / 2.f;
-      newSurface.bounds.sphereRadius = glm::length(newSurface.bounds.extents);
-      // calculate origin and extents from the min/max, use extent lenght for radius
+      newSurface.startIndex = range.firstIndex;
+      newSurface.count = range.indexCount;
+      newSurface.bounds = range.bounds;
       newmesh->surfaces.push_back(newSurface);
-      
     }
   }
 
@@ -331,10 +653,137 @@ std::optional<std::shared_ptr<LoadedGLTF>> load_gltf(Engine* engine, std::filesy
     }
   }
 
+  if (source.has_value())
+  {
+    DrawContext& ctx = engine->mainDrawContext;
+    cache.positions = std::span(ctx.positions).subspan(vertexBase);
+    cache.vertices = std::span(ctx.vertices).subspan(vertexBase);
+    cache.materials = std::span(ctx.standard_materials).subspan(matBase);
+
+    cache.indices.assign(indices.begin() + indexBase, indices.end());
+    for (uint32_t& index : cache.indices)
+    {
+      index -= vertexBase;
+    }
+
+    // meshes and asset.meshes line up, every mesh is followed by its own surfaces
+    for (size_t i = 0; i < meshes.size(); i++)
+    {
+      const std::shared_ptr<MeshAsset>& mesh = meshes[i];
+      cache.meshes.push_back({
+        .name = cache.add_string(asset.meshes[i].name),
+        .firstSurface = (uint32_t) cache.surfaces.size(),
+        .surfaceCount = (uint32_t) mesh->surfaces.size(),
+      });
+      for (GeoSurface surface : mesh->surfaces)
+      {
+        surface.startIndex -= indexBase;
+        surface.mat_idx -= matBase;
+        cache.surfaces.push_back(surface);
+      }
+    }
+
+    for (size_t i = 0; i < asset.nodes.size(); i++)
+    {
+      fastgltf::Node& node = asset.nodes[i];
+      cache.nodes.push_back({
+        .localTransform = nodes[i]->localTransform,
+        .name = cache.add_string(node.name),
+        .mesh = node.meshIndex.has_value() ? (int32_t) *node.meshIndex : -1,
+        .firstChild = (uint32_t) cache.nodeChildren.size(),
+        .childCount = (uint32_t) node.children.size(),
+      });
+      cache.nodeChildren.insert(cache.nodeChildren.end(), node.children.begin(), node.children.end());
+    }
+
+    uint64_t imageOffset = 0;
+    for (size_t i = 0; i < asset.images.size(); i++)
+    {
+      cache.images.push_back({
+        .name = cache.add_string(asset.images[i].name),
+        .width = decoded[i].width,
+        .height = decoded[i].height,
+        .offset = imageOffset,
+        .size = decoded[i].pixels.size(),
+      });
+      imageOffset += decoded[i].pixels.size();
+      cache.imageData.push_back(std::move(decoded[i].pixels));
+    }
+
+    scene_cache::write(cachePath, source->first, source->second, cache);
+  }
+
   LA_LOG_INFO("Finished loading {}", filepath.c_str());
   return scene;
 }
 
+void benchmark_gltf_decode(const std::filesystem::path& directory)
+{
+  std::vector<std::filesystem::path> files;
+  for (const auto& entry : std::filesystem::directory_iterator(directory))
+  {
+    if (entry.path().extension() == ".glb" || entry.path().extension() == ".gltf")
+    {
+      files.push_back(entry.path());
+    }
+  }
+  std::sort(files.begin(), files.end());
+
+  constexpr int RUNS = 5; // best of, the first run also pays for page faults
+  const uint32_t threads = JobSystem::thread_count();
+
+  LA_LOG_INFO("GLTF decode benchmark, 1 vs {} threads, best of {}", threads, RUNS);
+
+  for (const std::filesystem::path& path : files)
+  {
+    auto parseStart = std::chrono::high_resolution_clock::now();
+    std::optional<fastgltf::Asset> asset = parse_gltf(path);
+    float parseMs = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - parseStart).count();
+    if (!asset.has_value())
+      continue;
+
+    size_t indexCount = 0, vertexCount = 0;
+    std::vector<PrimitiveRange> ranges = plan_primitives(*asset, indexCount, vertexCount);
+
+    struct Output
+    {
+      std::vector<uint32_t> indices;
+      std::vector<Vertex> vertices;
+      std::vector<glm::vec3> positions;
+    };
+
+    auto run = [&](uint32_t threadCount, Output& out) {
+      out.indices.assign(indexCount, 0);
+      out.vertices.assign(vertexCount, Vertex{});
+      out.positions.assign(vertexCount, glm::vec3{});
+
+      float best = std::numeric_limits<float>::max();
+      for (int i = 0; i < RUNS; i++)
+      {
+        auto start = std::chrono::high_resolution_clock::now();
+        decode_primitives(*asset, ranges, out.indices.data(), out.vertices.data(), out.positions.data(), threadCount);
+        best = glm::min(best, std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+      }
+      return best;
+    };
+
+    Output single, multi;
+    float singleMs = run(1, single);
+    float multiMs = run(threads, multi);
+
+    bool identical =
+      single.indices == multi.indices &&
+      single.positions == multi.positions &&
+      memcmp(single.vertices.data(), multi.vertices.data(), vertexCount * sizeof(Vertex)) == 0;
+
+    LA_LOG_INFO(
+      "{}: {} primitives, {} vertices | parse {:.2f}ms | 1 thread {:.2f}ms | {} threads {:.2f}ms ({:.2f}x) | {}",
+      path.filename().string(), ranges.size(), vertexCount, parseMs, singleMs, threads, multiMs,
+      singleMs / glm::max(multiMs, 0.001f), identical ? "identical" : "MISMATCH"
+    );
+  }
+}
+
 VkFilter extract_filter(fastgltf::Filter filter)
 {
   switch (filter)
@@ -393,12 +842,35 @@ void LoadedGLTF::clearAll()
 
 }
 
-std::optional<AllocatedImage> load_image(Engine* engine, fastgltf::Asset& asset, fastgltf::Image& image, std::filesystem::path fpath)
+std::optional<AllocatedImage> load_image(Engine* engine, fastgltf::Asset& asset, fastgltf::Image& image, std::filesystem::path fpath, DecodedImage* keep)
 {
 
   AllocatedImage newImage{};
   int width, height, nrChannels;
 
+  auto upload = [&](unsigned char* data) {
+    if (!data)
+      return;
+
+    VkExtent3D imagesize;
+    imagesize.width = width;
+    imagesize.height = height;
+    imagesize.depth = 1;
+
+    newImage = engine->create_image(
+        data, imagesize, VK_FORMAT_R8G8B8A8_UNORM,
+        VK_IMAGE_USAGE_SAMPLED_BIT, true);
+
+    if (keep)
+    {
+      keep->pixels.assign(data, data + (size_t) width * height * 4);
+      keep->width = width;
+      keep->height = height;
+    }
+
+    stbi_image_free(data);
+  };
+
   std::visit(
     fastgltf::visitor{
         [](auto &arg) {
@@ -426,36 +898,14 @@ std::optional<AllocatedImage> load_image(Engine* engine, fastgltf::Asset& asset,
           
           unsigned char *data =
               stbi_load(path.c_str(), &width, &height, &nrChannels, 4);
-          if (data) {
-            VkExtent3D imagesize;
-            imagesize.width = width;
-            imagesize.height = height;
-            imagesize.depth = 1;
-
-            newImage = engine->create_image(
-                data, imagesize, VK_FORMAT_R8G8B8A8_UNORM,
-                VK_IMAGE_USAGE_SAMPLED_BIT, true);
-
-            stbi_image_free(data);
-          }
+          upload(data);
         },
         [&](fastgltf::sources::Vector &vector) {
           unsigned char *data =
               stbi_load_from_memory((unsigned char *)vector.bytes.data(),
                                     static_cast<int>(vector.bytes.size()),
                                     &width, &height, &nrChannels, 4);
-          if (data) {
-            VkExtent3D imagesize;
-            imagesize.width = width;
-            imagesize.height = height;
-            imagesize.depth = 1;
-
-            newImage = engine->create_image(
-                data, imagesize, VK_FORMAT_R8G8B8A8_UNORM,
-                VK_IMAGE_USAGE_SAMPLED_BIT, true);
-
-            stbi_image_free(data);
-          }
+          upload(data);
         },
         [&](fastgltf::sources::BufferView &view) {
           auto &bufferView = asset.bufferViews[view.bufferViewIndex];
@@ -480,18 +930,7 @@ std::optional<AllocatedImage> load_image(Engine* engine, fastgltf::Asset& asset,
                                           bufferView.byteOffset),
                         static_cast<int>(bufferView.byteLength), &width,
                         &height, &nrChannels, 4);
-                    if (data) {
-                      VkExtent3D imagesize;
-                      imagesize.width = width;
-                      imagesize.height = height;
-                      imagesize.depth = 1;
-
-                      newImage = engine->create_image(
-                          data, imagesize, VK_FORMAT_R8G8B8A8_UNORM,
-                          VK_IMAGE_USAGE_SAMPLED_BIT, true);
-
-                      stbi_image_free(data);
-                    }
+                    upload(data);
                   }},
               buffer.data);
         },
@@ -522,6 +961,7 @@ void MeshNode::queue_draw(const glm::mat4& topMatrix, DrawContext& ctx)
       .mesh_idx = (uint32_t) mesh_idx,
       .indexCount = s.count,
       .firstIndex = s.startIndex,
+      .bounds_idx = (uint32_t) ctx.sphere_bounds.size(),
     };
 
     // mutually exclusive flags
@@ -32,10 +32,20 @@ struct LoadedGLTF : public IRenderable
 private:
 };
 
+// rgba8 pixels kept around after upload so they can go into the scene cache
+struct DecodedImage
+{
+  std::vector<uint8_t> pixels;
+  uint32_t width{ 0 };
+  uint32_t height{ 0 };
+};
+
 std::optional<std::shared_ptr<LoadedGLTF>> load_gltf(Engine* engine, std::filesystem::path filepath);
 VkFilter extract_filter(fastgltf::Filter filter);
 VkSamplerMipmapMode extract_mipmap_mode(fastgltf::Filter filter);
-std::optional<AllocatedImage> load_image(Engine* engine, fastgltf::Asset& asset, fastgltf::Image& image, std::filesystem::path fpath);
+// decodes every gltf in a directory single threaded and on every worker, logs timings and checks the output matches
+void benchmark_gltf_decode(const std::filesystem::path& directory);
+std::optional<AllocatedImage> load_image(Engine* engine, fastgltf::Asset& asset, fastgltf::Image& image, std::filesystem::path fpath, DecodedImage* keep = nullptr);
 
 struct MeshNode : public Node
 {
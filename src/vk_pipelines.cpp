@@ -4,6 +4,7 @@
 #include "vk_initialisers.h"
 #include "la_asserts.h"
 #include "logger.h"
+#include "job_system.h"
 
 namespace Lucerna {
 
@@ -43,6 +44,250 @@ bool vkutil::load_shader_module(const char *filepath, VkDevice device, VkShaderM
   return true;
 }
 
+static uint64_t hash_bytes(const uint8_t* data, size_t size)
+{
+  // fnv-1a
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < size; i++)
+  {
+    hash = (hash ^ data[i]) * 1099511628211ull;
+  }
+  return hash;
+}
+
+void PipelineCache::init(VkDevice device, VkPhysicalDevice physicalDevice, const std::filesystem::path& path)
+{
+  this->device = device;
+  this->path = path;
+  vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+  std::vector<uint8_t> file;
+  std::ifstream in(path, std::ios::ate | std::ios::binary);
+  if (in.is_open())
+  {
+    file.resize((size_t) in.tellg());
+    in.seekg(0);
+    in.read(reinterpret_cast<char*>(file.data()), file.size());
+  }
+
+  VkPipelineCacheCreateInfo info{.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO, .pNext = nullptr};
+  if (!file.empty() && valid(file))
+  {
+    info.initialDataSize = file.size() - sizeof(Header);
+    info.pInitialData = file.data() + sizeof(Header);
+    LA_LOG_INFO("Loaded pipeline cache {} ({:.1f} KiB)", path.c_str(), info.initialDataSize / 1024.0f);
+  }
+
+  VK_CHECK_RESULT(vkCreatePipelineCache(device, &info, nullptr, &cache));
+}
+
+void PipelineCache::destroy()
+{
+  save();
+  vkDestroyPipelineCache(device, cache, nullptr);
+  cache = VK_NULL_HANDLE;
+}
+
+PipelineCache::Header PipelineCache::expected_header() const
+{
+  Header header{};
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.vendorID = properties.vendorID;
+  header.deviceID = properties.deviceID;
+  header.driverVersion = properties.driverVersion;
+  memcpy(header.uuid, properties.pipelineCacheUUID, VK_UUID_SIZE);
+  return header;
+}
+
+bool PipelineCache::valid(const std::vector<uint8_t>& file) const
+{
+  if (file.size() < sizeof(Header) + sizeof(VkPipelineCacheHeaderVersionOne))
+  {
+    LA_LOG_WARN("Pipeline cache {} is truncated, rebuilding", path.c_str());
+    return false;
+  }
+
+  Header header;
+  memcpy(&header, file.data(), sizeof(Header));
+  Header expected = expected_header();
+  if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION)
+  {
+    LA_LOG_INFO("Pipeline cache {} is from an older version, rebuilding", path.c_str());
+    return false;
+  }
+
+  if (header.vendorID != expected.vendorID || header.deviceID != expected.deviceID ||
+    header.driverVersion != expected.driverVersion || memcmp(header.uuid, expected.uuid, VK_UUID_SIZE) != 0)
+  {
+    LA_LOG_INFO("Pipeline cache {} is from another device or driver, rebuilding", path.c_str());
+    return false;
+  }
+
+  const uint8_t* data = file.data() + sizeof(Header);
+  if (header.dataSize != file.size() - sizeof(Header) || header.dataHash != hash_bytes(data, header.dataSize))
+  {
+    LA_LOG_WARN("Pipeline cache {} is corrupt, rebuilding", path.c_str());
+    return false;
+  }
+
+  // the driver checks its own header too, but a mismatch there is silently an empty cache
+  VkPipelineCacheHeaderVersionOne driverHeader;
+  memcpy(&driverHeader, data, sizeof(driverHeader));
+  if (driverHeader.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE || driverHeader.vendorID != expected.vendorID ||
+    driverHeader.deviceID != expected.deviceID || memcmp(driverHeader.pipelineCacheUUID, expected.uuid, VK_UUID_SIZE) != 0)
+  {
+    LA_LOG_WARN("Pipeline cache {} has a mismatching driver header, rebuilding", path.c_str());
+    return false;
+  }
+
+  return true;
+}
+
+bool PipelineCache::save() const
+{
+  size_t size = 0;
+  VK_CHECK_RESULT(vkGetPipelineCacheData(device, cache, &size, nullptr));
+  std::vector<uint8_t> data(size);
+  VK_CHECK_RESULT(vkGetPipelineCacheData(device, cache, &size, data.data()));
+  data.resize(size);
+
+  Header header = expected_header();
+  header.dataSize = size;
+  header.dataHash = hash_bytes(data.data(), size);
+
+  // written next to it and moved over so a crash never leaves half a cache behind
+  std::filesystem::path tmp = path;
+  tmp += ".tmp";
+  std::ofstream file(tmp, std::ios::binary | std::ios::trunc);
+  file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+  file.write(reinterpret_cast<const char*>(data.data()), size);
+  file.close();
+  if (file.fail())
+  {
+    LA_LOG_WARN("Failed writing pipeline cache {}", path.c_str());
+    std::filesystem::remove(tmp);
+    return false;
+  }
+
+  std::error_code ec;
+  std::filesystem::rename(tmp, path, ec);
+  if (ec)
+  {
+    LA_LOG_WARN("Could not move pipeline cache into place {}", ec.message());
+    return false;
+  }
+
+  LA_LOG_INFO("Wrote pipeline cache {} ({:.1f} KiB)", path.c_str(), size / 1024.0f);
+  return true;
+}
+
+void PipelineVariants::init(VkDevice device, std::string_view name, std::vector<uint32_t> constantIds, std::vector<VkShaderModule> modules, Builder&& builder)
+{
+  this->device = device;
+  this->name = name;
+  this->modules = std::move(modules);
+  this->builder = std::move(builder);
+
+  entries.clear();
+  for (uint32_t i = 0; i < constantIds.size(); i++)
+  {
+    entries.push_back({.constantID = constantIds[i], .offset = i * (uint32_t) sizeof(uint32_t), .size = sizeof(uint32_t)});
+  }
+}
+
+void PipelineVariants::destroy()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  idle.wait(lock, [this] { return building.empty(); });
+
+  for (auto& [values, pipeline] : pipelines)
+  {
+    vkDestroyPipeline(device, pipeline, nullptr);
+  }
+  for (VkShaderModule module : modules)
+  {
+    vkDestroyShaderModule(device, module, nullptr);
+  }
+  pipelines.clear();
+  modules.clear();
+  last = VK_NULL_HANDLE;
+}
+
+VkPipeline PipelineVariants::build(const std::vector<uint32_t>& values) const
+{
+  LA_LOG_ASSERT(values.size() == entries.size(), "{} takes {} specialization constants, got {}", name, entries.size(), values.size());
+
+  VkSpecializationInfo spec{
+    .mapEntryCount = (uint32_t) entries.size(),
+    .pMapEntries = entries.data(),
+    .dataSize = values.size() * sizeof(uint32_t),
+    .pData = values.data(),
+  };
+  VkPipeline pipeline = builder(spec);
+  vklog::label_pipeline(device, pipeline, name.c_str());
+  return pipeline;
+}
+
+VkPipeline PipelineVariants::get(const std::vector<uint32_t>& values)
+{
+  std::unique_lock<std::mutex> lock(mutex);
+
+  auto it = pipelines.find(values);
+  if (it != pipelines.end())
+  {
+    last = it->second;
+    return last;
+  }
+
+  // nothing to fall back on yet
+  if (last == VK_NULL_HANDLE)
+  {
+    lock.unlock();
+    VkPipeline pipeline = build(values);
+    lock.lock();
+
+    pipelines[values] = pipeline;
+    last = pipeline;
+    return last;
+  }
+
+  bool start = building.insert(values).second;
+  VkPipeline fallback = last;
+  // dispatch runs the job inline without workers
+  lock.unlock();
+
+  if (start)
+  {
+    JobSystem::dispatch([this, values] {
+      auto start = std::chrono::system_clock::now();
+      VkPipeline pipeline = build(values);
+      auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now() - start);
+      LA_LOG_INFO("Built a {} variant in {:.1f} ms", name, elapsed.count() / 1000.0f);
+
+      std::lock_guard<std::mutex> lock(mutex);
+      pipelines[values] = pipeline;
+      building.erase(values);
+      idle.notify_all();
+    });
+  }
+  return fallback;
+}
+
+uint32_t PipelineVariants::count() const
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return pipelines.size();
+}
+
+void PipelineBuilder::set_specialization(const VkSpecializationInfo* spec)
+{
+  for (VkPipelineShaderStageCreateInfo& stage : m_ShaderStages)
+  {
+    stage.pSpecializationInfo = spec;
+  }
+}
+
 void PipelineBuilder::clear()
 {
   m_InputAssembly = { .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO };
@@ -52,12 +297,14 @@ void PipelineBuilder::clear()
   m_RenderInfo = { .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO };
   
   m_ColorBlendAttachment = {};
+  m_ColorBlendAttachments.clear();
+  m_ColorAttachmentFormats.clear();
   PipelineLayout = {};
 
   m_ShaderStages.clear();
 }
 
-VkPipeline PipelineBuilder::build_pipeline(VkDevice device)
+VkPipeline PipelineBuilder::build_pipeline(VkDevice device, VkPipelineCache cache)
 {
   VkPipelineViewportStateCreateInfo viewportState{};
   viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
@@ -75,6 +322,11 @@ VkPipeline PipelineBuilder::build_pipeline(VkDevice device)
   colorBlending.logicOp = VK_LOGIC_OP_COPY;
   colorBlending.attachmentCount = 1;
   colorBlending.pAttachments = &m_ColorBlendAttachment;
+  if (!m_ColorBlendAttachments.empty())
+  {
+    colorBlending.attachmentCount = m_ColorBlendAttachments.size();
+    colorBlending.pAttachments = m_ColorBlendAttachments.data();
+  }
    
   // NOTE: (UNUSED as im using BDA), normally used for specifying vertex attribute format
   VkPipelineVertexInputStateCreateInfo vertexInputInfo = { .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO };
@@ -103,7 +355,7 @@ VkPipeline PipelineBuilder::build_pipeline(VkDevice device)
   pipelineInfo.pDynamicState = &dynamicInfo;
 
   VkPipeline newPipeline;
-  VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &newPipeline));
+  VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, cache, 1, &pipelineInfo, nullptr, &newPipeline));
   return newPipeline;
 }
 
@@ -181,6 +433,38 @@ void PipelineBuilder::enable_blending_alphablend()
   m_ColorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
 }
 
+void PipelineBuilder::enable_blending_weighted_oit()
+{
+  VkPipelineColorBlendAttachmentState accumulation{};
+  accumulation.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+  accumulation.blendEnable = VK_TRUE;
+  accumulation.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+  accumulation.dstColorBlendFactor = VK_BLEND_FACTOR_ONE;
+  accumulation.colorBlendOp = VK_BLEND_OP_ADD;
+  accumulation.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+  accumulation.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+  accumulation.alphaBlendOp = VK_BLEND_OP_ADD;
+
+  VkPipelineColorBlendAttachmentState revealage{};
+  revealage.colorWriteMask = VK_COLOR_COMPONENT_R_BIT;
+  revealage.blendEnable = VK_TRUE;
+  revealage.srcColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+  revealage.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_COLOR;
+  revealage.colorBlendOp = VK_BLEND_OP_ADD;
+  revealage.srcAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+  revealage.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+  revealage.alphaBlendOp = VK_BLEND_OP_ADD;
+
+  m_ColorBlendAttachments = {accumulation, revealage};
+}
+
+void PipelineBuilder::set_color_attachment_formats(std::span<const VkFormat> formats)
+{
+  m_ColorAttachmentFormats.assign(formats.begin(), formats.end());
+  m_RenderInfo.colorAttachmentCount = m_ColorAttachmentFormats.size();
+  m_RenderInfo.pColorAttachmentFormats = m_ColorAttachmentFormats.data();
+}
+
 void PipelineBuilder::set_color_attachment_format(VkFormat format)
 {
   m_ColorAttachmentFormat = format;
@@ -3,14 +3,20 @@
 #include <volk.h>
 #include <vulkan/vulkan_core.h>
 
+#include <condition_variable>
+#include <mutex>
+#include <span>
+
 namespace Lucerna {
 
 class PipelineBuilder
 {
   public:
     PipelineBuilder() { clear(); }
-    VkPipeline build_pipeline(VkDevice device);
+    VkPipeline build_pipeline(VkDevice device, VkPipelineCache cache = VK_NULL_HANDLE);
     void set_shaders(VkShaderModule vertexShader, VkShaderModule fragmentShader);
+    // applies to every stage set so far, spec has to outlive build_pipeline
+    void set_specialization(const VkSpecializationInfo* spec);
     void set_input_topology(VkPrimitiveTopology topology);
     void set_polygon_mode(VkPolygonMode mode);
     void set_cull_mode(VkCullModeFlags cullMode, VkFrontFace);
@@ -18,7 +24,10 @@ class PipelineBuilder
     void disable_blending();
     void enable_blending_additive();
     void enable_blending_alphablend();
+    // accumulation (rgba summed) and revealage (scaled by 1 - src) of weighted blended oit, one blend state each
+    void enable_blending_weighted_oit();
     void set_color_attachment_format(VkFormat format);
+    void set_color_attachment_formats(std::span<const VkFormat> formats);
     void set_depth_format(VkFormat format);
     void disable_depthtest();
     void enable_depthtest(bool depthWriteEnable, VkCompareOp op);
@@ -35,11 +44,85 @@ class PipelineBuilder
     VkPipelineDepthStencilStateCreateInfo m_DepthStencil{};
     VkPipelineRenderingCreateInfo m_RenderInfo{};
     VkFormat m_ColorAttachmentFormat{};
+    std::vector<VkFormat> m_ColorAttachmentFormats{};
+    std::vector<VkPipelineColorBlendAttachmentState> m_ColorBlendAttachments{}; // per attachment, empty uses m_ColorBlendAttachment
 
     void clear();
 };
 
 
+// VkPipelineCache kept in a file between runs. the blob is only handed to the driver when the header in front of it
+// matches this device and driver and its hash checks out, anything else starts empty and is replaced on save.
+// vkCreate*Pipelines may use it from several threads at once, the driver synchronises the cache internally
+class PipelineCache
+{
+  public:
+    void init(VkDevice device, VkPhysicalDevice physicalDevice, const std::filesystem::path& path);
+    // saves, then destroys the cache
+    void destroy();
+    bool save() const;
+
+    VkPipelineCache handle() const { return cache; }
+  private:
+    static constexpr char MAGIC[4] = {'L', 'P', 'S', 'O'};
+    // bump when the header changes
+    static constexpr uint32_t VERSION = 1;
+
+    struct Header
+    {
+      char magic[4];
+      uint32_t version;
+      uint32_t vendorID;
+      uint32_t deviceID;
+      uint32_t driverVersion;
+      uint8_t uuid[VK_UUID_SIZE]; // pipelineCacheUUID
+      uint64_t dataSize;
+      uint64_t dataHash;
+    };
+
+    Header expected_header() const;
+    bool valid(const std::vector<uint8_t>& file) const;
+
+    VkDevice device{};
+    VkPhysicalDeviceProperties properties{};
+    std::filesystem::path path;
+    VkPipelineCache cache{};
+};
+
+// pipelines that only differ in their specialization constants (quality settings baked into the shader).
+// every distinct set of values is built once and kept until destroy. a set that isnt built yet is compiled
+// on the job system and get() keeps returning the last pipeline it handed out until it is ready,
+// only the very first one is built on the calling thread
+class PipelineVariants
+{
+  public:
+    // builds a pipeline for spec (one 4 byte value per constant id), may run on any thread
+    using Builder = std::function<VkPipeline(const VkSpecializationInfo& spec)>;
+
+    // the variants own modules, they are destroyed with them
+    void init(VkDevice device, std::string_view name, std::vector<uint32_t> constantIds, std::vector<VkShaderModule> modules, Builder&& builder);
+    // waits for the builds still running
+    void destroy();
+
+    // values in the order of the constant ids, thread safe
+    VkPipeline get(const std::vector<uint32_t>& values);
+    uint32_t count() const;
+  private:
+    VkPipeline build(const std::vector<uint32_t>& values) const;
+
+    VkDevice device{};
+    std::string name;
+    std::vector<VkSpecializationMapEntry> entries;
+    std::vector<VkShaderModule> modules;
+    Builder builder;
+
+    mutable std::mutex mutex;
+    std::condition_variable idle;
+    std::map<std::vector<uint32_t>, VkPipeline> pipelines;
+    std::set<std::vector<uint32_t>> building;
+    VkPipeline last{};
+};
+
 namespace vkutil
 {
 // NOTE: std::filesystem::path and optional that retuns "placeholder" shader pipeline if it fails.
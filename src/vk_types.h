@@ -1,10 +1,12 @@
 #pragma once
 #include <cstdint>
+#include <mutex>
 #include <volk.h>
 #include "la_asserts.h"
 #include "vk_mem_alloc.h"
 #include "lucerna_pch.h"
 #include "logger.h"
+#include "vk_descriptors.h"
 
 
 
@@ -47,6 +49,7 @@ namespace Lucerna {
     AllocatedBuffer materialBuffer{};
     AllocatedBuffer transformBuffer{};
     AllocatedBuffer boundsBuffer{};
+    AllocatedBuffer lightBuffer{}; // GPULights, never empty so it can always be bound
   };
 
 
@@ -58,8 +61,10 @@ namespace Lucerna {
   struct DeletionQueue
   {
     std::deque<std::function<void()>> deletors;
+    std::mutex mutex; // init pushes from the pipeline jobs
     void push_function(std::function<void()>&& function)
     {
+      std::lock_guard<std::mutex> lock(mutex);
       deletors.push_back(function);
     }
     
@@ -73,6 +78,31 @@ namespace Lucerna {
     }
   };
 
+  // deletors that run once a timeline semaphore has reached the value they were pushed with
+  struct TimelineDeletionQueue
+  {
+    std::deque<std::pair<uint64_t, std::function<void()>>> deletors;
+    void push_function(uint64_t value, std::function<void()>&& function)
+    {
+      deletors.push_back({value, std::move(function)});
+    }
+
+    // values are pushed in increasing order
+    void collect(uint64_t completed)
+    {
+      while (!deletors.empty() && deletors.front().first <= completed)
+      {
+        deletors.front().second();
+        deletors.pop_front();
+      }
+    }
+
+    void flush()
+    {
+      collect(UINT64_MAX);
+    }
+  };
+
   enum class MaterialPass:uint8_t 
   {
     MainColour,
@@ -119,10 +149,14 @@ namespace Lucerna {
 #include "common.h"
 #include "zprepass/zprepass.vert"
 #include "shadow/shadow_map.vert"
+#include "shadow/shadow_mask.comp"
+#include "lighting/light_cull.comp"
+#include "oit/oit_composite.comp"
 #include "debug_line/debug_line.vert"
 #include "ssao/ssao.comp"
 #include "ssao/bilateral_filter.comp"
 #include "culling/indirect_cull.comp"
+#include "culling/depth_pyramid.comp"
 
   struct GeoSurface
   {
@@ -141,13 +175,25 @@ namespace Lucerna {
 
 
   // still using global buffers
+  // compacted draws of one cull view, drawn with vkCmdDrawIndexedIndirectCount
+  struct IndirectList
+  {
+    AllocatedBuffer draws;
+    AllocatedBuffer count; // host visible, read back for stats
+  };
+
   struct DrawSetBuffers
   {
     AllocatedBuffer draw_data;
-    AllocatedBuffer indirect_draws;
-    AllocatedBuffer indirect_count;
-    AllocatedBuffer partialSums;
-    AllocatedBuffer outputCompact;
+    IndirectList indirect;
+    AllocatedBuffer lookback; // per group and view state of the single pass compaction
+
+    // draws that became visible after the depth pyramid was built, see culling.glsl
+    IndirectList late_indirect;
+    // extra views culled with the camera in the early phase (shadow casters), one list each
+    std::vector<IndirectList> view_indirect;
+    AllocatedBuffer visibility;    // two halves of one uint per draw, swapped every frame
+    AllocatedBuffer cull_counters; // one CullCounters per frame in flight, host visible
   };
 
 
@@ -155,9 +201,15 @@ namespace Lucerna {
   {
     std::vector<DrawData> draw_datas;
     DrawSetBuffers buffers;
+    CullCounters stats{}; // from the last frame that finished in this frame slot
 
     VkPipeline pipeline;
     std::string name;
+    uint32_t extra_views{ 0 }; // size of buffers.view_indirect, at most MAX_CULL_VIEWS - 1
+
+    // one per frame in flight, rewritten only when the scene or draw set buffers change
+    std::vector<PersistentDescriptorSet> sceneSets;
+    std::vector<PersistentDescriptorSet> cullSets;
   };
 
 
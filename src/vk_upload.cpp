@@ -0,0 +1,253 @@
+#include "vk_upload.h"
+#include "vk_initialisers.h"
+#include "vk_images.h"
+#include "la_asserts.h"
+#include "logger.h"
+#include <vulkan/vulkan_core.h>
+
+namespace Lucerna {
+
+void UploadBatcher::init(VkDevice device, VmaAllocator allocator, VkQueue queue, std::mutex* queueMutex, uint32_t queueFamily, VkDeviceSize blockSize)
+{
+  this->device = device;
+  this->allocator = allocator;
+  this->queue = queue;
+  this->queueMutex = queueMutex;
+  this->blockSize = blockSize;
+
+  VkCommandPoolCreateInfo poolInfo = vkinit::command_pool_create_info(queueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+  VK_CHECK_RESULT(vkCreateCommandPool(device, &poolInfo, nullptr, &pool));
+
+  VkSemaphoreTypeCreateInfo typeInfo{.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO, .pNext = nullptr};
+  typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+  typeInfo.initialValue = 0;
+
+  VkSemaphoreCreateInfo semaphoreInfo = vkinit::semaphore_create_info(0);
+  semaphoreInfo.pNext = &typeInfo;
+  VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &timeline));
+}
+
+void UploadBatcher::destroy()
+{
+  flush();
+  wait(submitted);
+  collect();
+
+  for (StagingBlock& b : freeBlocks)
+  {
+    vmaDestroyBuffer(allocator, b.buffer.buffer, b.buffer.allocation);
+  }
+  freeBlocks.clear();
+  freeCommandBuffers.clear();
+
+  vkDestroyCommandPool(device, pool, nullptr);
+  vkDestroySemaphore(device, timeline, nullptr);
+}
+
+UploadBatcher::StagingBlock UploadBatcher::create_block(VkDeviceSize size)
+{
+  StagingBlock block{.capacity = size};
+
+  VkBufferCreateInfo bufferInfo{.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO, .pNext = nullptr};
+  bufferInfo.size = size;
+  bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+
+  VmaAllocationCreateInfo allocInfo{};
+  allocInfo.usage = VMA_MEMORY_USAGE_CPU_ONLY;
+  allocInfo.flags = VMA_ALLOCATION_CREATE_MAPPED_BIT;
+
+  VK_CHECK_RESULT(vmaCreateBuffer(allocator, &bufferInfo, &allocInfo, &block.buffer.buffer, &block.buffer.allocation, &block.buffer.info));
+  vklog::label_buffer(device, block.buffer.buffer, "Upload Staging Block");
+  return block;
+}
+
+VkCommandBuffer UploadBatcher::open_batch()
+{
+  if (current.has_value())
+    return current->cmd;
+
+  current = Batch{};
+  if (!freeCommandBuffers.empty())
+  {
+    current->cmd = freeCommandBuffers.back();
+    freeCommandBuffers.pop_back();
+    VK_CHECK_RESULT(vkResetCommandBuffer(current->cmd, 0));
+  }
+  else
+  {
+    VkCommandBufferAllocateInfo allocInfo = vkinit::command_buffer_allocate_info(pool, 1);
+    VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &allocInfo, &current->cmd));
+  }
+
+  VkCommandBufferBeginInfo beginInfo = vkinit::command_buffer_begin_info(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+  VK_CHECK_RESULT(vkBeginCommandBuffer(current->cmd, &beginInfo));
+  return current->cmd;
+}
+
+uint8_t* UploadBatcher::reserve(VkDeviceSize size, VkBuffer& buffer, VkDeviceSize& offset)
+{
+  open_batch();
+
+  // 16 covers the texel size of every format we upload and the 4 byte requirement of buffer copies
+  constexpr VkDeviceSize alignment = 16;
+
+  StagingBlock* block = current->blocks.empty() ? nullptr : &current->blocks.back();
+  VkDeviceSize aligned = block ? (block->head + alignment - 1) & ~(alignment - 1) : 0;
+
+  if (block == nullptr || aligned + size > block->capacity)
+  {
+    if (current->blocks.size() >= MAX_BLOCKS_PER_BATCH)
+    {
+      flush_locked();
+      // the render loop only collects once a frame, loading stalls here instead of staging ahead of the gpu
+      if (inFlight.size() > MAX_BATCHES_IN_FLIGHT)
+      {
+        wait(inFlight.front().value);
+      }
+      open_batch();
+    }
+    collect_locked();
+
+    // reuse a finished block if it fits, oversized uploads get a dedicated one
+    auto it = std::find_if(freeBlocks.begin(), freeBlocks.end(), [&](const StagingBlock& b) { return b.capacity >= size; });
+    if (it != freeBlocks.end())
+    {
+      current->blocks.push_back(*it);
+      freeBlocks.erase(it);
+    }
+    else
+    {
+      current->blocks.push_back(create_block(glm::max(blockSize, size)));
+    }
+
+    block = &current->blocks.back();
+    block->head = 0;
+    aligned = 0;
+  }
+
+  block->head = aligned + size;
+  buffer = block->buffer.buffer;
+  offset = aligned;
+  return (uint8_t*) block->buffer.info.pMappedData + aligned;
+}
+
+void UploadBatcher::enqueue_buffer(VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size)
+{
+  if (size == 0)
+    return;
+
+  std::lock_guard<std::mutex> lock(mutex);
+
+  VkBuffer src;
+  VkDeviceSize srcOffset;
+  memcpy(reserve(size, src, srcOffset), data, size);
+
+  VkBufferCopy copy{};
+  copy.srcOffset = srcOffset;
+  copy.dstOffset = dstOffset;
+  copy.size = size;
+  vkCmdCopyBuffer(current->cmd, src, dst, 1, &copy);
+}
+
+void UploadBatcher::enqueue_image(const AllocatedImage& image, const void* data, VkDeviceSize size, bool mipmapped)
+{
+  std::lock_guard<std::mutex> lock(mutex);
+
+  VkBuffer src;
+  VkDeviceSize srcOffset;
+  memcpy(reserve(size, src, srcOffset), data, size);
+
+  VkCommandBuffer cmd = current->cmd;
+  vkutil::transition_image(cmd, image.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+
+  VkBufferImageCopy copyRegion{};
+  copyRegion.bufferOffset = srcOffset;
+  copyRegion.bufferRowLength = 0;
+  copyRegion.bufferImageHeight = 0;
+  copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  copyRegion.imageSubresource.mipLevel = 0;
+  copyRegion.imageSubresource.baseArrayLayer = 0;
+  copyRegion.imageSubresource.layerCount = 1;
+  copyRegion.imageExtent = image.imageExtent;
+  vkCmdCopyBufferToImage(cmd, src, image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copyRegion);
+
+  if (mipmapped)
+  {
+    vkutil::generate_mipmaps(cmd, image.image, VkExtent2D{image.imageExtent.width, image.imageExtent.height});
+  }
+  else
+  {
+    vkutil::transition_image(cmd, image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+  }
+}
+
+uint64_t UploadBatcher::flush()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  return flush_locked();
+}
+
+uint64_t UploadBatcher::flush_locked()
+{
+  if (!current.has_value())
+    return submitted;
+
+  VK_CHECK_RESULT(vkEndCommandBuffer(current->cmd));
+
+  current->value = ++submitted;
+
+  VkCommandBufferSubmitInfo cmdInfo = vkinit::command_buffer_submit_info(current->cmd);
+  VkSemaphoreSubmitInfo signalInfo = vkinit::semaphore_submit_info(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, timeline);
+  signalInfo.value = current->value;
+
+  VkSubmitInfo2 submit = vkinit::submit_info(&cmdInfo, &signalInfo, nullptr);
+  {
+    std::lock_guard<std::mutex> queueLock(*queueMutex);
+    VK_CHECK_RESULT(vkQueueSubmit2(queue, 1, &submit, VK_NULL_HANDLE));
+  }
+
+  inFlight.push_back(std::move(*current));
+  current.reset();
+  return submitted;
+}
+
+void UploadBatcher::collect()
+{
+  std::lock_guard<std::mutex> lock(mutex);
+  collect_locked();
+}
+
+void UploadBatcher::collect_locked()
+{
+  uint64_t completed = 0;
+  VK_CHECK_RESULT(vkGetSemaphoreCounterValue(device, timeline, &completed));
+
+  while (!inFlight.empty() && inFlight.front().value <= completed)
+  {
+    Batch& b = inFlight.front();
+    freeCommandBuffers.push_back(b.cmd);
+    freeBlocks.insert(freeBlocks.end(), b.blocks.begin(), b.blocks.end());
+    inFlight.pop_front();
+  }
+
+  // keep one block around for runtime uploads, the load time ones can go
+  while (freeBlocks.size() > 1 && inFlight.empty() && !current.has_value())
+  {
+    vmaDestroyBuffer(allocator, freeBlocks.back().buffer.buffer, freeBlocks.back().buffer.allocation);
+    freeBlocks.pop_back();
+  }
+}
+
+void UploadBatcher::wait(uint64_t value)
+{
+  if (value == 0)
+    return;
+
+  VkSemaphoreWaitInfo waitInfo{.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO, .pNext = nullptr};
+  waitInfo.semaphoreCount = 1;
+  waitInfo.pSemaphores = &timeline;
+  waitInfo.pValues = &value;
+  VK_CHECK_RESULT(vkWaitSemaphores(device, &waitInfo, UINT64_MAX));
+}
+
+} // namespace Lucerna
@@ -0,0 +1,75 @@
+#pragma once
+#include <volk.h>
+#include "lucerna_pch.h"
+#include "vk_types.h"
+
+#include <mutex>
+
+namespace Lucerna {
+
+// batches staging uploads into as few submissions as possible. enqueue only copies into a shared
+// staging arena and records the copy (and mip generation) into the open batch, flush submits it and
+// signals a timeline semaphore so nothing waits on the cpu until the data is actually needed
+class UploadBatcher
+{
+  public:
+    // queueMutex guards every submission to queue, loader threads flush full batches on their own
+    void init(VkDevice device, VmaAllocator allocator, VkQueue queue, std::mutex* queueMutex, uint32_t queueFamily, VkDeviceSize blockSize);
+    void destroy();
+
+    // safe to call from loader threads, data is copied before returning.
+    // a full batch is submitted from the calling thread, which blocks once too many are in flight
+    void enqueue_buffer(VkBuffer dst, VkDeviceSize dstOffset, const void* data, VkDeviceSize size);
+    void enqueue_image(const AllocatedImage& image, const void* data, VkDeviceSize size, bool mipmapped);
+
+    // submits the open batch, returns the timeline value that signals once it has completed
+    uint64_t flush();
+    // recycles staging blocks and command buffers of batches the gpu has finished with
+    void collect();
+    void wait(uint64_t value);
+
+    VkSemaphore semaphore() const { return timeline; }
+    uint64_t last_submitted() const { return submitted; }
+  private:
+    struct StagingBlock
+    {
+      AllocatedBuffer buffer{};
+      VkDeviceSize capacity{ 0 };
+      VkDeviceSize head{ 0 };
+    };
+
+    struct Batch
+    {
+      VkCommandBuffer cmd{};
+      std::vector<StagingBlock> blocks;
+      uint64_t value{ 0 };
+    };
+
+    VkCommandBuffer open_batch();
+    uint8_t* reserve(VkDeviceSize size, VkBuffer& buffer, VkDeviceSize& offset);
+    StagingBlock create_block(VkDeviceSize size);
+    uint64_t flush_locked();
+    void collect_locked();
+
+    // flush automatically once a batch holds this many blocks, past MAX_BATCHES_IN_FLIGHT the oldest
+    // batch is waited on so staging memory stays bounded while loader threads outrun the gpu
+    static constexpr uint32_t MAX_BLOCKS_PER_BATCH = 4;
+    static constexpr uint32_t MAX_BATCHES_IN_FLIGHT = 2;
+
+    VkDevice device{};
+    VmaAllocator allocator{};
+    VkQueue queue{};
+    std::mutex* queueMutex{ nullptr };
+    VkCommandPool pool{};
+    VkSemaphore timeline{};
+    VkDeviceSize blockSize{ 0 };
+    uint64_t submitted{ 0 };
+
+    std::optional<Batch> current;
+    std::deque<Batch> inFlight;
+    std::vector<StagingBlock> freeBlocks;
+    std::vector<VkCommandBuffer> freeCommandBuffers;
+    std::mutex mutex;
+};
+
+} // namespace Lucerna